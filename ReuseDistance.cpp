@@ -19,6 +19,18 @@
  */
 
 #include <ReuseDistance.hpp>
+#include <ReuseExport.hpp>
+#include <ReuseIndex.hpp>
+#include <ReuseThreads.hpp>
+#include <ReuseWindow.hpp>
+#include <SpatialWindow.hpp>
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <sstream>
 
 using namespace std;
 
@@ -29,14 +41,152 @@ using namespace std;
 #define debug_assert(...)
 #endif
 
-inline uint64_t uint64abs(uint64_t a){
-    if (a < 0x8000000000000000L){
-        return a;
-    } else {
-        return 0 - a;
-    }
+// time a sample of Process calls, see ReuseEngineStats::latency
+//#define REUSE_LATENCY
+#ifdef REUSE_LATENCY
+static inline uint64_t LatencyNow(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+#define latency_begin() uint64_t __lstart = ((latencycalls++ % LatencySampleRate) == 0) ? LatencyNow() : 0
+#define latency_end() if (__lstart) latency->Update(LatencyNow() - __lstart)
+#else
+#define latency_begin()
+#define latency_end()
+#endif
+
+// the sampling hash needs to spread nearby addresses over all of its low bits
+static inline uint64_t SampleHash(uint64_t addr){
+    addr ^= addr >> 33;
+    addr *= 0xFF51AFD7ED558CCDL;
+    addr ^= addr >> 33;
+    addr *= 0xC4CEB9FE1A85EC53L;
+    addr ^= addr >> 33;
+    return addr;
 }
 
+// bins are handed out in blocks whose capacities are powers of 2 from 2 to SpillBins, carved
+// from large slabs. freed blocks go onto a list for their capacity and are reused from there,
+// so per-id bin arrays cost no allocator overhead
+class ReuseBinArena {
+private:
+    static const uint32_t SlabBins = 8192;
+    static const uint32_t Classes = 8;
+
+    vector<ReuseBin*> slabs;
+    ReuseBin* next;
+    uint32_t left;
+    ReuseBin* freelist[Classes];
+
+    static uint32_t Class(uint32_t cap){
+        uint32_t c = 0;
+        while ((1U << c) < cap){
+            c++;
+        }
+        assert(c < Classes);
+        return c;
+    }
+
+public:
+    ReuseBinArena() : next(NULL), left(0) {
+        memset(freelist, 0, sizeof(freelist));
+    }
+
+    ~ReuseBinArena(){
+        for (uint32_t i = 0; i < slabs.size(); i++){
+            delete[] slabs[i];
+        }
+    }
+
+    ReuseBin* Alloc(uint32_t cap){
+        uint32_t c = Class(cap);
+        ReuseBin* b = freelist[c];
+        if (b){
+            // the first bin of a free block holds the next free block
+            freelist[c] = *(ReuseBin**)b;
+            return b;
+        }
+        if (left < cap){
+            next = new ReuseBin[SlabBins];
+            left = SlabBins;
+            slabs.push_back(next);
+        }
+        b = next;
+        next += cap;
+        left -= cap;
+        return b;
+    }
+
+    void Free(ReuseBin* b, uint32_t cap){
+        uint32_t c = Class(cap);
+        *(ReuseBin**)b = freelist[c];
+        freelist[c] = b;
+    }
+
+    uint64_t GetSlabCount(){
+        return slabs.size();
+    }
+
+    uint64_t GetBytes(){
+        return slabs.size() * SlabBins * sizeof(ReuseBin);
+    }
+};
+
+// a Fenwick tree of counts over [0, size)
+class BulkCounter {
+private:
+    vector<uint32_t> tree;
+
+public:
+    void Reset(uint64_t size){
+        tree.assign(size + 1, 0);
+    }
+
+    void Add(uint64_t i, int32_t v){
+        for (i++; i < tree.size(); i += i & (~i + 1)){
+            tree[i] += v;
+        }
+    }
+
+    // the sum over [0, i)
+    uint64_t Before(uint64_t i){
+        uint64_t sum = 0;
+        for (; i > 0; i &= i - 1){
+            sum += tree[i];
+        }
+        return sum;
+    }
+};
+
+// one distinct address of a batch
+struct BulkAddress {
+    uint64_t address;
+
+    // the position of its latest access in the batch
+    uint64_t last;
+
+    // its slot in the index
+    uint64_t slot;
+};
+
+struct ReuseBulk {
+    // [address hash -> 1 + index in addresses, or 0 if empty]. an open-addressed table with at
+    // least twice as many slots as a batch has addresses, which is emptied after every batch
+    vector<uint32_t> index;
+    uint64_t mask;
+    vector<BulkAddress> addresses;
+
+    // the index in addresses of each access
+    vector<uint32_t> which;
+
+    // the latest access to each address, by position in the batch
+    BulkCounter latest;
+
+    // window entries removed by the batch, to be reused
+    vector<ReuseEntry*> slots;
+};
+
 void ReuseDistance::Init(uint64_t w, uint64_t b){
     capacity = w;
     binindividual = b;
@@ -48,7 +198,38 @@ void ReuseDistance::Init(uint64_t w, uint64_t b){
     window = newtree234();
     assert(window);
 
-    mwindow.clear();
+    membudget = ReuseDistance::Infinity;
+    sampleshift = 0;
+    samplemask = 0;
+    windowcapacity = capacity;
+    degradations.clear();
+
+    statsconfig.binindividual = binindividual;
+    statsconfig.maxtracking = capacity;
+    statsconfig.invalid = ReuseDistance::Infinity;
+    statsconfig.arena = new ReuseBinArena();
+
+    aggregate = NULL;
+    aggregatesequence = 0;
+
+    bulk = NULL;
+    bulkskip = 0;
+    batchable = true;
+
+    exporter = NULL;
+    exportinterval = 0;
+    exportleft = 0;
+
+    mwindow = NULL;
+    windowengine = NULL;
+    SetWindow(WindowAuto, IndexHash);
+
+    // latencies are binned by powers of two
+    latency = NULL;
+    latencycalls = 0;
+#ifdef REUSE_LATENCY
+    latency = new ReuseStats(0, 1, ReuseDistance::Infinity, INVALID_SPATIAL);
+#endif
 
     assert(ReuseDistance::Infinity == NULL && "NULL is non-zero!?");
 }
@@ -61,10 +242,71 @@ ReuseDistance::ReuseDistance(uint64_t w){
     ReuseDistance::Init(w, DefaultBinIndividual);
 }
 
+ReuseDistance::ReuseDistance(uint64_t w, uint64_t b, uint64_t m){
+    ReuseDistance::Init(w, b);
+    membudget = m;
+    SetWindow(WindowAuto, IndexHash);
+}
+
+ReuseDistance::ReuseDistance(uint64_t w, uint64_t b, uint64_t m, uint32_t e){
+    ReuseDistance::Init(w, b);
+    membudget = m;
+    SetWindow(e, IndexHash);
+}
+
+ReuseDistance::ReuseDistance(uint64_t w, uint64_t b, uint64_t m, uint32_t e, uint32_t i){
+    ReuseDistance::Init(w, b);
+    membudget = m;
+    SetWindow(e, i);
+}
+
+// sampling under a memory budget needs the tree234 window, which can be cut down to any size
+void ReuseDistance::SetWindow(uint32_t e, uint32_t i){
+    assert(current == 0);
+    if (windowengine){
+        delete windowengine;
+        windowengine = NULL;
+    }
+    if (mwindow){
+        delete mwindow;
+    }
+    assert((i != IndexPageTable || membudget == ReuseDistance::Infinity) && "IndexPageTable cannot be used with a memory budget");
+    mwindow = new ReuseIndex(i);
+
+    if (e == WindowAuto){
+        if (membudget != ReuseDistance::Infinity){
+            e = WindowTree;
+        } else if (capacity != ReuseDistance::Infinity && capacity <= BitmapWindowLimit){
+            e = WindowBitmap;
+        } else {
+            e = WindowBTree;
+        }
+    }
+
+    if (e == WindowBitmap){
+        assert(capacity != ReuseDistance::Infinity && "WindowBitmap needs a finite window");
+        assert(membudget == ReuseDistance::Infinity && "WindowBitmap cannot be used with a memory budget");
+        windowengine = new ReuseWindowBitmap(capacity, i);
+    } else if (e == WindowBTree){
+        assert(membudget == ReuseDistance::Infinity && "WindowBTree cannot be used with a memory budget");
+        windowengine = new ReuseWindowBTree(capacity, i);
+    } else {
+        assert(e == WindowTree);
+    }
+
+    // the most recent addresses are kept in a ReuseWindowFront, unless that is all the window would hold
+    if (windowengine && (capacity == ReuseDistance::Infinity || capacity > ReuseWindowFront::FrontSize)){
+        windowengine = new ReuseWindowFront(windowengine, capacity);
+    }
+}
+
 ReuseDistance::~ReuseDistance(){
-    for (reuse_map_type<uint64_t, ReuseStats*>::const_iterator it = stats.begin(); it != stats.end(); it++){
-        uint64_t id = it->first;
-        delete stats[id];
+    // everything which uses statsconfig goes before its arena
+    stats.Clear();
+
+    if (windowengine){
+        delete windowengine;
+        current = 0;
     }
 
     debug_assert(current == count234(window));
@@ -73,22 +315,37 @@ ReuseDistance::~ReuseDistance(){
         current--;
     }
     freetree234(window);
+    delete mwindow;
+
+    if (aggregate){
+        delete aggregate;
+    }
+    if (latency){
+        delete latency;
+    }
+    if (bulk){
+        delete bulk;
+    }
+    delete statsconfig.arena;
 }
 
 uint64_t ReuseStats::GetMissCount(){
-    return distcounts[invalid];
+    return CountDistance(config->invalid);
 }
 
 void ReuseDistance::GetIndices(std::vector<uint64_t>& ids){
     assert(ids.size() == 0);
-    for (reuse_map_type<uint64_t, ReuseStats*>::const_iterator it = stats.begin(); it != stats.end(); it++){
-        uint64_t id = it->first;
-        ids.push_back(id);
+    for (uint64_t i = 0; i < stats.Size(); i++){
+        ids.push_back(stats.At(i)->GetId());
     }
 }
 
 void ReuseDistance::GetActiveAddresses(std::vector<uint64_t>& addrs){
     assert(addrs.size() == 0);
+    if (windowengine){
+        windowengine->GetActiveAddresses(addrs);
+        return;
+    }
     debug_assert(current == count234(window));
 
     for (int i = 0; i < current; i++){
@@ -101,10 +358,44 @@ void ReuseDistance::Print(bool annotate){
     Print(cout, annotate);
 }
 
+void ReuseDistance::SetExport(ReuseExport* e, uint64_t i){
+    assert(i > 0);
+    exporter = e;
+    exportinterval = i;
+    exportleft = i;
+}
+
 void ReuseDistance::Process(ReuseEntry* rs, uint64_t count){
-    for (uint32_t i = 0; i < count; i++){
-        Process(rs[i]);
+    if (exporter == NULL){
+        ProcessArray(rs, count);
+        return;
     }
+
+    ReuseExport* e = exporter;
+    exporter = NULL;
+    while (count >= exportleft){
+        uint64_t n = exportleft;
+        ProcessArray(rs, n);
+        rs += n;
+        count -= n;
+        e->Publish(this);
+        exportleft = exportinterval;
+    }
+    ProcessArray(rs, count);
+    exportleft -= count;
+    exporter = e;
+}
+
+inline void ReuseDistance::CountExport(uint64_t n){
+    if (exporter == NULL){
+        return;
+    }
+    while (n >= exportleft){
+        n -= exportleft;
+        exporter->Publish(this);
+        exportleft = exportinterval;
+    }
+    exportleft -= n;
 }
 
 void ReuseDistance::Process(vector<ReuseEntry> rs){
@@ -121,31 +412,275 @@ void ReuseDistance::Process(vector<ReuseEntry*> rs){
     }
 }
 
+void ReuseDistance::ProcessArray(ReuseEntry* rs, uint64_t count){
+#ifndef REUSE_LATENCY
+    // only the tree234 window (WindowTree) is batched. the bitmap and B+-tree windows are faster one
+    // address at a time than through ProcessBulk, so without a budget, arrays only reach ProcessBulk
+    // when WindowTree is asked for
+    if (batchable && membudget == ReuseDistance::Infinity && windowengine == NULL){
+        for (uint64_t i = 0; i < count; i += BulkSize){
+            uint64_t n = min(count - i, (uint64_t)BulkSize);
+            if (bulkskip == 0){
+                ProcessBulk(rs + i, n);
+                continue;
+            }
+            bulkskip--;
+            for (uint64_t j = i; j < i + n; j++){
+                ProcessAddress(rs[j]);
+            }
+        }
+        return;
+    }
+
+    // an address repeated right after itself is at distance 1 and leaves the window as it was,
+    // so a run of them is only counted
+    if (batchable && membudget == ReuseDistance::Infinity){
+        for (uint64_t i = 0; i < count;){
+            Process(rs[i]);
+            uint64_t j = i + 1;
+            while (j < count && rs[j].address == rs[i].address){
+                uint64_t k = j;
+                while (j < count && rs[j].address == rs[i].address && rs[j].id == rs[k].id){
+                    j++;
+                }
+                GetStats(rs[k].id, true)->Update(1, j - k);
+            }
+            sequence += j - i - 1;
+            i = j;
+        }
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < count; i++){
+        Process(rs[i]);
+    }
+}
+
+// the distance of an access is its position in the LRU stack. for an address accessed earlier in
+// the batch, that is the number of distinct addresses accessed since. otherwise the address is
+// taken out of the window at its first access, and its position is the number of entries left at
+// or above it plus the number of distinct addresses the batch has accessed so far, which are all
+// on top of the stack. the window is always the top current entries of the stack, so an access
+// hits if its position is at most current. this gives the same distances as
+// Process(ReuseEntry&)
+void ReuseDistance::ProcessBulk(ReuseEntry* rs, uint64_t count){
+    if (bulk == NULL){
+        bulk = new ReuseBulk();
+    }
+    ReuseBulk& b = *bulk;
+    if (b.index.size() < 2 * count){
+        uint64_t n = 1;
+        while (n < 2 * count){
+            n <<= 1;
+        }
+        b.index.assign(n, 0);
+        b.mask = n - 1;
+    }
+    b.addresses.clear();
+    b.slots.clear();
+    b.which.resize(count);
+    b.latest.Reset(count);
+
+    uint64_t before = current;
+    for (uint64_t i = 0; i < count; i++){
+        uint64_t addr = rs[i].address;
+        ReuseStats* stats = GetStats(rs[i].id, true);
+
+        uint64_t h = SampleHash(addr) & b.mask;
+        while (b.index[h] && b.addresses[b.index[h] - 1].address != addr){
+            h = (h + 1) & b.mask;
+        }
+
+        uint64_t d = ReuseDistance::Infinity;
+        if (b.index[h]){
+            BulkAddress& a = b.addresses[b.index[h] - 1];
+            d = b.latest.Before(i) - b.latest.Before(a.last);
+            b.latest.Add(a.last, -1);
+            a.last = i;
+            b.which[i] = b.index[h] - 1;
+        } else {
+            uint64_t seq = mwindow->Get(addr);
+            if (seq){
+                ReuseEntry key;
+                key.address = addr;
+                key.__seq = seq;
+
+                int dist = 0;
+                ReuseEntry* result = findrelpos234(window, &key, &dist);
+                debug_assert(result);
+
+                d = before - dist + b.addresses.size();
+                delpos234(window, dist);
+                b.slots.push_back(result);
+                mwindow->Erase(addr);
+                before--;
+            }
+
+            BulkAddress a;
+            a.address = addr;
+            a.last = i;
+            a.slot = h;
+            b.which[i] = b.addresses.size();
+            b.addresses.push_back(a);
+            b.index[h] = b.addresses.size();
+        }
+        b.latest.Add(i, 1);
+
+        if (d != ReuseDistance::Infinity && d <= current){
+            stats->Update(d);
+        } else {
+            stats->Update(ReuseDistance::Infinity);
+            if (capacity == ReuseDistance::Infinity || current < windowcapacity){
+                current++;
+            }
+        }
+    }
+
+    // the window is now the batch's addresses, most recent first, followed by what is left of
+    // the old window, cut to current entries
+    uint64_t fresh = min((uint64_t)b.addresses.size(), current);
+    while (before > current - fresh){
+        ReuseEntry* slot = (ReuseEntry*)delpos234(window, 0);
+        mwindow->Erase(slot->address);
+        b.slots.push_back(slot);
+        before--;
+    }
+
+    // the most recent fresh addresses of the batch are added in the order they were last used
+    uint64_t first = count;
+    for (uint64_t kept = 0; first > 0 && kept < fresh; first--){
+        if (b.addresses[b.which[first - 1]].last == first - 1){
+            kept++;
+        }
+    }
+    for (uint64_t i = first; i < count; i++){
+        BulkAddress& a = b.addresses[b.which[i]];
+        if (a.last != i){
+            continue;
+        }
+
+        ReuseEntry* slot;
+        if (b.slots.size()){
+            slot = b.slots.back();
+            b.slots.pop_back();
+        } else {
+            slot = new ReuseEntry();
+        }
+        slot->__seq = sequence + i;
+        slot->address = a.address;
+        add234(window, slot);
+        mwindow->Put(a.address, sequence + i);
+    }
+
+    for (uint64_t i = 0; i < b.slots.size(); i++){
+        delete b.slots[i];
+    }
+    for (uint64_t i = 0; i < b.addresses.size(); i++){
+        b.index[b.addresses[i].slot] = 0;
+    }
+
+    debug_assert(count234(window) == current);
+    debug_assert(mwindow->Size() == current);
+
+    // every distinct address still costs a delete and an insert on the tree, on top of the batch's
+    // own bookkeeping, so a batch with few repeats is slower than one address at a time
+    if (b.addresses.size() * BulkDistinctShare > count){
+        bulkskip = BulkBackoff;
+    }
+
+    sequence += count;
+}
+
 void ReuseDistance::SkipAddresses(uint64_t amount){
     sequence += amount;
 
+    if (windowengine){
+        windowengine->Flush();
+        current = 0;
+        return;
+    }
+
     // flush the window completely
     while (current){
         delete delpos234(window, 0);
         current--;
     }
-    mwindow.clear();
+    mwindow->Clear();
 
-    assert(mwindow.size() == 0);
+    assert(mwindow->Size() == 0);
     assert(count234(window) == 0);
 }
 
+void ReuseDistance::Invalidate(uint64_t addr){
+    if (windowengine){
+        if (windowengine->Invalidate(addr)){
+            current--;
+        }
+        return;
+    }
+
+    uint64_t seq = mwindow->Get(addr);
+    if (seq == 0){
+        return;
+    }
+
+    ReuseEntry key;
+    key.address = addr;
+    key.__seq = seq;
+
+    int dist = 0;
+    ReuseEntry* result = findrelpos234(window, &key, &dist);
+    debug_assert(result);
+
+    delpos234(window, dist);
+    delete result;
+    mwindow->Erase(addr);
+    current--;
+
+    debug_assert(count234(window) == mwindow->Size());
+}
+
 void ReuseDistance::Process(ReuseEntry& r){
+    ProcessAddress(r);
+    CountExport(1);
+}
+
+void ReuseDistance::ProcessAddress(ReuseEntry& r){
+    latency_begin();
+
     uint64_t addr = r.address;
     uint64_t id = r.id;
-    uint64_t mres = mwindow.count(addr);
+
+    if (membudget != ReuseDistance::Infinity){
+        if ((sequence & (BudgetCheckInterval - 1)) == 0){
+            CheckBudget();
+        }
+        if (SampleHash(addr) & samplemask){
+            sequence++;
+            latency_end();
+            return;
+        }
+    }
 
     ReuseStats* stats = GetStats(id, true);
 
+    if (windowengine){
+        uint64_t d = windowengine->Process(addr);
+        stats->Update(d);
+        if (d == ReuseDistance::Infinity && (capacity == ReuseDistance::Infinity || current < capacity)){
+            current++;
+        }
+        sequence++;
+        latency_end();
+        return;
+    }
+
+    // sequence numbers start at 1, so 0 means that addr is not in the window
+    uint64_t mres = mwindow->Get(addr);
+
     int dist = 0;
     ReuseEntry* result;
     if (mres){
-        mres = mwindow[addr];
         ReuseEntry key;
         key.address = addr;
         key.__seq = mres;
@@ -154,35 +689,335 @@ void ReuseDistance::Process(ReuseEntry& r){
         debug_assert(result);
 
         if (capacity != ReuseDistance::Infinity){
-            debug_assert(current - dist <= capacity);
+            debug_assert(current - dist <= windowcapacity);
+        }
+        if (sampleshift){
+            stats->Update((current - dist) << sampleshift, samplemask + 1);
+        } else {
+            stats->Update(current - dist);
         }
-        stats->Update(current - dist);
     } else {
-        stats->Update(ReuseDistance::Infinity);
+        stats->Update(ReuseDistance::Infinity, samplemask + 1);
     }
 
     // recycle a slot when possible
     ReuseEntry* slot = NULL;
-    if (mres || (capacity != ReuseDistance::Infinity && current >= capacity)){
+    if (mres || (capacity != ReuseDistance::Infinity && current >= windowcapacity)){
         slot = (ReuseEntry*)delpos234(window, dist);
-        debug_assert(mwindow[slot->address]);
-        mwindow.erase(slot->address);
-        debug_assert(count234(window) == mwindow.size());
+        debug_assert(mwindow->Get(slot->address));
+        if (slot->address != addr){
+            mwindow->Erase(slot->address);
+        }
     } else {
         slot = new ReuseEntry();
         current++;
     }
     
-    mwindow[addr] = sequence;
+    mwindow->Put(addr, sequence);
 
     slot->__seq = sequence;
     slot->address = addr;
     add234(window, slot);
 
-    debug_assert(count234(window) == mwindow.size());
-    debug_assert(mwindow.size() <= current);
+    debug_assert(count234(window) == mwindow->Size());
+    debug_assert(mwindow->Size() <= current);
 
     sequence++;
+
+    latency_end();
+}
+
+// estimate the bytes held by a reuse_map_type: one node per entry, plus the bucket array for a hash
+template <class K, class V> static uint64_t MapBytes(reuse_map_type<K, V>& m){
+#ifdef HAVE_UNORDERED_MAP
+    return m.size() * (sizeof(pair<const K, V>) + 2 * sizeof(void*)) + m.bucket_count() * sizeof(void*);
+#else
+    return m.size() * (sizeof(pair<const K, V>) + 4 * sizeof(void*));
+#endif
+}
+
+// prefix sums for the ReuseStats queries, rebuilt when accesses has changed since they were
+// built. qsums[i] is the number of accesses in the bins up to and including qkeys[i]
+struct ReuseQueries {
+    vector<uint64_t> qkeys;
+    vector<uint64_t> qsums;
+    uint64_t qaccesses;
+};
+
+void ReuseStats::BuildQueries(){
+    if (queries == NULL){
+        queries = new ReuseQueries();
+    } else if (queries->qaccesses == accesses){
+        return;
+    }
+
+    vector<ReuseBin> scratch;
+    uint64_t n;
+    const ReuseBin* sorted = GetSortedBins(&n, scratch);
+
+    queries->qkeys.clear();
+    queries->qsums.clear();
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++){
+        if (sorted[i].distance != config->invalid){
+            sum += sorted[i].count;
+            queries->qkeys.push_back(sorted[i].distance);
+            queries->qsums.push_back(sum);
+        }
+    }
+    queries->qaccesses = accesses;
+}
+
+uint64_t ReuseStats::CountAtMost(uint64_t d){
+    BuildQueries();
+    vector<uint64_t>& qkeys = queries->qkeys;
+    uint64_t i = upper_bound(qkeys.begin(), qkeys.end(), d) - qkeys.begin();
+    return i ? queries->qsums[i - 1] : 0;
+}
+
+uint64_t ReuseStats::CountRange(uint64_t a, uint64_t b){
+    if (b < a){
+        return 0;
+    }
+    return CountAtMost(b) - (a ? CountAtMost(a - 1) : 0);
+}
+
+double ReuseStats::GetCDF(uint64_t d){
+    if (accesses == 0){
+        return 0.0;
+    }
+    return (double)CountAtMost(d) / (double)accesses;
+}
+
+uint64_t ReuseStats::GetQuantile(double q){
+    BuildQueries();
+    if (accesses == 0){
+        return config->invalid;
+    }
+    vector<uint64_t>& qsums = queries->qsums;
+
+    // the smallest count of accesses which covers q of them
+    uint64_t target = (uint64_t)ceil(q * (double)accesses);
+    if (target == 0){
+        target = 1;
+    }
+    uint64_t i = lower_bound(qsums.begin(), qsums.end(), target) - qsums.begin();
+    if (i == qsums.size()){
+        return config->invalid;
+    }
+    return queries->qkeys[i];
+}
+
+uint64_t ReuseStats::CountMisses(uint64_t size){
+    return accesses - CountAtMost(size);
+}
+
+ReuseStats* ReuseDistance::GetAggregateStats(){
+    Flush();
+    if (aggregate && aggregatesequence == sequence){
+        return aggregate;
+    }
+    if (aggregate){
+        delete aggregate;
+        aggregate = NULL;
+    }
+
+    if (stats.Size()){
+        aggregate = new ReuseStats(0, &statsconfig);
+        for (uint64_t i = 0; i < stats.Size(); i++){
+            aggregate->Merge(stats.At(i));
+        }
+    }
+    aggregatesequence = sequence;
+    return aggregate;
+}
+
+// most misses first, then lowest id
+static bool CompareMisses(const pair<uint64_t, uint64_t>& a, const pair<uint64_t, uint64_t>& b){
+    if (a.second != b.second){
+        return a.second > b.second;
+    }
+    return a.first < b.first;
+}
+
+void ReuseDistance::GetTopMissIds(uint64_t size, uint32_t k, vector<pair<uint64_t, uint64_t> >& top){
+    Flush();
+    assert(top.size() == 0 && "top must be an empty vector");
+    for (uint64_t i = 0; i < stats.Size(); i++){
+        ReuseStats* r = stats.At(i);
+        top.push_back(pair<uint64_t, uint64_t>(r->GetId(), r->CountMisses(size)));
+    }
+    if (k < top.size()){
+        partial_sort(top.begin(), top.begin() + k, top.end(), CompareMisses);
+        top.resize(k);
+    } else {
+        sort(top.begin(), top.end(), CompareMisses);
+    }
+}
+
+uint64_t ReuseStats::GetBinCount(){
+    return spill ? spill->size() : bincount;
+}
+
+uint64_t ReuseStats::GetBytes(){
+    uint64_t bytes = sizeof(ReuseStats);
+    if (bins != &first){
+        bytes += bincapacity * sizeof(ReuseBin);
+    }
+    if (spill){
+        bytes += MapBytes(*spill);
+    }
+    if (queries){
+        bytes += sizeof(ReuseQueries) + queries->qkeys.capacity() * 2 * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+void ReuseDistance::GetCommonStats(ReuseEngineStats& s){
+    memset(&s, 0, sizeof(ReuseEngineStats));
+    s.capacity = capacity;
+    s.samplerate = samplemask + 1;
+    s.statsobjects = stats.Size();
+    s.statsbytes = stats.GetBytes() + statsconfig.arena->GetBytes();
+    s.latency = latency;
+
+    // the table's slots and chunks, the arena's slabs, and anything a ReuseStats holds by itself
+    s.allocations = 1 + (stats.Size() + ReuseStatsTable::ChunkSize - 1) / ReuseStatsTable::ChunkSize + statsconfig.arena->GetSlabCount();
+    for (uint64_t i = 0; i < stats.Size(); i++){
+        ReuseStats* r = stats.At(i);
+        s.accesses += r->GetAccessCount();
+        s.statsbins += r->GetBinCount();
+        s.statsbytes += r->GetBytes();
+        if (r->GetBinCount() > ReuseStats::SpillBins){
+            s.allocations += r->GetBinCount() + 2;
+        }
+    }
+}
+
+void ReuseDistance::GetEngineStats(ReuseEngineStats& s){
+    GetCommonStats(s);
+
+    if (windowengine){
+        windowengine->GetEngineStats(s);
+        s.totalbytes = s.windowbytes + s.hashbytes + s.statsbytes;
+        return;
+    }
+
+    uint64_t nodes = nodes234(window);
+    s.windowsize = current;
+    s.treedepth = depth234(window);
+    s.windowbytes = current * sizeof(ReuseEntry) + nodes * nodesize234();
+
+    mwindow->GetEngineStats(s);
+
+    s.allocations += current + nodes;
+    s.totalbytes = s.windowbytes + s.hashbytes + s.statsbytes;
+}
+
+void ReuseDistance::PrintEngineStats(ostream& f){
+    ReuseEngineStats s;
+    GetEngineStats(s);
+
+    f << "# " << Describe() << "ENGINE" << TAB << "accesses" << TAB << s.accesses << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "windowsize" << TAB << s.windowsize << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "capacity" << TAB << s.capacity << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "treedepth" << TAB << s.treedepth << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "hashsize" << TAB << s.hashsize << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "hashbuckets" << TAB << s.hashbuckets << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "loadfactor" << TAB << s.loadfactor << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "statsobjects" << TAB << s.statsobjects << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "statsbins" << TAB << s.statsbins << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "allocations" << TAB << s.allocations << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "windowbytes" << TAB << s.windowbytes << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "hashbytes" << TAB << s.hashbytes << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "statsbytes" << TAB << s.statsbytes << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "totalbytes" << TAB << s.totalbytes << ENDL
+      << "# " << Describe() << "ENGINE" << TAB << "samplerate" << TAB << s.samplerate << ENDL;
+
+    if (s.latency){
+        vector<uint64_t> keys;
+        s.latency->GetSortedDistances(keys);
+        for (vector<uint64_t>::const_iterator it = keys.begin(); it != keys.end(); it++){
+            if (*it == INVALID_SPATIAL) continue;
+            f << "# " << Describe() << "LATENCY" << TAB << *it << TAB << s.latency->CountDistance(*it) << ENDL;
+        }
+    }
+}
+
+uint64_t ReuseDistance::EstimateBytes(){
+    // a 2-3-4 node holds 2 elements on average
+    uint64_t bytes = current * (sizeof(ReuseEntry) + nodesize234() / 2) + mwindow->GetBytes() + stats.GetBytes();
+    for (uint64_t i = 0; i < stats.Size(); i++){
+        bytes += stats.At(i)->GetBytes();
+    }
+    return bytes;
+}
+
+void ReuseDistance::CheckBudget(){
+    uint64_t bytes = EstimateBytes();
+
+    while (bytes > membudget / 8 * BudgetThreshold && current > 0 && sampleshift < MaxSampleShift){
+        sampleshift++;
+        samplemask = (samplemask << 1) | 1;
+        if (capacity != ReuseDistance::Infinity){
+            windowcapacity = capacity >> sampleshift;
+            if (windowcapacity == 0){
+                windowcapacity = 1;
+            }
+        }
+
+        degradations.push_back(sequence - 1);
+        degradations.push_back(samplemask + 1);
+        degradations.push_back(bytes);
+
+        // evict everything which is no longer sampled, then the oldest addresses if the window
+        // is still over its reduced capacity
+        vector<uint64_t> addrs;
+        mwindow->GetAddresses(addrs);
+        for (vector<uint64_t>::const_iterator it = addrs.begin(); it != addrs.end(); it++){
+            if (SampleHash(*it) & samplemask){
+                Invalidate(*it);
+            }
+        }
+        while (capacity != ReuseDistance::Infinity && current > windowcapacity){
+            ReuseEntry* e = (ReuseEntry*)delpos234(window, 0);
+            mwindow->Erase(e->address);
+            delete e;
+            current--;
+        }
+        mwindow->Shrink();
+
+        bytes = EstimateBytes();
+    }
+}
+
+uint64_t ReuseDistance::GetSampleRate(){
+    return samplemask + 1;
+}
+
+void ReuseDistance::ScaleStats(uint64_t distance, uint64_t count){
+    Flush();
+    assert(distance > 0 && count > 0);
+    for (uint64_t i = 0; i < stats.Size(); i++){
+        stats.At(i)->Scale(distance, count);
+    }
+
+    // the aggregate is rebuilt from the scaled stats when it is next needed
+    if (aggregate){
+        delete aggregate;
+        aggregate = NULL;
+    }
+}
+
+void ReuseDistance::PrintDegradations(ostream& f){
+    for (uint32_t i = 0; i < degradations.size(); i += 3){
+        f << "# " << Describe() << "DEGRADED"
+          << TAB << "access" << TAB << degradations[i]
+          << TAB << "samplerate" << TAB << degradations[i + 1]
+          << TAB << "bytes" << TAB << degradations[i + 2]
+          << TAB << "budget" << TAB << membudget
+          << ENDL;
+    }
 }
 
 void ReuseDistance::PrintFormat(ostream& f){
@@ -214,16 +1049,15 @@ void ReuseStats::PrintFormat(ostream& f){
 }
 
 void ReuseDistance::Print(ostream& f, bool annotate){
+    Flush();
     vector<uint64_t> keys;
-    for (reuse_map_type<uint64_t, ReuseStats*>::const_iterator it = stats.begin(); it != stats.end(); it++){
-        keys.push_back(it->first);
-    }
+    GetIndices(keys);
     sort(keys.begin(), keys.end());
 
     uint64_t tot = 0, mis = 0;
     for (vector<uint64_t>::const_iterator it = keys.begin(); it != keys.end(); it++){
         uint64_t id = (*it);
-        ReuseStats* r = (ReuseStats*)stats[id];
+        ReuseStats* r = stats.Find(id);
         tot += r->GetAccessCount();
         mis += r->GetMissCount();
     }
@@ -232,6 +1066,7 @@ void ReuseDistance::Print(ostream& f, bool annotate){
         ReuseDistance::PrintFormat(f);
         ReuseStats::PrintFormat(f);
     }
+    PrintDegradations(f);
 
     f << Describe() << "STATS"
       << TAB << dec << capacity
@@ -244,7 +1079,7 @@ void ReuseDistance::Print(ostream& f, bool annotate){
 
     for (vector<uint64_t>::const_iterator it = keys.begin(); it != keys.end(); it++){
         uint64_t id = (*it);
-        ReuseStats* r = (ReuseStats*)stats[id];
+        ReuseStats* r = stats.Find(id);
 
         f << TAB << Describe() << "ID"
           << TAB << dec << id
@@ -256,41 +1091,471 @@ void ReuseDistance::Print(ostream& f, bool annotate){
     }
 }
 
-ReuseStats* ReuseDistance::GetStats(uint64_t id, bool gen){
-    ReuseStats* s = stats[id];
-    if (s == NULL && gen){
-        s = new ReuseStats(id, binindividual, capacity, ReuseDistance::Infinity);
-        stats[id] = s;
+// decimal formatting for the parallel Print, two digits are produced per division
+static const char DecimalPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+static const uint64_t PowersOfTen[] = {
+    1L, 10L, 100L, 1000L, 10000L, 100000L, 1000000L, 10000000L, 100000000L, 1000000000L,
+    10000000000L, 100000000000L, 1000000000000L, 10000000000000L, 100000000000000L,
+    1000000000000000L, 10000000000000000L, 100000000000000000L, 1000000000000000000L,
+    10000000000000000000UL };
+
+static inline uint32_t DecimalLength(uint64_t v){
+    uint32_t n = 1;
+    while (n < 20 && v >= PowersOfTen[n]){
+        n++;
     }
-    return s;
+    return n;
 }
 
-// this should be fast as possible. This code is from http://graphics.stanford.edu/~seander/bithacks.html#IntegerLog
-static const uint64_t b[] = {0x2L, 0xCL, 0xF0L, 0xFF00L, 0xFFFF0000L, 0xFFFFFFFF00000000L};
-static const uint32_t S[] = {1, 2, 4, 8, 16, 32};
-inline uint64_t ShaveBitsPwr2(uint64_t val){
-    val -= 1;
-    register uint64_t r = 0; // result of log2(v) will go here
-    for (int32_t i = 5; i >= 0; i--){
-        if (val & b[i]){
+static inline char* FormatDecimal(char* p, uint64_t v){
+    char* e = p + DecimalLength(v);
+    char* q = e;
+    while (v >= 100){
+        uint32_t r = (v % 100) * 2;
+        v /= 100;
+        *--q = DecimalPairs[r + 1];
+        *--q = DecimalPairs[r];
+    }
+    if (v >= 10){
+        *--q = DecimalPairs[v * 2 + 1];
+        *--q = DecimalPairs[v * 2];
+    } else {
+        *--q = '0' + v;
+    }
+    return e;
+}
+
+static inline char* FormatString(char* p, const char* s, uint64_t len){
+    memcpy(p, s, len);
+    return p + len;
+}
+
+// a contiguous range of (sorted) ids which is formatted by a single thread
+struct PrintChunk {
+    std::pair<uint64_t, ReuseStats*>* ids;
+    uint64_t count;
+
+    const char* tag;
+    uint64_t taglen;
+
+    uint64_t length;
+    uint64_t accesses;
+    uint64_t misses;
+    char* buf;
+};
+
+static void* MeasureChunk(void* arg){
+    PrintChunk* c = (PrintChunk*)arg;
+    c->length = 0;
+    c->accesses = 0;
+    c->misses = 0;
+    for (uint64_t i = 0; i < c->count; i++){
+        uint64_t id = c->ids[i].first;
+        ReuseStats* r = c->ids[i].second;
+        uint64_t acc = r->GetAccessCount();
+        uint64_t mis = r->GetMissCountConst();
+        c->accesses += acc;
+        c->misses += mis;
+
+        // TAB tag TAB id TAB acc TAB mis ENDL
+        c->length += 5 + c->taglen + DecimalLength(id) + DecimalLength(acc) + DecimalLength(mis);
+        c->length += r->FormatLength();
+    }
+    return NULL;
+}
+
+static void* FormatChunk(void* arg){
+    PrintChunk* c = (PrintChunk*)arg;
+    char* p = c->buf;
+    for (uint64_t i = 0; i < c->count; i++){
+        uint64_t id = c->ids[i].first;
+        ReuseStats* r = c->ids[i].second;
+
+        *p++ = '\t';
+        p = FormatString(p, c->tag, c->taglen);
+        *p++ = '\t';
+        p = FormatDecimal(p, id);
+        *p++ = '\t';
+        p = FormatDecimal(p, r->GetAccessCount());
+        *p++ = '\t';
+        p = FormatDecimal(p, r->GetMissCountConst());
+        *p++ = '\n';
+
+        p = r->Format(p);
+    }
+    debug_assert(p == c->buf + c->length);
+    return NULL;
+}
+
+static void RunChunks(void* (*fn)(void*), PrintChunk* chunks, uint32_t threads){
+    pthread_t* tids = new pthread_t[threads];
+    for (uint32_t i = 1; i < threads; i++){
+        int ret = pthread_create(&tids[i], NULL, fn, &chunks[i]);
+        assert(ret == 0 && "unable to create print thread");
+    }
+    fn(&chunks[0]);
+    for (uint32_t i = 1; i < threads; i++){
+        pthread_join(tids[i], NULL);
+    }
+    delete[] tids;
+}
+
+void ReuseDistance::Print(ostream& f, bool annotate, uint32_t threads){
+    assert(threads > 0);
+    Flush();
+
+    vector<pair<uint64_t, ReuseStats*> > ids;
+    ids.reserve(stats.Size());
+    for (uint64_t i = 0; i < stats.Size(); i++){
+        ReuseStats* r = stats.At(i);
+        ids.push_back(pair<uint64_t, ReuseStats*>(r->GetId(), r));
+    }
+    sort(ids.begin(), ids.end());
+
+    if (threads > ids.size()){
+        threads = ids.size() > 0 ? ids.size() : 1;
+    }
+
+    string tag = Describe() + "ID";
+    PrintChunk* chunks = new PrintChunk[threads];
+    uint64_t per = ids.size() / threads;
+    uint64_t extra = ids.size() % threads;
+    uint64_t start = 0;
+    for (uint32_t i = 0; i < threads; i++){
+        chunks[i].ids = ids.size() > 0 ? &ids[start] : NULL;
+        chunks[i].count = per + (i < extra ? 1 : 0);
+        chunks[i].tag = tag.c_str();
+        chunks[i].taglen = tag.size();
+        start += chunks[i].count;
+    }
+    debug_assert(start == ids.size());
+
+    // first pass finds the exact size of each chunk so that everything can go into one buffer
+    RunChunks(MeasureChunk, chunks, threads);
+
+    uint64_t tot = 0, mis = 0, len = 0;
+    for (uint32_t i = 0; i < threads; i++){
+        tot += chunks[i].accesses;
+        mis += chunks[i].misses;
+        len += chunks[i].length;
+    }
+
+    ostringstream head;
+    if (annotate){
+        ReuseDistance::PrintFormat(head);
+        ReuseStats::PrintFormat(head);
+    }
+    PrintDegradations(head);
+
+    head << Describe() << "STATS"
+         << TAB << dec << capacity
+         << TAB << binindividual
+         << TAB << maxtracking
+         << TAB << ids.size()
+         << TAB << tot
+         << TAB << mis
+         << ENDL;
+    string h = head.str();
+
+    char* buf = new char[h.size() + len];
+    char* p = FormatString(buf, h.c_str(), h.size());
+    for (uint32_t i = 0; i < threads; i++){
+        chunks[i].buf = p;
+        p += chunks[i].length;
+    }
+
+    RunChunks(FormatChunk, chunks, threads);
+
+    f.write(buf, h.size() + len);
+
+    delete[] buf;
+    delete[] chunks;
+}
+
+ReuseStats* ReuseDistance::GetStats(uint64_t id, bool gen){
+    ReuseStats* s = stats.Find(id);
+    if (s == NULL && gen){
+        s = stats.Insert(id, &statsconfig);
+    }
+    return s;
+}
+
+// this should be fast as possible. This code is from http://graphics.stanford.edu/~seander/bithacks.html#IntegerLog
+static const uint64_t b[] = {0x2L, 0xCL, 0xF0L, 0xFF00L, 0xFFFF0000L, 0xFFFFFFFF00000000L};
+static const uint32_t S[] = {1, 2, 4, 8, 16, 32};
+inline uint64_t ShaveBitsPwr2(uint64_t val){
+    val -= 1;
+    register uint64_t r = 0; // result of log2(v) will go here
+    for (int32_t i = 5; i >= 0; i--){
+        if (val & b[i]){
             val = val >> S[i];
             r |= S[i];
         }
     }
-    return (2 << r);
+    return ((uint64_t)2 << r);
+}
+
+ReuseStats::ReuseStats(uint64_t idx, uint64_t bin, uint64_t num, uint64_t inv)
+    : id(idx), accesses(0), bins(&first), bincount(0), bincapacity(1), spill(NULL), queries(NULL)
+{
+    config = new ReuseStatsConfig();
+    config->binindividual = bin;
+    config->maxtracking = num;
+    config->invalid = inv;
+    config->arena = NULL;
+}
+
+ReuseStats::ReuseStats(uint64_t idx, ReuseStatsConfig* c)
+    : id(idx), accesses(0), config(c), bins(&first), bincount(0), bincapacity(1), spill(NULL), queries(NULL)
+{
+    assert(config);
+}
+
+ReuseStats::~ReuseStats(){
+    Release();
+    if (config->arena == NULL){
+        delete config;
+    }
+}
+
+// give back all bins, leaving an empty ReuseStats
+void ReuseStats::Release(){
+    if (bins != &first){
+        if (config->arena){
+            config->arena->Free(bins, bincapacity);
+        } else {
+            delete[] bins;
+        }
+    }
+    if (spill){
+        delete spill;
+    }
+    if (queries){
+        delete queries;
+    }
+    bins = &first;
+    bincount = 0;
+    bincapacity = 1;
+    spill = NULL;
+    queries = NULL;
+}
+
+static bool BinBelow(const ReuseBin& b, uint64_t d){
+    return b.distance < d;
+}
+
+static bool CompareBins(const ReuseBin& a, const ReuseBin& b){
+    return a.distance < b.distance;
+}
+
+// make room for one more bin, moving everything into spill once SpillBins is reached
+void ReuseStats::Grow(){
+    assert(spill == NULL && bincount == bincapacity);
+
+    if (bincapacity == SpillBins){
+        spill = new reuse_map_type<uint64_t, uint64_t>();
+        for (uint32_t i = 0; i < bincount; i++){
+            (*spill)[bins[i].distance] = bins[i].count;
+        }
+    }
+
+    uint32_t cap = bincapacity * 2;
+    ReuseBin* b = NULL;
+    if (spill == NULL){
+        b = config->arena ? config->arena->Alloc(cap) : new ReuseBin[cap];
+        memcpy(b, bins, bincount * sizeof(ReuseBin));
+    }
+
+    if (bins != &first){
+        if (config->arena){
+            config->arena->Free(bins, bincapacity);
+        } else {
+            delete[] bins;
+        }
+    }
+
+    if (spill){
+        bins = &first;
+        bincount = 0;
+        bincapacity = 1;
+    } else {
+        bins = b;
+        bincapacity = cap;
+    }
+}
+
+void ReuseStats::Add(uint64_t bin, uint64_t count){
+    if (spill == NULL){
+        ReuseBin* b = lower_bound(bins, bins + bincount, bin, BinBelow);
+        if (b != bins + bincount && b->distance == bin){
+            b->count += count;
+            return;
+        }
+
+        if (bincount == bincapacity){
+            uint64_t i = b - bins;
+            Grow();
+            b = bins + i;
+        }
+        if (spill == NULL){
+            memmove(b + 1, b, (bins + bincount - b) * sizeof(ReuseBin));
+            b->distance = bin;
+            b->count = count;
+            bincount++;
+            return;
+        }
+    }
+    (*spill)[bin] += count;
+}
+
+// the bins sorted by distance. these are the bins themselves unless they have spilled, in
+// which case they are sorted into scratch
+const ReuseBin* ReuseStats::GetSortedBins(uint64_t* n, vector<ReuseBin>& scratch){
+    if (spill == NULL){
+        *n = bincount;
+        return bins;
+    }
+
+    scratch.clear();
+    scratch.reserve(spill->size());
+    for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = spill->begin(); it != spill->end(); it++){
+        ReuseBin b;
+        b.distance = it->first;
+        b.count = it->second;
+        scratch.push_back(b);
+    }
+    sort(scratch.begin(), scratch.end(), CompareBins);
+
+    *n = scratch.size();
+    return &scratch[0];
+}
+
+// slots are found by a multiplicative hash of the id, then by linear probing
+#define STATS_HASH(__id, __shift) (((__id) * 0x9E3779B97F4A7C15ULL) >> (__shift))
+#define STATS_SLOTS(__shift) ((uint64_t)1 << (64 - (__shift)))
+
+ReuseStatsTable::ReuseStatsTable()
+    : slots(NULL), shift(64), count(0), last(NULL)
+{
+}
+
+ReuseStatsTable::~ReuseStatsTable(){
+    Clear();
+}
+
+ReuseStats* ReuseStatsTable::Find(uint64_t id){
+    if (last && last->GetId() == id){
+        return last;
+    }
+    if (slots == NULL){
+        return NULL;
+    }
+
+    uint64_t mask = STATS_SLOTS(shift) - 1;
+    for (uint64_t h = STATS_HASH(id, shift); slots[h]; h = (h + 1) & mask){
+        if (slots[h]->GetId() == id){
+            last = slots[h];
+            return last;
+        }
+    }
+    return NULL;
+}
+
+// double the slots, keeping the load at or below one half
+void ReuseStatsTable::Grow(){
+    uint64_t oldshift = shift;
+    ReuseStats** old = slots;
+
+    shift = (slots == NULL) ? 60 : shift - 1;
+    uint64_t n = STATS_SLOTS(shift);
+    slots = new ReuseStats*[n];
+    memset(slots, 0, n * sizeof(ReuseStats*));
+
+    if (old){
+        for (uint64_t i = 0; i < STATS_SLOTS(oldshift); i++){
+            if (old[i]){
+                uint64_t h = STATS_HASH(old[i]->GetId(), shift);
+                while (slots[h]){
+                    h = (h + 1) & (n - 1);
+                }
+                slots[h] = old[i];
+            }
+        }
+        delete[] old;
+    }
+}
+
+ReuseStats* ReuseStatsTable::Insert(uint64_t id, ReuseStatsConfig* c){
+    debug_assert(Find(id) == NULL);
+
+    if (slots == NULL || (count + 1) * 2 > STATS_SLOTS(shift)){
+        Grow();
+    }
+
+    if (count % ChunkSize == 0){
+        chunks.push_back((ReuseStats*)operator new(ChunkSize * sizeof(ReuseStats)));
+    }
+    ReuseStats* s = new (chunks.back() + count % ChunkSize) ReuseStats(id, c);
+    count++;
+
+    uint64_t mask = STATS_SLOTS(shift) - 1;
+    uint64_t h = STATS_HASH(id, shift);
+    while (slots[h]){
+        h = (h + 1) & mask;
+    }
+    slots[h] = s;
+
+    last = s;
+    return s;
+}
+
+ReuseStats* ReuseStatsTable::At(uint64_t i){
+    debug_assert(i < count);
+    return chunks[i / ChunkSize] + i % ChunkSize;
+}
+
+void ReuseStatsTable::Clear(){
+    for (uint64_t i = 0; i < count; i++){
+        At(i)->~ReuseStats();
+    }
+    for (uint64_t i = 0; i < chunks.size(); i++){
+        operator delete(chunks[i]);
+    }
+    chunks.clear();
+
+    if (slots){
+        delete[] slots;
+    }
+    slots = NULL;
+    shift = 64;
+    count = 0;
+    last = NULL;
+}
+
+uint64_t ReuseStatsTable::GetBytes(){
+    uint64_t bytes = chunks.capacity() * sizeof(ReuseStats*);
+    if (slots){
+        bytes += STATS_SLOTS(shift) * sizeof(ReuseStats*);
+    }
+    // the unused tail of the last chunk
+    bytes += (chunks.size() * ChunkSize - count) * sizeof(ReuseStats);
+    return bytes;
 }
 
 uint64_t ReuseStats::GetBin(uint64_t value){
     // not a valid value
-    if (value == invalid){
-        return invalid;
+    if (value == config->invalid){
+        return config->invalid;
     }
     // outside of tracking window, also invalid
-    else if (maxtracking != ReuseDistance::Infinity && value > maxtracking){
-        return invalid;
+    else if (config->maxtracking != ReuseDistance::Infinity && value > config->maxtracking){
+        return config->invalid;
     }
     // valid but not tracked individually
-    else if (binindividual != ReuseDistance::Infinity && value > binindividual){
+    else if (config->binindividual != ReuseDistance::Infinity && value > config->binindividual){
         return ShaveBitsPwr2(value);
     }
     // valid and tracked individually
@@ -298,6 +1563,7 @@ uint64_t ReuseStats::GetBin(uint64_t value){
 }
 
 ReuseStats* ReuseDistance::GetStats(uint64_t id){
+    Flush();
     return GetStats(id, false);
 }
 
@@ -307,55 +1573,100 @@ uint64_t ReuseStats::GetAccessCount(){
 
 uint64_t ReuseStats::GetMaximumDistance(){
     uint64_t max = 0;
-    for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = distcounts.begin(); it != distcounts.end(); it++){
-        uint64_t d = it->first;
-        if (d > max){
-            max = d;
+    if (spill){
+        for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = spill->begin(); it != spill->end(); it++){
+            if (it->first > max){
+                max = it->first;
+            }
         }
+    } else if (bincount){
+        max = bins[bincount - 1].distance;
     }
     return max;
 }
 
 void ReuseStats::Update(uint64_t dist){
-    distcounts[GetBin(dist)] += 1;
+    Add(GetBin(dist), 1);
     accesses++;
 }
 
+void ReuseStats::Update(uint64_t dist, uint64_t count){
+    Add(GetBin(dist), count);
+    accesses += count;
+}
+
+void ReuseStats::Merge(ReuseStats* other){
+    assert(other);
+    if (other->spill){
+        for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = other->spill->begin(); it != other->spill->end(); it++){
+            Add(it->first, it->second);
+        }
+    } else {
+        for (uint32_t i = 0; i < other->bincount; i++){
+            Add(other->bins[i].distance, other->bins[i].count);
+        }
+    }
+    accesses += other->accesses;
+}
+
+void ReuseStats::Scale(uint64_t distance, uint64_t count){
+    vector<ReuseBin> scratch;
+    uint64_t n;
+    const ReuseBin* sorted = GetSortedBins(&n, scratch);
+    vector<ReuseBin> old(sorted, sorted + n);
+    Release();
+
+    for (uint64_t i = 0; i < old.size(); i++){
+        uint64_t d = old[i].distance;
+        if (d != config->invalid){
+            d *= distance;
+            if (config->binindividual != ReuseDistance::Infinity && d > config->binindividual){
+                d = ShaveBitsPwr2(d);
+            }
+        }
+        Add(d, old[i].count * count);
+    }
+    accesses *= count;
+}
+
 uint64_t ReuseStats::CountDistance(uint64_t d){
-    if (distcounts.count(d) == 0){
-        return 0;
+    if (spill){
+        reuse_map_type<uint64_t, uint64_t>::const_iterator it = spill->find(d);
+        return (it == spill->end()) ? 0 : it->second;
     }
-    return distcounts[d];
+    ReuseBin* b = lower_bound(bins, bins + bincount, d, BinBelow);
+    return (b != bins + bincount && b->distance == d) ? b->count : 0;
 }
 
 void ReuseStats::GetSortedDistances(vector<uint64_t>& dkeys){
     assert(dkeys.size() == 0 && "dkeys must be an empty vector");
-    for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = distcounts.begin(); it != distcounts.end(); it++){
-        uint64_t d = it->first;
-        dkeys.push_back(d);
+    vector<ReuseBin> scratch;
+    uint64_t n;
+    const ReuseBin* sorted = GetSortedBins(&n, scratch);
+    for (uint64_t i = 0; i < n; i++){
+        dkeys.push_back(sorted[i].distance);
     }
-    sort(dkeys.begin(), dkeys.end());    
 }
 
 void ReuseStats::Print(ostream& f, bool annotate){
-    vector<uint64_t> keys;
-    GetSortedDistances(keys);
+    vector<ReuseBin> scratch;
+    uint64_t n;
+    const ReuseBin* sorted = GetSortedBins(&n, scratch);
 
     if (annotate){
         ReuseStats::PrintFormat(f);
     }
 
-    for (vector<uint64_t>::const_iterator it = keys.begin(); it != keys.end(); it++){
-        uint64_t d = *it;
-        if (d == invalid) continue;
+    for (uint64_t i = 0; i < n; i++){
+        uint64_t d = sorted[i].distance;
+        if (d == config->invalid) continue;
 
-        debug_assert(distcounts.count(d) > 0);
-        uint32_t cnt = distcounts[d];
+        uint32_t cnt = sorted[i].count;
 
         debug_assert(cnt > 0);
         if (cnt > 0){
             uint64_t p = d / 2 + 1;
-            if (binindividual == ReuseDistance::Infinity || d <= binindividual){
+            if (config->binindividual == ReuseDistance::Infinity || d <= config->binindividual){
                 p = d;
             }
             f << TAB
@@ -367,7 +1678,59 @@ void ReuseStats::Print(ostream& f, bool annotate){
     }
 }
 
-void SpatialLocality::Init(uint64_t size, uint64_t bin, uint64_t max){
+uint64_t ReuseStats::GetMissCountConst(){
+    return CountDistance(config->invalid);
+}
+
+// the bin lines printed by ReuseStats::Print are: TAB TAB lower TAB upper TAB count ENDL
+uint64_t ReuseStats::FormatLength(){
+    vector<ReuseBin> scratch;
+    uint64_t n;
+    const ReuseBin* sorted = GetSortedBins(&n, scratch);
+
+    uint64_t len = 0;
+    for (uint64_t i = 0; i < n; i++){
+        uint64_t d = sorted[i].distance;
+        uint32_t cnt = sorted[i].count;
+        if (d == config->invalid || cnt == 0) continue;
+
+        uint64_t p = d / 2 + 1;
+        if (config->binindividual == ReuseDistance::Infinity || d <= config->binindividual){
+            p = d;
+        }
+        len += 5 + DecimalLength(p) + DecimalLength(d) + DecimalLength(cnt);
+    }
+    return len;
+}
+
+char* ReuseStats::Format(char* buf){
+    vector<ReuseBin> scratch;
+    uint64_t n;
+    const ReuseBin* sorted = GetSortedBins(&n, scratch);
+
+    for (uint64_t i = 0; i < n; i++){
+        uint64_t d = sorted[i].distance;
+        uint32_t cnt = sorted[i].count;
+        if (d == config->invalid || cnt == 0) continue;
+
+        uint64_t p = d / 2 + 1;
+        if (config->binindividual == ReuseDistance::Infinity || d <= config->binindividual){
+            p = d;
+        }
+        *buf++ = '\t';
+        *buf++ = '\t';
+        buf = FormatDecimal(buf, p);
+        *buf++ = '\t';
+        buf = FormatDecimal(buf, d);
+        *buf++ = '\t';
+        buf = FormatDecimal(buf, cnt);
+        *buf++ = '\n';
+    }
+    return buf;
+}
+
+void SpatialLocality::Init(uint64_t size, uint64_t bin, uint64_t max, uint32_t e){
+    batchable = false;
     sequence = 1;
     capacity = size;
     binindividual = bin;
@@ -375,94 +1738,1371 @@ void SpatialLocality::Init(uint64_t size, uint64_t bin, uint64_t max){
 
     assert(capacity > 0 && capacity != ReuseDistance::Infinity && "window size must be a finite, positive value");
     assert((maxtracking == INFINITY_REUSE || maxtracking >= binindividual) && "max tracking must be at least as large as individual binning");
-}
 
-ReuseStats* SpatialLocality::GetStats(uint64_t id, bool gen){
-    ReuseStats* s = stats[id];
-    if (s == NULL && gen){
-        s = new ReuseStats(id, binindividual, maxtracking, SpatialLocality::Invalid);
-        stats[id] = s;
+    statsconfig.binindividual = binindividual;
+    statsconfig.maxtracking = maxtracking;
+    statsconfig.invalid = SpatialLocality::Invalid;
+
+    // the most recent address is checked against the capacity addresses before it,
+    // so the window holds one more address than the capacity
+    if (e == EngineAuto){
+        e = (capacity <= ScanWindowLimit) ? EngineScan : EngineBlocked;
     }
-    return s;
+    if (e == EngineScan){
+        engine = new SpatialWindowScan(capacity + 1);
+    } else if (e == EngineBlocked){
+        engine = new SpatialWindowBlocked(capacity + 1);
+    } else if (e == EngineMap){
+        engine = new SpatialWindowMap(capacity + 1);
+    } else if (e == EngineShared){
+        engine = NULL;
+    } else {
+        assert(false && "unknown SpatialLocality engine");
+    }
+}
+
+SpatialLocality::~SpatialLocality(){
+    delete engine;
 }
 
 void SpatialLocality::Process(ReuseEntry& r){
-    uint64_t addr = r.address;
-    uint64_t id = r.id;
-    ReuseStats* stats = GetStats(id, true);
+    latency_begin();
+
+    ReuseStats* stats = GetStats(r.id, true);
     debug_assert(stats);
 
-    // find the address closest to addr
-    uint64_t bestdiff = SpatialLocality::Invalid;
+    stats->Update(engine->Process(r.address));
+    sequence++;
 
-    if (awindow.size() > 0){
+    latency_end();
+    CountExport(1);
+}
 
-        map<uint64_t, uint64_t>::const_iterator it = awindow.upper_bound(addr);
-        if (it == awindow.end()){
-            it--;
-        }
+void SpatialLocality::SkipAddresses(uint64_t){
+    // flush the window completely
+    if (engine){
+        engine->Flush();
+    }
+}
 
-        // only need to check the values immediately equal, >, and < than addr
-        for (uint32_t i = 0; i < 3; i++, it--){
-            uint64_t cur = it->first;
-            uint64_t seq = it->second;
-            uint64_t diff = uint64abs(cur - addr);
+void SpatialLocality::GetActiveAddresses(std::vector<uint64_t>& addrs){
+    assert(addrs.size() == 0);
+    if (engine){
+        engine->GetActiveAddresses(addrs);
+    }
+}
 
-            if (diff < bestdiff){
-                bestdiff = diff;
-            }
+void SpatialLocality::Invalidate(uint64_t addr){
+    if (engine){
+        engine->Invalidate(addr);
+    }
+}
 
-            if (it == awindow.begin()){
-                break;
-            }
-        }
+void SpatialLocality::GetEngineStats(ReuseEngineStats& s){
+    GetCommonStats(s);
+    if (engine){
+        engine->GetEngineStats(s);
     }
+    s.totalbytes = s.windowbytes + s.hashbytes + s.statsbytes;
+}
 
-    stats->Update(bestdiff);
+// the most recent address is checked against the w addresses before it, so as in SpatialLocality
+// each window holds w + 1 addresses
+void MultiSpatialLocality::Init(const vector<uint64_t>& sizes, uint64_t b, uint64_t n, bool persize){
+    batchable = false;
+    sequence = 1;
 
-    // remove the oldest address in the window
-    if (swindow.size() > capacity){
-        uint64_t a = swindow.front();
-        swindow.pop_front();
+    vector<uint64_t> s(sizes);
+    sort(s.begin(), s.end());
+    s.erase(unique(s.begin(), s.end()), s.end());
+    assert(s.size() > 0 && "at least one window size is needed");
 
-        uint64_t v = awindow[a];
-        if (v > 1){
-            awindow[a] = v - 1;
-        } else {
-            awindow.erase(a);
-        }
+    vector<uint64_t> held;
+    for (uint32_t i = 0; i < s.size(); i++){
+        assert(s[i] > 0 && s[i] != ReuseDistance::Infinity && "window size must be a finite, positive value");
+        windows.push_back(new SpatialLocality(s[i], persize ? s[i] : b, n, SpatialLocality::EngineShared));
+        held.push_back(s[i] + 1);
     }
+    capacity = s.back();
+    best.resize(s.size());
 
-    // insert the newest address into the window
-    awindow[addr]++;
-    swindow.push_back(addr);
+    engine = new SpatialWindowMulti(held, SpatialLocality::ScanWindowLimit + 1);
 }
 
-void SpatialLocality::SkipAddresses(uint64_t amount){
+MultiSpatialLocality::~MultiSpatialLocality(){
+    delete engine;
+    for (uint32_t i = 0; i < windows.size(); i++){
+        delete windows[i];
+    }
+}
 
-    // flush the window completely
-    while (swindow.size()){
-        uint64_t a = swindow.front();
-        swindow.pop_front();
+void MultiSpatialLocality::Process(ReuseEntry& r){
+    latency_begin();
+
+    engine->Process(r.address, &best[0]);
+    for (uint32_t i = 0; i < windows.size(); i++){
+        SpatialLocality* w = windows[i];
+        w->GetStats(r.id, true)->Update(best[i]);
+        w->sequence++;
+    }
+    sequence++;
+
+    latency_end();
+    CountExport(1);
+}
+
+void MultiSpatialLocality::Print(ostream& f, bool annotate){
+    for (uint32_t i = 0; i < windows.size(); i++){
+        windows[i]->Print(f, annotate && i == 0);
+    }
+}
+
+void MultiSpatialLocality::Print(ostream& f, bool annotate, uint32_t threads){
+    for (uint32_t i = 0; i < windows.size(); i++){
+        windows[i]->Print(f, annotate && i == 0, threads);
+    }
+}
+
+void MultiSpatialLocality::SkipAddresses(uint64_t){
+    engine->Flush();
+}
+
+void MultiSpatialLocality::GetActiveAddresses(std::vector<uint64_t>& addrs){
+    assert(addrs.size() == 0);
+    engine->GetActiveAddresses(addrs);
+}
+
+void MultiSpatialLocality::Invalidate(uint64_t addr){
+    engine->Invalidate(addr);
+}
+
+void MultiSpatialLocality::GetEngineStats(ReuseEngineStats& s){
+    GetCommonStats(s);
+    engine->GetEngineStats(s);
+    for (uint32_t i = 0; i < windows.size(); i++){
+        ReuseEngineStats w;
+        windows[i]->GetEngineStats(w);
+        s.statsobjects += w.statsobjects;
+        s.statsbins += w.statsbins;
+        s.statsbytes += w.statsbytes;
+        s.allocations += w.allocations;
+    }
+
+    // every window size sees every access once
+    s.accesses = sequence - 1;
+    s.totalbytes = s.windowbytes + s.hashbytes + s.statsbytes;
+}
+
+SpatialLocality* MultiSpatialLocality::GetWindow(uint32_t i){
+    assert(i < windows.size());
+    return windows[i];
+}
+
+// the state of one id in a StrideLocality. a slot is empty when stats is NULL
+struct StrideSlot {
+    uint64_t id;
+    uint64_t last;
+    ReuseStats* stats;
+
+    // NULL until the id has a negative stride
+    ReuseStats* backward;
+};
+
+void StrideLocality::Init(uint64_t b, uint64_t n){
+    batchable = false;
+    sequence = 1;
+    binindividual = b;
+    maxtracking = n;
 
-        uint64_t v = awindow[a];
-        if (v > 1){
-            awindow[a] = v - 1;
+    assert((maxtracking == INFINITY_REUSE || maxtracking >= binindividual) && "max tracking must be at least as large as individual binning");
+
+    statsconfig.binindividual = binindividual;
+    statsconfig.maxtracking = maxtracking;
+    statsconfig.invalid = StrideLocality::Invalid;
+
+    slots = NULL;
+    shift = 64;
+    slotcount = 0;
+    lastslot = NULL;
+}
+
+StrideLocality::~StrideLocality(){
+    if (slots){
+        delete[] slots;
+    }
+}
+
+// double the slots, keeping the load at or below one half
+void StrideLocality::Grow(){
+    uint64_t oldshift = shift;
+    StrideSlot* old = slots;
+
+    shift = (slots == NULL) ? 60 : shift - 1;
+    uint64_t n = STATS_SLOTS(shift);
+    slots = new StrideSlot[n];
+    memset(slots, 0, n * sizeof(StrideSlot));
+    lastslot = NULL;
+
+    if (old){
+        for (uint64_t i = 0; i < STATS_SLOTS(oldshift); i++){
+            if (old[i].stats){
+                uint64_t h = STATS_HASH(old[i].id, shift);
+                while (slots[h].stats){
+                    h = (h + 1) & (n - 1);
+                }
+                slots[h] = old[i];
+            }
+        }
+        delete[] old;
+    }
+}
+
+// the slot of an id, or the empty slot where it belongs
+StrideSlot* StrideLocality::FindSlot(uint64_t id){
+    if (lastslot && lastslot->id == id){
+        return lastslot;
+    }
+    if (slots == NULL || (slotcount + 1) * 2 > STATS_SLOTS(shift)){
+        Grow();
+    }
+
+    uint64_t mask = STATS_SLOTS(shift) - 1;
+    uint64_t h = STATS_HASH(id, shift);
+    while (slots[h].stats && slots[h].id != id){
+        h = (h + 1) & mask;
+    }
+    return &slots[h];
+}
+
+void StrideLocality::Process(ReuseEntry& r){
+    latency_begin();
+
+    StrideSlot* s = FindSlot(r.id);
+    if (s->stats == NULL){
+        s->id = r.id;
+        s->stats = GetStats(r.id, true);
+        s->backward = backward.Find(r.id);
+        s->stats->Update(Invalid);
+        slotcount++;
+    } else {
+        // strides wrap around, so that every one of them is at most 2^63 away from 0
+        int64_t stride = (int64_t)(r.address - s->last);
+        if (stride >= 0){
+            s->stats->Update((uint64_t)stride);
         } else {
-            awindow.erase(a);
+            uint64_t m = 0 - (uint64_t)stride;
+            if (s->backward == NULL){
+                s->backward = backward.Insert(r.id, &statsconfig);
+            }
+            s->stats->Update(m);
+            s->backward->Update(m);
         }
     }
+    s->last = r.address;
+    lastslot = s;
+    sequence++;
 
-    assert(awindow.size() == 0);
-    assert(swindow.size() == 0);
+    latency_end();
+    CountExport(1);
 }
 
-void SpatialLocality::GetActiveAddresses(std::vector<uint64_t>& addrs){
-    assert(addrs.size() == 0);
+void StrideLocality::GetStrides(uint64_t id, vector<pair<int64_t, uint64_t> >& strides){
+    assert(strides.size() == 0);
+    ReuseStats* s = stats.Find(id);
+    if (s == NULL){
+        return;
+    }
+    ReuseStats* b = backward.Find(id);
+
+    vector<uint64_t> dists;
+    s->GetSortedDistances(dists);
+    if (dists.size() && dists.back() == Invalid){
+        dists.pop_back();
+    }
 
-    for (map<uint64_t, uint64_t>::const_iterator it = awindow.begin(); it != awindow.end(); it++){
-        uint64_t addr = it->first;
-        addrs.push_back(addr);
+    for (uint64_t i = dists.size(); i > 0 && b; i--){
+        uint64_t c = b->CountDistance(dists[i - 1]);
+        if (c){
+            strides.push_back(pair<int64_t, uint64_t>((int64_t)(0 - dists[i - 1]), c));
+        }
+    }
+    for (uint64_t i = 0; i < dists.size(); i++){
+        uint64_t c = s->CountDistance(dists[i]) - (b ? b->CountDistance(dists[i]) : 0);
+        if (c){
+            // only the bin above 2^62 reaches past the largest int64_t
+            int64_t d = (int64_t)min(dists[i], ((uint64_t)1 << 63) - 1);
+            strides.push_back(pair<int64_t, uint64_t>(d, c));
+        }
     }
 }
 
+uint64_t StrideLocality::GetDominantStride(uint64_t id, int64_t* stride){
+    vector<pair<int64_t, uint64_t> > strides;
+    GetStrides(id, strides);
+
+    uint64_t best = 0;
+    uint64_t bestm = 0;
+    *stride = 0;
+    for (uint64_t i = 0; i < strides.size(); i++){
+        int64_t k = strides[i].first;
+        uint64_t c = strides[i].second;
+        uint64_t m = (k < 0) ? 0 - (uint64_t)k : (uint64_t)k;
+        if (binindividual != ReuseDistance::Infinity && m > binindividual){
+            continue;
+        }
+        if (c > best || (c == best && (m < bestm || (m == bestm && k > 0)))){
+            best = c;
+            bestm = m;
+            *stride = k;
+        }
+    }
+    return best;
+}
+
+void StrideLocality::Print(ostream& f, bool annotate){
+    vector<uint64_t> keys;
+    GetIndices(keys);
+    sort(keys.begin(), keys.end());
+
+    uint64_t tot = 0, mis = 0;
+    for (vector<uint64_t>::const_iterator it = keys.begin(); it != keys.end(); it++){
+        ReuseStats* r = stats.Find(*it);
+        tot += r->GetAccessCount();
+        mis += r->GetMissCount();
+    }
+
+    if (annotate){
+        f << "# "
+          << Describe() << "STATS"
+          << TAB << "<window_size>"
+          << TAB << "<bin_indiv>"
+          << TAB << "<max_track>"
+          << TAB << "<id_count>"
+          << TAB << "<tot_access>"
+          << TAB << "<tot_miss>"
+          << ENDL;
+        f << "# "
+          << TAB << Describe() << "ID"
+          << TAB << "<id>"
+          << TAB << "<id_access>"
+          << TAB << "<id_miss>"
+          << TAB << "<dominant_stride>"
+          << TAB << "<dominant_count>"
+          << ENDL;
+        ReuseStats::PrintFormat(f);
+    }
+
+    f << Describe() << "STATS"
+      << TAB << dec << capacity
+      << TAB << binindividual
+      << TAB << maxtracking
+      << TAB << keys.size()
+      << TAB << tot
+      << TAB << mis
+      << ENDL;
+
+    for (vector<uint64_t>::const_iterator it = keys.begin(); it != keys.end(); it++){
+        uint64_t id = (*it);
+        ReuseStats* r = stats.Find(id);
+        ReuseStats* b = backward.Find(id);
+
+        int64_t dominant;
+        uint64_t dcount = GetDominantStride(id, &dominant);
+        f << TAB << Describe() << "ID"
+          << TAB << dec << id
+          << TAB << r->GetAccessCount()
+          << TAB << r->GetMissCount()
+          << TAB << dominant
+          << TAB << dcount
+          << ENDL;
+
+        // negative bins are printed from the bin farthest below 0, each as [-upper, -lower]
+        vector<uint64_t> dists;
+        r->GetSortedDistances(dists);
+        if (dists.size() && dists.back() == Invalid){
+            dists.pop_back();
+        }
+        for (uint64_t i = dists.size(); i > 0 && b; i--){
+            uint64_t d = dists[i - 1];
+            uint64_t c = b->CountDistance(d);
+            uint64_t p = (binindividual == ReuseDistance::Infinity || d <= binindividual) ? d : d / 2 + 1;
+            if (c){
+                f << TAB
+                  << TAB << "-" << d
+                  << TAB << "-" << p
+                  << TAB << c
+                  << ENDL;
+            }
+        }
+        for (uint64_t i = 0; i < dists.size(); i++){
+            uint64_t d = dists[i];
+            uint64_t c = r->CountDistance(d) - (b ? b->CountDistance(d) : 0);
+            uint64_t p = (binindividual == ReuseDistance::Infinity || d <= binindividual) ? d : d / 2 + 1;
+            if (c){
+                f << TAB
+                  << TAB << p
+                  << TAB << d
+                  << TAB << c
+                  << ENDL;
+            }
+        }
+    }
+}
+
+void StrideLocality::Print(ostream& f, bool annotate, uint32_t){
+    Print(f, annotate);
+}
+
+void StrideLocality::GetActiveAddresses(std::vector<uint64_t>& addrs){
+    assert(addrs.size() == 0);
+    for (uint64_t i = 0; slots && i < STATS_SLOTS(shift); i++){
+        if (slots[i].stats){
+            addrs.push_back(slots[i].last);
+        }
+    }
+    sort(addrs.begin(), addrs.end());
+    addrs.erase(unique(addrs.begin(), addrs.end()), addrs.end());
+}
+
+void StrideLocality::SkipAddresses(uint64_t){
+    // the stats stay behind in their tables, so only the last addresses are forgotten
+    if (slots){
+        memset(slots, 0, STATS_SLOTS(shift) * sizeof(StrideSlot));
+    }
+    slotcount = 0;
+    lastslot = NULL;
+}
+
+void StrideLocality::Invalidate(uint64_t){
+}
+
+void StrideLocality::GetEngineStats(ReuseEngineStats& s){
+    GetCommonStats(s);
+
+    s.allocations += 1 + (backward.Size() + ReuseStatsTable::ChunkSize - 1) / ReuseStatsTable::ChunkSize;
+    s.statsbytes += backward.GetBytes();
+    for (uint64_t i = 0; i < backward.Size(); i++){
+        ReuseStats* r = backward.At(i);
+        s.statsbins += r->GetBinCount();
+        s.statsbytes += r->GetBytes();
+        if (r->GetBinCount() > ReuseStats::SpillBins){
+            s.allocations += r->GetBinCount() + 2;
+        }
+    }
+
+    s.windowsize = slotcount;
+    s.hashsize = slotcount;
+    if (slots){
+        s.allocations++;
+        s.hashbuckets = STATS_SLOTS(shift);
+        s.loadfactor = (double)slotcount / s.hashbuckets;
+        s.hashbytes = s.hashbuckets * sizeof(StrideSlot);
+    }
+    s.totalbytes = s.windowbytes + s.hashbytes + s.statsbytes;
+}
+
+ByteReuseDistance::ByteReuseDistance(uint64_t w, uint64_t b)
+    : ReuseDistance(w, b), next(0), oldest(0), bytes(0)
+{
+    batchable = false;
+}
+
+ByteReuseDistance::~ByteReuseDistance(){
+}
+
+// fenwick is 1-based: fenwick[i] holds the sizes of slots [i - (i & -i), i)
+void ByteReuseDistance::Add(uint64_t slot, int64_t size){
+    uint64_t n = slotsize.size();
+    for (uint64_t i = slot + 1; i <= n; i += i & (~i + 1)){
+        fenwick[i] += size;
+    }
+}
+
+// the bytes in slots [0, slot)
+uint64_t ByteReuseDistance::Before(uint64_t slot){
+    uint64_t sum = 0;
+    for (uint64_t i = slot; i > 0; i &= i - 1){
+        sum += fenwick[i];
+    }
+    return sum;
+}
+
+void ByteReuseDistance::Remove(uint64_t slot){
+    debug_assert(slotsize[slot] != DeadSlot);
+    Add(slot, -(int64_t)slotsize[slot]);
+    bytes -= slotsize[slot];
+    slotsize[slot] = DeadSlot;
+}
+
+// move the live slots to the front, doubling the slots if more than half of them are live,
+// then rebuild the Fenwick tree in one pass
+void ByteReuseDistance::Compact(){
+    uint64_t n = slotsize.size();
+    if (n == 0){
+        n = InitialSlots;
+    } else if (bwindow.size() * 2 > n){
+        n *= 2;
+    }
+
+    uint64_t live = 0;
+    for (uint64_t i = oldest; i < next; i++){
+        if (slotsize[i] != DeadSlot){
+            slotaddr[live] = slotaddr[i];
+            slotsize[live] = slotsize[i];
+            bwindow[slotaddr[live]] = live;
+            live++;
+        }
+    }
+    debug_assert(live == bwindow.size());
+
+    slotaddr.resize(n);
+    slotsize.resize(n);
+    fenwick.assign(n + 1, 0);
+    for (uint64_t i = 1; i <= n; i++){
+        if (i <= live){
+            fenwick[i] += slotsize[i - 1];
+        }
+        uint64_t up = i + (i & (~i + 1));
+        if (up <= n){
+            fenwick[up] += fenwick[i];
+        }
+    }
+
+    oldest = 0;
+    next = live;
+}
+
+void ByteReuseDistance::Process(ByteReuseEntry& r){
+    latency_begin();
+
+    assert(r.size > 0 && "object size must be positive");
+
+    ReuseStats* stats = GetStats(r.id, true);
+
+    if (next == slotsize.size()){
+        Compact();
+    }
+
+    reuse_map_type<uint64_t, uint64_t>::const_iterator it = bwindow.find(r.address);
+    if (it != bwindow.end()){
+        uint64_t slot = it->second;
+        stats->Update(bytes - Before(slot));
+        Remove(slot);
+    } else {
+        stats->Update(ReuseDistance::Infinity);
+    }
+
+    uint64_t slot = next++;
+    slotaddr[slot] = r.address;
+    slotsize[slot] = r.size;
+    Add(slot, r.size);
+    bytes += r.size;
+    bwindow[r.address] = slot;
+
+    // evict least recently used objects until the window fits
+    if (capacity != ReuseDistance::Infinity){
+        while (bytes > capacity){
+            while (slotsize[oldest] == DeadSlot){
+                oldest++;
+            }
+            bwindow.erase(slotaddr[oldest]);
+            Remove(oldest);
+        }
+    }
+
+    sequence++;
+
+    latency_end();
+    CountExport(1);
+}
+
+void ByteReuseDistance::Process(ByteReuseEntry* rs, uint64_t count){
+    for (uint64_t i = 0; i < count; i++){
+        Process(rs[i]);
+    }
+}
+
+void ByteReuseDistance::Process(ReuseEntry& r){
+    ByteReuseEntry b;
+    b.id = r.id;
+    b.address = r.address;
+    b.size = 1;
+    Process(b);
+}
+
+void ByteReuseDistance::GetActiveAddresses(std::vector<uint64_t>& addrs){
+    assert(addrs.size() == 0);
+    for (uint64_t i = oldest; i < next; i++){
+        if (slotsize[i] != DeadSlot){
+            addrs.push_back(slotaddr[i]);
+        }
+    }
+}
+
+void ByteReuseDistance::SkipAddresses(uint64_t amount){
+    sequence += amount;
+
+    // flush the window completely
+    bwindow.clear();
+    fenwick.assign(fenwick.size(), 0);
+    next = 0;
+    oldest = 0;
+    bytes = 0;
+}
+
+void ByteReuseDistance::Invalidate(uint64_t addr){
+    reuse_map_type<uint64_t, uint64_t>::iterator it = bwindow.find(addr);
+    if (it == bwindow.end()){
+        return;
+    }
+    Remove(it->second);
+    bwindow.erase(it);
+}
+
+void ByteReuseDistance::GetEngineStats(ReuseEngineStats& s){
+    GetCommonStats(s);
+
+    uint64_t n = slotsize.size();
+    s.windowsize = bwindow.size();
+    while (((uint64_t)1 << s.treedepth) < n){
+        s.treedepth++;
+    }
+    s.windowbytes = (fenwick.capacity() + slotaddr.capacity() + slotsize.capacity()) * sizeof(uint64_t);
+
+    s.hashsize = bwindow.size();
+#ifdef HAVE_UNORDERED_MAP
+    s.hashbuckets = bwindow.bucket_count();
+    s.loadfactor = bwindow.load_factor();
+#endif
+    s.hashbytes = MapBytes(bwindow);
+
+    s.allocations += 3 + bwindow.size();
+    s.totalbytes = s.windowbytes + s.hashbytes + s.statsbytes;
+}
+
+// the time bins of the ReuseTime conversion histograms: exact below FineExact, otherwise the
+// time with all but its top FineBits bits cleared
+static inline uint64_t FineTime(uint64_t t){
+    uint64_t s = 0;
+    while (t >= ReuseTime::FineExact && (t >> s) >= ((uint64_t)1 << ReuseTime::FineBits)){
+        s++;
+    }
+    return (t >> s) << s;
+}
+
+// the largest time in the same bin as t
+static inline uint64_t FineTimeEnd(uint64_t t){
+    uint64_t s = 0;
+    while (t >= ReuseTime::FineExact && (t >> s) >= ((uint64_t)1 << ReuseTime::FineBits)){
+        s++;
+    }
+    return FineTime(t) + ((uint64_t)1 << s) - 1;
+}
+
+static inline void FineAdd(reuse_map_type<uint64_t, pair<uint64_t, double> >& m, uint64_t t){
+    pair<uint64_t, double>& b = m[FineTime(t)];
+    b.first++;
+    b.second += t;
+}
+
+ReuseTime::ReuseTime(uint64_t b)
+    : ReuseDistance(ReuseDistance::Infinity, b), now(0), distinct(0), fpnow(0)
+{
+    batchable = false;
+}
+
+ReuseTime::~ReuseTime(){
+}
+
+void ReuseTime::Process(ReuseEntry& r){
+    latency_begin();
+
+    ReuseStats* stats = GetStats(r.id, true);
+    now++;
+
+    reuse_map_type<uint64_t, uint64_t>::iterator it = lastaccess.find(r.address);
+    if (it != lastaccess.end()){
+        uint64_t t = now - it->second;
+        stats->Update(t);
+        FineAdd(reusetimes, t);
+        it->second = now;
+    } else {
+        stats->Update(ReuseDistance::Infinity);
+        FineAdd(firsttimes, now);
+        distinct++;
+        lastaccess[r.address] = now;
+    }
+
+    sequence++;
+
+    latency_end();
+    CountExport(1);
+}
+
+// an address leaves the index, so its last access goes into the conversion histograms
+void ReuseTime::Retire(uint64_t last){
+    FineAdd(lasttimes, last);
+    fpnow = 0;
+}
+
+void ReuseTime::GetActiveAddresses(std::vector<uint64_t>& addrs){
+    assert(addrs.size() == 0);
+
+    vector<pair<uint64_t, uint64_t> > order;
+    order.reserve(lastaccess.size());
+    for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = lastaccess.begin(); it != lastaccess.end(); it++){
+        order.push_back(pair<uint64_t, uint64_t>(it->second, it->first));
+    }
+    sort(order.begin(), order.end());
+
+    for (uint64_t i = 0; i < order.size(); i++){
+        addrs.push_back(order[i].second);
+    }
+}
+
+void ReuseTime::SkipAddresses(uint64_t amount){
+    sequence += amount;
+
+    // flush the index completely
+    for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = lastaccess.begin(); it != lastaccess.end(); it++){
+        Retire(it->second);
+    }
+    lastaccess.clear();
+}
+
+void ReuseTime::Invalidate(uint64_t addr){
+    reuse_map_type<uint64_t, uint64_t>::iterator it = lastaccess.find(addr);
+    if (it == lastaccess.end()){
+        return;
+    }
+    Retire(it->second);
+    lastaccess.erase(it);
+}
+
+void ReuseTime::GetEngineStats(ReuseEngineStats& s){
+    GetCommonStats(s);
+
+    s.windowsize = lastaccess.size();
+    s.windowbytes = MapBytes(reusetimes) + MapBytes(firsttimes) + MapBytes(lasttimes)
+        + fpkeys.capacity() * sizeof(uint64_t) + (fpcounts.capacity() + fpsums.capacity()) * sizeof(double);
+
+    s.hashsize = lastaccess.size();
+#ifdef HAVE_UNORDERED_MAP
+    s.hashbuckets = lastaccess.bucket_count();
+    s.loadfactor = lastaccess.load_factor();
+#endif
+    s.hashbytes = MapBytes(lastaccess);
+
+    s.allocations += lastaccess.size() + reusetimes.size() + firsttimes.size() + lasttimes.size();
+    s.totalbytes = s.windowbytes + s.hashbytes + s.statsbytes;
+}
+
+// every datum contributes its first access time f, its reuse times t and its reverse last access
+// time l = now - last + 1. all three enter the footprint as the sum over v > w of (v - w), so their
+// bins are merged into one sorted list with suffix sums of counts and of times. each bin is keyed by
+// its smallest time, so only the bin holding w is counted inexactly
+void ReuseTime::BuildFootprint(){
+    map<uint64_t, pair<double, double> > merged;
+    reuse_map_type<uint64_t, pair<uint64_t, double> >* forward[2] = { &reusetimes, &firsttimes };
+    for (uint32_t i = 0; i < 2; i++){
+        for (reuse_map_type<uint64_t, pair<uint64_t, double> >::const_iterator it = forward[i]->begin(); it != forward[i]->end(); it++){
+            pair<double, double>& b = merged[it->first];
+            b.first += it->second.first;
+            b.second += it->second.second;
+        }
+    }
+    for (reuse_map_type<uint64_t, pair<uint64_t, double> >::const_iterator it = lasttimes.begin(); it != lasttimes.end(); it++){
+        pair<double, double>& b = merged[now + 1 - min(FineTimeEnd(it->first), now)];
+        b.first += it->second.first;
+        b.second += it->second.first * (double)(now + 1) - it->second.second;
+    }
+    for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = lastaccess.begin(); it != lastaccess.end(); it++){
+        uint64_t l = now + 1 - it->second;
+        pair<double, double>& b = merged[FineTime(l)];
+        b.first += 1.0;
+        b.second += l;
+    }
+
+    uint64_t n = merged.size();
+    fpkeys.resize(n);
+    fpcounts.resize(n + 1);
+    fpsums.resize(n + 1);
+    fpcounts[n] = 0.0;
+    fpsums[n] = 0.0;
+
+    uint64_t i = n;
+    for (map<uint64_t, pair<double, double> >::reverse_iterator it = merged.rbegin(); it != merged.rend(); it++){
+        i--;
+        fpkeys[i] = it->first;
+        fpcounts[i] = fpcounts[i + 1] + it->second.first;
+        fpsums[i] = fpsums[i + 1] + it->second.second;
+    }
+    fpnow = now;
+}
+
+double ReuseTime::GetFootprint(uint64_t w){
+    if (now == 0){
+        return 0.0;
+    }
+    if (fpnow != now){
+        BuildFootprint();
+    }
+    if (w > now){
+        w = now;
+    }
+
+    uint64_t i = upper_bound(fpkeys.begin(), fpkeys.end(), w) - fpkeys.begin();
+    double fp = distinct - (fpsums[i] - (double)w * fpcounts[i]) / (double)(now - w + 1);
+    return (fp < 0.0) ? 0.0 : fp;
+}
+
+// the miss ratio is the slope of the footprint at the shortest window whose footprint fills the
+// cache, which is found by binary search over [lo, now) since the footprint does not decrease.
+// first accesses always miss, so the callers never return less than distinct / now
+static double MissRatioAt(ReuseTime* r, uint64_t c, uint64_t* lo, uint64_t now){
+    uint64_t hi = now - 1;
+    while (*lo < hi){
+        uint64_t mid = *lo + (hi - *lo) / 2;
+        if (r->GetFootprint(mid) >= c){
+            hi = mid;
+        } else {
+            *lo = mid + 1;
+        }
+    }
+    return r->GetFootprint(*lo + 1) - r->GetFootprint(*lo);
+}
+
+double ReuseTime::GetMissRatio(uint64_t c){
+    if (now == 0){
+        return 0.0;
+    }
+    uint64_t lo = 0;
+    return max(MissRatioAt(this, c, &lo, now), (double)distinct / now);
+}
+
+void ReuseTime::GetMissRatioCurve(std::vector<uint64_t>& sizes, std::vector<double>& ratios){
+    assert(ratios.size() == 0);
+
+    uint64_t lo = 0;
+    for (uint64_t i = 0; i < sizes.size(); i++){
+        if (now == 0){
+            ratios.push_back(0.0);
+            continue;
+        }
+        // ascending sizes continue the search from the previous window
+        if (i && sizes[i] < sizes[i - 1]){
+            lo = 0;
+        }
+        ratios.push_back(max(MissRatioAt(this, sizes[i], &lo, now), (double)distinct / now));
+    }
+}
+
+ReuseStats* ReuseTime::GetDistanceStats(uint64_t id){
+    ReuseStats* times = ReuseDistance::GetStats(id);
+    if (times == NULL){
+        return NULL;
+    }
+
+    ReuseStats* dists = new ReuseStats(id, binindividual, ReuseDistance::Infinity, ReuseDistance::Infinity);
+
+    vector<uint64_t> keys;
+    times->GetSortedDistances(keys);
+    for (vector<uint64_t>::const_iterator it = keys.begin(); it != keys.end(); it++){
+        uint64_t t = *it;
+        uint64_t cnt = times->CountDistance(t);
+        if (t == ReuseDistance::Infinity){
+            dists->Update(ReuseDistance::Infinity, cnt);
+            continue;
+        }
+
+        // a binned time stands for the middle of (t/2, t]
+        double mid = t;
+        if (binindividual != ReuseDistance::Infinity && t > binindividual){
+            mid = 0.75 * t;
+        }
+        uint64_t d = (uint64_t)(GetFootprint((uint64_t)mid) + 0.5);
+        dists->Update((d == 0) ? 1 : d, cnt);
+    }
+    return dists;
+}
+
+// holds the private stats of all threads merged together, for printing
+class PrivateReuseDistance : public ReuseDistance {
+protected:
+    virtual const std::string Describe() { return "PRIVATE"; }
+
+public:
+    PrivateReuseDistance(uint64_t w, uint64_t b) : ReuseDistance(w, b) {}
+
+    void Merge(ReuseDistance* r){
+        vector<uint64_t> ids;
+        r->GetIndices(ids);
+        for (vector<uint64_t>::const_iterator it = ids.begin(); it != ids.end(); it++){
+            GetStats(*it, true)->Merge(r->GetStats(*it));
+        }
+    }
+};
+
+void ThreadedReuseDistance::Init(uint64_t p, uint32_t n, bool inv){
+    privatecapacity = p;
+    invalidate = inv;
+    batchable = false;
+    pending = 0;
+
+    assert(n > 0 && "at least 1 worker thread is required");
+    windows.resize(n);
+    batches.resize(n);
+    pool = new ReuseWorkerPool(n);
+}
+
+ThreadedReuseDistance::~ThreadedReuseDistance(){
+    delete pool;
+
+    for (uint32_t i = 0; i < windows.size(); i++){
+        for (reuse_map_type<uint32_t, ReuseDistance*>::const_iterator it = windows[i].begin(); it != windows[i].end(); it++){
+            delete it->second;
+        }
+    }
+}
+
+void ThreadedReuseDistance::ProcessPrivate(void* arg, uint32_t worker){
+    ThreadedReuseDistance* t = (ThreadedReuseDistance*)arg;
+    reuse_map_type<uint32_t, ReuseDistance*>& mine = t->windows[worker];
+    vector<ThreadedReuseEntry>& batch = t->batches[worker];
+    uint32_t workers = t->windows.size();
+
+    ReuseEntry r;
+    for (uint64_t i = 0; i < batch.size(); i++){
+        ThreadedReuseEntry& e = batch[i];
+
+        if (e.thread % workers == worker){
+            ReuseDistance* w = mine[e.thread];
+            if (w == NULL){
+                w = new ReuseDistance(t->privatecapacity, t->binindividual);
+                mine[e.thread] = w;
+            }
+            r.id = e.id;
+            r.address = e.address;
+            w->Process(r);
+        }
+
+        // every worker is given every write, so each can invalidate its own threads' windows
+        if (t->invalidate && e.write){
+            for (reuse_map_type<uint32_t, ReuseDistance*>::const_iterator it = mine.begin(); it != mine.end(); it++){
+                if (it->first != e.thread){
+                    it->second->Invalidate(e.address);
+                }
+            }
+        }
+    }
+}
+
+inline void ThreadedReuseDistance::Buffer(ThreadedReuseEntry& addr){
+    uint32_t owner = addr.thread % batches.size();
+    batches[owner].push_back(addr);
+    if (invalidate && addr.write){
+        for (uint32_t k = 0; k < batches.size(); k++){
+            if (k != owner){
+                batches[k].push_back(addr);
+            }
+        }
+    }
+    pending++;
+}
+
+void ThreadedReuseDistance::Flush(){
+    if (pending == 0){
+        return;
+    }
+    pool->Start(ThreadedReuseDistance::ProcessPrivate, this);
+    pool->Wait();
+
+    for (uint32_t k = 0; k < batches.size(); k++){
+        batches[k].clear();
+    }
+    pending = 0;
+}
+
+// the shared window is updated while the workers run through a full batch
+void ThreadedReuseDistance::Process(ThreadedReuseEntry* addrs, uint64_t count){
+    ReuseEntry r;
+    for (uint64_t i = 0; i < count; ){
+        uint64_t n = min(count - i, BatchSize - pending);
+        for (uint64_t j = i; j < i + n; j++){
+            Buffer(addrs[j]);
+        }
+
+        bool full = (pending == BatchSize);
+        if (full){
+            pool->Start(ThreadedReuseDistance::ProcessPrivate, this);
+        }
+        for (uint64_t j = i; j < i + n; j++){
+            r.id = addrs[j].id;
+            r.address = addrs[j].address;
+            ProcessAddress(r);
+        }
+        if (full){
+            pool->Wait();
+            for (uint32_t k = 0; k < batches.size(); k++){
+                batches[k].clear();
+            }
+            pending = 0;
+        }
+        CountExport(n);
+        i += n;
+    }
+}
+
+void ThreadedReuseDistance::Process(ThreadedReuseEntry& addr){
+    Process(&addr, 1);
+}
+
+void ThreadedReuseDistance::Process(ReuseEntry& addr){
+    ThreadedReuseEntry t;
+    t.id = addr.id;
+    t.address = addr.address;
+    t.thread = 0;
+    t.write = 0;
+    Process(&t, 1);
+}
+
+void ThreadedReuseDistance::SkipAddresses(uint64_t amount){
+    Flush();
+    ReuseDistance::SkipAddresses(amount);
+    for (uint32_t i = 0; i < windows.size(); i++){
+        for (reuse_map_type<uint32_t, ReuseDistance*>::const_iterator it = windows[i].begin(); it != windows[i].end(); it++){
+            it->second->SkipAddresses(amount);
+        }
+    }
+}
+
+ReuseStats* ThreadedReuseDistance::GetPrivateStats(uint32_t thread, uint64_t id){
+    Flush();
+    reuse_map_type<uint32_t, ReuseDistance*>& mine = windows[thread % windows.size()];
+    reuse_map_type<uint32_t, ReuseDistance*>::const_iterator it = mine.find(thread);
+    if (it == mine.end()){
+        return NULL;
+    }
+    return it->second->GetStats(id);
+}
+
+ReuseDistance* ThreadedReuseDistance::MergePrivate(){
+    PrivateReuseDistance* p = new PrivateReuseDistance(privatecapacity, binindividual);
+    for (uint32_t i = 0; i < windows.size(); i++){
+        for (reuse_map_type<uint32_t, ReuseDistance*>::const_iterator it = windows[i].begin(); it != windows[i].end(); it++){
+            p->Merge(it->second);
+        }
+    }
+    return p;
+}
+
+void ThreadedReuseDistance::Print(ostream& f, bool annotate){
+    Flush();
+    ReuseDistance::Print(f, annotate);
+
+    ReuseDistance* p = MergePrivate();
+    p->Print(f, annotate);
+    delete p;
+}
+
+void ThreadedReuseDistance::Print(ostream& f, bool annotate, uint32_t threads){
+    Flush();
+    ReuseDistance::Print(f, annotate, threads);
+
+    ReuseDistance* p = MergePrivate();
+    p->Print(f, annotate, threads);
+    delete p;
+}
+
+// an address and the ReuseStats of its id, sorted into the batch of the worker which owns the id
+struct ShardEntry {
+    ReuseStats* stats;
+    uint64_t address;
+};
+
+// everything a worker of a ShardedReuseDistance owns. the ReuseStats of its ids are in the
+// ShardedReuseDistance's table, but they only allocate bins from config.arena
+struct ReuseShard {
+    ReuseStatsConfig config;
+
+    // [id -> window]
+    reuse_map_type<uint64_t, ReuseWindow*> windows;
+
+    std::vector<ShardEntry> batch;
+};
+
+ShardedReuseDistance::ShardedReuseDistance(uint64_t w, uint64_t b, uint32_t n)
+    : ReuseDistance(w, b)
+{
+    ShardedReuseDistance::Init(n);
+}
+
+ShardedReuseDistance::ShardedReuseDistance(uint64_t w)
+    : ReuseDistance(w)
+{
+    ShardedReuseDistance::Init(DefaultWorkers);
+}
+
+void ShardedReuseDistance::Init(uint32_t n){
+    batchable = false;
+    pending = 0;
+
+    assert(n > 0 && "at least 1 worker thread is required");
+    for (uint32_t i = 0; i < n; i++){
+        ReuseShard* s = new ReuseShard();
+        s->config.binindividual = binindividual;
+        s->config.maxtracking = capacity;
+        s->config.invalid = ReuseDistance::Infinity;
+        s->config.arena = new ReuseBinArena();
+        shards.push_back(s);
+    }
+    pool = new ReuseWorkerPool(n);
+}
+
+ShardedReuseDistance::~ShardedReuseDistance(){
+    delete pool;
+
+    // the ReuseStats give their bins back to the shards' arenas, so they go first
+    stats.Clear();
+
+    for (uint32_t i = 0; i < shards.size(); i++){
+        ReuseShard* s = shards[i];
+        for (reuse_map_type<uint64_t, ReuseWindow*>::const_iterator it = s->windows.begin(); it != s->windows.end(); it++){
+            delete it->second;
+        }
+        delete s->config.arena;
+        delete s;
+    }
+}
+
+inline uint32_t ShardedReuseDistance::Shard(uint64_t id){
+    return ((id * 0x9E3779B97F4A7C15L) >> 32) % shards.size();
+}
+
+void ShardedReuseDistance::ProcessShard(void* arg, uint32_t worker){
+    ShardedReuseDistance* t = (ShardedReuseDistance*)arg;
+    ReuseShard* s = t->shards[worker];
+
+    // consecutive addresses often share an id
+    ReuseStats* last = NULL;
+    ReuseWindow* window = NULL;
+    for (uint64_t i = 0; i < s->batch.size(); i++){
+        ShardEntry& e = s->batch[i];
+        if (e.stats != last){
+            ReuseWindow*& w = s->windows[e.stats->GetId()];
+            if (w == NULL){
+                w = new ReuseWindowBTree(t->capacity, ReuseDistance::IndexHash);
+            }
+            last = e.stats;
+            window = w;
+        }
+        e.stats->Update(window->Process(e.address));
+    }
+}
+
+// new ids are given their ReuseStats here, by the calling thread, so the workers never touch the table
+inline void ShardedReuseDistance::Buffer(ReuseEntry& addr){
+    uint32_t k = Shard(addr.id);
+    ShardEntry e;
+    e.stats = stats.Find(addr.id);
+    if (e.stats == NULL){
+        e.stats = stats.Insert(addr.id, &shards[k]->config);
+    }
+    e.address = addr.address;
+    shards[k]->batch.push_back(e);
+
+    if (++pending == BatchSize){
+        Flush();
+    }
+}
+
+void ShardedReuseDistance::Flush(){
+    if (pending == 0){
+        return;
+    }
+    pool->Start(ShardedReuseDistance::ProcessShard, this);
+    pool->Wait();
+
+    for (uint32_t k = 0; k < shards.size(); k++){
+        shards[k]->batch.clear();
+    }
+    sequence += pending;
+    pending = 0;
+}
+
+void ShardedReuseDistance::ProcessArray(ReuseEntry* rs, uint64_t count){
+    for (uint64_t i = 0; i < count; i++){
+        Buffer(rs[i]);
+    }
+}
+
+void ShardedReuseDistance::Process(ReuseEntry& addr){
+    Buffer(addr);
+    CountExport(1);
+}
+
+void ShardedReuseDistance::GetActiveAddresses(vector<uint64_t>& addrs){
+    Flush();
+    assert(addrs.size() == 0);
+    for (uint32_t i = 0; i < shards.size(); i++){
+        for (reuse_map_type<uint64_t, ReuseWindow*>::const_iterator it = shards[i]->windows.begin(); it != shards[i]->windows.end(); it++){
+            it->second->GetActiveAddresses(addrs);
+        }
+    }
+    sort(addrs.begin(), addrs.end());
+    addrs.erase(unique(addrs.begin(), addrs.end()), addrs.end());
+}
+
+void ShardedReuseDistance::GetActiveAddresses(uint64_t id, vector<uint64_t>& addrs){
+    Flush();
+    assert(addrs.size() == 0);
+    ReuseShard* s = shards[Shard(id)];
+    reuse_map_type<uint64_t, ReuseWindow*>::const_iterator it = s->windows.find(id);
+    if (it != s->windows.end()){
+        it->second->GetActiveAddresses(addrs);
+    }
+}
+
+void ShardedReuseDistance::SkipAddresses(uint64_t amount){
+    Flush();
+    sequence += amount;
+    for (uint32_t i = 0; i < shards.size(); i++){
+        for (reuse_map_type<uint64_t, ReuseWindow*>::const_iterator it = shards[i]->windows.begin(); it != shards[i]->windows.end(); it++){
+            it->second->Flush();
+        }
+    }
+}
+
+void ShardedReuseDistance::Invalidate(uint64_t addr){
+    Flush();
+    for (uint32_t i = 0; i < shards.size(); i++){
+        for (reuse_map_type<uint64_t, ReuseWindow*>::const_iterator it = shards[i]->windows.begin(); it != shards[i]->windows.end(); it++){
+            it->second->Invalidate(addr);
+        }
+    }
+}
+
+void ShardedReuseDistance::GetEngineStats(ReuseEngineStats& s){
+    Flush();
+    GetCommonStats(s);
+
+    for (uint32_t i = 0; i < shards.size(); i++){
+        ReuseShard* sh = shards[i];
+        s.statsbytes += sh->config.arena->GetBytes();
+        s.allocations += sh->config.arena->GetSlabCount() + sh->windows.size();
+
+        for (reuse_map_type<uint64_t, ReuseWindow*>::const_iterator it = sh->windows.begin(); it != sh->windows.end(); it++){
+            ReuseEngineStats w;
+            memset(&w, 0, sizeof(ReuseEngineStats));
+            it->second->GetEngineStats(w);
+
+            s.windowsize += w.windowsize;
+            s.treedepth = max(s.treedepth, w.treedepth);
+            s.hashsize += w.hashsize;
+            s.hashbuckets += w.hashbuckets;
+            s.allocations += w.allocations;
+            s.windowbytes += w.windowbytes;
+            s.hashbytes += w.hashbytes;
+        }
+    }
+    s.loadfactor = s.hashbuckets ? (double)s.hashsize / s.hashbuckets : 0;
+    s.totalbytes = s.windowbytes + s.hashbytes + s.statsbytes;
+}
+
+AnalyzerSet::AnalyzerSet(uint64_t g, uint32_t t)
+    : pool(NULL), threads(t), mask(~(g - 1)), idmap(NULL), idarg(NULL), filling(0), analyzing(1), running(false)
+{
+    assert(g > 0 && (g & (g - 1)) == 0 && "granularity must be a power of 2");
+    staged[0].reserve(BatchSize);
+    staged[1].reserve(BatchSize);
+}
+
+AnalyzerSet::AnalyzerSet()
+    : pool(NULL), threads(0), mask(~0UL), idmap(NULL), idarg(NULL), filling(0), analyzing(1), running(false)
+{
+    staged[0].reserve(BatchSize);
+    staged[1].reserve(BatchSize);
+}
+
+AnalyzerSet::~AnalyzerSet(){
+    Flush();
+    if (pool){
+        delete pool;
+    }
+}
+
+void AnalyzerSet::Add(ReuseDistance* r){
+    assert(pool == NULL && "analyzers must be added before the first address is processed");
+    assert(r);
+    analyzers.push_back(r);
+}
+
+void AnalyzerSet::SetIdMap(uint64_t (*fn)(uint64_t id, void* arg), void* arg){
+    assert(pool == NULL && "the id map must be set before the first address is processed");
+    idmap = fn;
+    idarg = arg;
+}
+
+void AnalyzerSet::ProcessBatch(void* arg, uint32_t worker){
+    AnalyzerSet* s = (AnalyzerSet*)arg;
+    vector<ReuseEntry>& batch = s->staged[s->analyzing];
+    uint32_t workers = s->pool->GetSize();
+
+    for (uint32_t i = worker; i < s->analyzers.size(); i += workers){
+        s->analyzers[i]->Process(&batch[0], batch.size());
+    }
+}
+
+// hand the batch being filled to the workers once they are done with the last one
+void AnalyzerSet::Dispatch(){
+    if (running){
+        pool->Wait();
+        running = false;
+    }
+    if (staged[filling].size() == 0){
+        return;
+    }
+
+    if (pool == NULL){
+        assert(analyzers.size() > 0 && "no analyzers were added");
+        uint32_t n = analyzers.size();
+        if (threads > 0 && threads < n){
+            n = threads;
+        }
+        pool = new ReuseWorkerPool(n);
+    }
+
+    analyzing = filling;
+    filling = 1 - filling;
+    staged[filling].clear();
+
+    pool->Start(AnalyzerSet::ProcessBatch, this);
+    running = true;
+}
+
+void AnalyzerSet::Process(ReuseEntry* addrs, uint64_t count){
+    for (uint64_t i = 0; i < count; i++){
+        Process(addrs[i]);
+    }
+}
+
+void AnalyzerSet::Process(ReuseEntry& addr){
+    vector<ReuseEntry>& batch = staged[filling];
+
+    ReuseEntry r;
+    r.id = idmap ? idmap(addr.id, idarg) : addr.id;
+    r.address = addr.address & mask;
+    batch.push_back(r);
+
+    if (batch.size() == BatchSize){
+        Dispatch();
+    }
+}
+
+void AnalyzerSet::Flush(){
+    Dispatch();
+    if (running){
+        pool->Wait();
+        running = false;
+    }
+}
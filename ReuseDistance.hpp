@@ -29,6 +29,9 @@
  * ids.
  */
 
+#ifndef _ReuseDistance_hpp_
+#define _ReuseDistance_hpp_
+
 #include <assert.h>
 #include <stdlib.h>
 #include <tree234.h>
@@ -73,6 +76,150 @@ struct ReuseEntry {
 
 
 class ReuseStats;
+class SpatialWindow;
+class SpatialWindowMulti;
+struct StrideSlot;
+class ReuseExport;
+class ReuseWindow;
+class ReuseIndex;
+class ReuseBinArena;
+struct ReuseBulk;
+struct ReuseQueries;
+
+/**
+ * @struct ReuseBin
+ *
+ * A distance bin and the number of accesses which fell into it.
+ */
+struct ReuseBin {
+    uint64_t distance;
+    uint64_t count;
+};
+
+/**
+ * @struct ReuseStatsConfig
+ *
+ * The binning parameters of a ReuseStats, which are kept once per ReuseDistance rather than
+ * once per id.
+ *
+ * @field binindividual  Stop collecting individual bins above this value.
+ * @field maxtracking  Any value above this is considered a miss.
+ * @field invalid  The value which represents a miss.
+ * @field arena  Where bins are allocated from, or NULL for a ReuseStats which owns its config.
+ */
+struct ReuseStatsConfig {
+    uint64_t binindividual;
+    uint64_t maxtracking;
+    uint64_t invalid;
+    ReuseBinArena* arena;
+};
+
+/**
+ * @class ReuseStatsTable
+ *
+ * The ReuseStats of every id seen by a ReuseDistance. The ReuseStats are stored in fixed-size
+ * chunks, so they never move once created, and are found through an open-addressed table of
+ * pointers.
+ */
+class ReuseStatsTable {
+private:
+    ReuseStats** slots;
+    uint64_t shift;
+    uint64_t count;
+    std::vector<ReuseStats*> chunks;
+
+    // the most recently found ReuseStats, since consecutive accesses often share an id
+    ReuseStats* last;
+
+    void Grow();
+
+public:
+
+    // ReuseStats per chunk
+    static const uint64_t ChunkSize = 256;
+
+    ReuseStatsTable();
+    ~ReuseStatsTable();
+
+    /**
+     * Find the ReuseStats for an id.
+     *
+     * @return The ReuseStats, or NULL if there is none.
+     */
+    ReuseStats* Find(uint64_t id);
+
+    /**
+     * Create the ReuseStats for an id. The id must not already have one.
+     *
+     * @return The new ReuseStats.
+     */
+    ReuseStats* Insert(uint64_t id, ReuseStatsConfig* c);
+
+    /**
+     * @return The number of ids.
+     */
+    uint64_t Size() { return count; }
+
+    /**
+     * @return The ReuseStats of the i'th id to be inserted, 0 <= i < Size().
+     */
+    ReuseStats* At(uint64_t i);
+
+    /**
+     * Destroy every ReuseStats.
+     */
+    void Clear();
+
+    /**
+     * @return The estimated bytes held by the table itself, not counting the ReuseStats.
+     */
+    uint64_t GetBytes();
+};
+
+/**
+ * @struct ReuseEngineStats
+ *
+ * ReuseEngineStats describes the internal state of a ReuseDistance, for finding out why a run
+ * is slow or uses a lot of memory. Byte counts are estimates which include the allocator's
+ * per-node pointers but not its own bookkeeping.
+ *
+ * @field accesses  The number of addresses processed.
+ * @field windowsize  The number of addresses currently in the window.
+ * @field capacity  The window capacity, or ReuseDistance::Infinity.
+ * @field treedepth  The number of levels in the window's search tree, or 0 if it has none.
+ * @field hashsize  The number of entries in the address hash.
+ * @field hashbuckets  The number of buckets in the address hash, or 0 if it is not a hash.
+ * @field loadfactor  hashsize / hashbuckets, or 0 if the address hash is not a hash.
+ * @field statsobjects  The number of ReuseStats objects (one per unique id).
+ * @field statsbins  The number of distance bins held by all ReuseStats objects.
+ * @field allocations  The number of live heap blocks held by the window, hash and stats.
+ * @field windowbytes  Estimated bytes held by the window.
+ * @field hashbytes  Estimated bytes held by the address hash.
+ * @field statsbytes  Estimated bytes held by the ReuseStats objects.
+ * @field totalbytes  windowbytes + hashbytes + statsbytes.
+ * @field samplerate  1 in this many addresses is being tracked, see the memory budget
+ * ReuseDistance constructor.
+ * @field latency  A histogram of sampled Process latencies in nanoseconds, or NULL if
+ * the library was not built with REUSE_LATENCY defined. Owned by the ReuseDistance.
+ */
+struct ReuseEngineStats {
+    uint64_t accesses;
+    uint64_t windowsize;
+    uint64_t capacity;
+    uint64_t treedepth;
+    uint64_t hashsize;
+    uint64_t hashbuckets;
+    double loadfactor;
+    uint64_t statsobjects;
+    uint64_t statsbins;
+    uint64_t allocations;
+    uint64_t windowbytes;
+    uint64_t hashbytes;
+    uint64_t statsbytes;
+    uint64_t totalbytes;
+    uint64_t samplerate;
+    ReuseStats* latency;
+};
 
 /**
  * @class ReuseDistance
@@ -88,22 +235,84 @@ private:
     // [sequence -> address] A counted B-tree filled with ReuseEntry*, sorted by __seq. this is from tree234.h
     tree234* window;
 
-    // [address -> sequence]
-    reuse_map_type<uint64_t, uint64_t> mwindow;
+    // [address -> sequence], see ReuseIndex.hpp
+    ReuseIndex* mwindow;
 
     uint64_t current;
 
+    // replaces window and mwindow when it is not NULL, see ReuseWindow.hpp
+    ReuseWindow* windowengine;
+
+    // memory budget in bytes, and the hashed sampling used to stay within it. an address
+    // is tracked when the low sampleshift bits of its hash are all 0
+    uint64_t membudget;
+    uint64_t sampleshift;
+    uint64_t samplemask;
+    uint64_t windowcapacity;
+
+    // [access at which sampling was raised, sample rate, estimated bytes before]
+    std::vector<uint64_t> degradations;
+
+    uint64_t EstimateBytes();
+    void CheckBudget();
+    void PrintDegradations(std::ostream& f);
+
+    // scratch space for ProcessBulk, allocated by its first use. ProcessBulk only works on the
+    // tree234 window, so it is never used with windowengine
+    ReuseBulk* bulk;
+
+    // batches left to process one address at a time before ProcessBulk is tried again
+    uint64_t bulkskip;
+
+    void ProcessBulk(ReuseEntry* rs, uint64_t count);
+
+    // published to every exportinterval addresses, exportleft addresses from now. the array Process
+    // counts its addresses itself, and sets exporter aside meanwhile so that they are not counted twice
+    ReuseExport* exporter;
+    uint64_t exportinterval;
+    uint64_t exportleft;
+
+    friend class ReuseExport;
+
 protected:
     // store all stats
     // [id -> stats for this id]
-    reuse_map_type<uint64_t, ReuseStats*> stats;
+    ReuseStatsTable stats;
+
+    // binning parameters shared by every ReuseStats in stats
+    ReuseStatsConfig statsconfig;
 
     uint64_t capacity;
     uint64_t sequence;
     uint64_t binindividual;
     uint64_t maxtracking;
 
+    // all ids' counts together, built by GetAggregateStats when sequence has changed
+    ReuseStats* aggregate;
+    uint64_t aggregatesequence;
+
+    // sampled Process latencies, only kept when built with REUSE_LATENCY
+    ReuseStats* latency;
+    uint64_t latencycalls;
+
+    // arrays may be processed by ProcessBulk, which reproduces ReuseDistance::Process. subclasses
+    // which override Process(ReuseEntry&) clear this
+    bool batchable;
+
     void Init(uint64_t w, uint64_t b);
+    void SetWindow(uint32_t e, uint32_t i);
+    void GetCommonStats(ReuseEngineStats& s);
+
+    // ReuseDistance::Process without the export count, for subclasses which use the window of
+    // their ReuseDistance as part of a Process of their own
+    void ProcessAddress(ReuseEntry& r);
+
+    // count n processed addresses towards the next publish. every Process(ReuseEntry&) calls this
+    void CountExport(uint64_t n);
+
+    // the array Process, once it has been split for the export. subclasses which want arrays
+    // of addresses rather than one address at a time override this
+    virtual void ProcessArray(ReuseEntry* rs, uint64_t count);
     virtual ReuseStats* GetStats(uint64_t id, bool gen);
     virtual const std::string Describe() { return "REUSE"; }
 
@@ -112,6 +321,70 @@ public:
     static const uint64_t DefaultBinIndividual = 32;
     static const uint64_t Infinity = INFINITY_REUSE;
 
+    // when built with REUSE_LATENCY, 1 in this many Process calls is timed
+    static const uint64_t LatencySampleRate = 64;
+
+    // with a memory budget, usage is estimated every this many addresses (a power of 2)
+    static const uint64_t BudgetCheckInterval = 16384;
+
+    // sampling is raised when usage goes above this many 1/8ths of the budget
+    static const uint64_t BudgetThreshold = 7;
+
+    // sampling is never raised beyond 1 in 2^MaxSampleShift addresses
+    static const uint64_t MaxSampleShift = 24;
+
+    // arrays are processed in batches of up to this many addresses
+    static const uint64_t BulkSize = 4096;
+
+    // a batch only beats processing its addresses one at a time when it repeats them. after a
+    // batch in which more than 1 in BulkDistinctShare addresses were distinct, the next
+    // BulkBackoff batches are processed one address at a time
+    static const uint64_t BulkDistinctShare = 2;
+    static const uint64_t BulkBackoff = 16;
+
+    /**
+     * Choose the window implementation based on the window size: WindowTree under a memory budget,
+     * otherwise WindowBitmap up to BitmapWindowLimit and WindowBTree beyond it.
+     */
+    static const uint32_t WindowAuto = 0;
+
+    /**
+     * A counted B-tree of addresses ordered by their latest access, plus a hash of addresses. Good
+     * for any window size, and the only implementation for memory budgets. Without a budget, arrays
+     * of addresses are processed in batches (see the array version of Process).
+     */
+    static const uint32_t WindowTree = 1;
+
+    /**
+     * A ring of bits over the most recent accesses with popcount summaries, plus a hash of addresses.
+     * Only good for small windows.
+     */
+    static const uint32_t WindowBitmap = 2;
+
+    /**
+     * A counted B+-tree whose nodes hold BTREE_FANOUT sequence numbers, plus a hash of addresses. Good for
+     * large and unlimited windows, where it touches far fewer cache lines per access than WindowTree.
+     */
+    static const uint32_t WindowBTree = 3;
+
+    /**
+     * WindowAuto uses WindowBitmap for windows of this size or smaller, and WindowBTree for anything larger.
+     */
+    static const uint64_t BitmapWindowLimit = 65536;
+
+    /**
+     * Find the latest access to each address in a hash.
+     */
+    static const uint32_t IndexHash = 0;
+
+    /**
+     * Find the latest access to each address in a multi-level page table whose leaves are dense
+     * arrays covering ReusePageTable::PageSize consecutive addresses. Faster and smaller than
+     * IndexHash when addresses are clustered into a few regions (such as cache line numbers
+     * from a handful of heap and stack areas), and much larger when they are scattered.
+     */
+    static const uint32_t IndexPageTable = 1;
+
     /**
      * Contructs a ReuseDistance object.
      *
@@ -131,6 +404,44 @@ public:
      */
     ReuseDistance(uint64_t w);
 
+    /**
+     * Contructs a ReuseDistance object which stays within a memory budget. While the estimated size
+     * of the window and statistics is well below the budget, this behaves exactly like the 2-argument
+     * constructor. When it approaches the budget, the ReuseDistance switches to hashed sampling: only
+     * addresses whose hash falls in a 1/2^k subset are tracked, addresses outside that subset are
+     * evicted, and the distances and counts of tracked addresses are scaled up by 2^k. k is raised
+     * by 1 each time the budget is approached again. Each change is recorded in the output of Print.
+     *
+     * @param w  See the 2-argument constructor.
+     * @param b  See the 2-argument constructor.
+     * @param m  The memory budget in bytes. No budget is imposed if m == ReuseDistance::Infinity.
+     *
+     */
+    ReuseDistance(uint64_t w, uint64_t b, uint64_t m);
+
+    /**
+     * Contructs a ReuseDistance object which uses a specific window implementation. Every implementation
+     * gives the same results. Otherwise equivalent to the 3-argument constructor.
+     *
+     * @param e  The window implementation. One of ReuseDistance::WindowAuto, ReuseDistance::WindowTree,
+     * ReuseDistance::WindowBitmap or ReuseDistance::WindowBTree. WindowBitmap requires
+     * w != ReuseDistance::Infinity and m == ReuseDistance::Infinity, and WindowBTree requires
+     * m == ReuseDistance::Infinity, which is enforced at runtime. Unless w is
+     * ReuseWindowFront::FrontSize or smaller, WindowBitmap and WindowBTree are put behind a
+     * ReuseWindowFront (see ReuseWindow.hpp), which finds the shortest distances on its own.
+     */
+    ReuseDistance(uint64_t w, uint64_t b, uint64_t m, uint32_t e);
+
+    /**
+     * Contructs a ReuseDistance object which uses a specific window implementation and address index.
+     * Every index gives the same results. Otherwise equivalent to the 4-argument constructor.
+     *
+     * @param i  The address index. One of ReuseDistance::IndexHash or ReuseDistance::IndexPageTable.
+     * A page table does not shrink much when sampling is raised, so IndexPageTable requires
+     * m == ReuseDistance::Infinity, which is enforced at runtime.
+     */
+    ReuseDistance(uint64_t w, uint64_t b, uint64_t m, uint32_t e, uint32_t i);
+
     /**
      * Destroys a ReuseDistance object.
      */
@@ -164,6 +475,20 @@ public:
      */
     virtual void Print(std::ostream& f, bool annotate=false);
 
+    /**
+     * Print statistics for this ReuseDistance to an output stream, producing output that is
+     * byte-identical to the other versions of ReuseDistance::Print. The per-id blocks are formatted
+     * in parallel into a single preallocated buffer, which is then handed to the stream with a single
+     * write. This is much faster than the other versions of Print when a large number of ids are present.
+     *
+     * @param f  The output stream to print results to.
+     * @param annotate  Also print annotations describing the meaning of output fields, preceded by a '#'.
+     * @param threads  The number of threads used to format the output. threads > 0 is enforced at runtime.
+     *
+     * @return none
+     */
+    virtual void Print(std::ostream& f, bool annotate, uint32_t threads);
+
     /**
      * Print statistics for this ReuseDistance to std::cout.
      * See the other version of ReuseDistance::Print for information about output format.
@@ -194,6 +519,12 @@ public:
 
     /**
      * Process multiple memory addresses. Equivalent to calling Process on each element of the input array.
+     * With a WindowTree window and no memory budget, a ReuseDistance works through the array in batches of
+     * BulkSize addresses: distances within a batch are found from the window as it was before the
+     * batch, and the window is then updated once for each distinct address in the batch rather
+     * than once per address. This only saves work when a batch repeats addresses, and costs some
+     * when it does not, so batches are given up for a while whenever most of the addresses in
+     * one are distinct (see BulkDistinctShare and BulkBackoff).
      *
      * @param addrs  An array of structures describing memory addresses to process.
      * @param count  The number of elements in addrs.
@@ -202,6 +533,29 @@ public:
      */
     void Process(ReuseEntry* addrs, uint64_t count);
 
+    /**
+     * Publish the statistics of this ReuseDistance to a ReuseExport (see ReuseExport.hpp) as it runs.
+     * Every version of Process calls ReuseExport::Publish after every i addresses, and the array
+     * version splits the array where needed.
+     *
+     * @param e  The ReuseExport, which must outlive its use by this ReuseDistance, or NULL to stop publishing.
+     * @param i  The number of addresses between publishes. i > 0 is enforced at runtime.
+     *
+     * @return none
+     */
+    void SetExport(ReuseExport* e, uint64_t i);
+
+    /**
+     * Finish processing any addresses which Process has held back. ReuseDistance processes every
+     * address as it is given, so this does nothing; subclasses which gather addresses into batches
+     * (see ShardedReuseDistance) process their partial batch. Print, the GetStats family and the
+     * other methods which read statistics call this themselves, so it is only needed before
+     * reading a ReuseStats which was fetched earlier.
+     *
+     * @return none
+     */
+    virtual void Flush() {}
+
     /**
      * Process multiple memory addresses. Equivalent to calling Process on each element of the input vector.
      *
@@ -229,6 +583,29 @@ public:
      */
     ReuseStats* GetStats(uint64_t id);
 
+    /**
+     * Get a ReuseStats which holds the counts of all ids together, for running the ReuseStats
+     * queries (GetQuantile, GetCDF, CountRange, ...) across the whole stream. It is rebuilt
+     * only when addresses have been processed since the last call.
+     *
+     * @return A ReuseStats which is owned by this ReuseDistance and is valid until the next call
+     * to Process, or NULL if no addresses have been processed.
+     */
+    ReuseStats* GetAggregateStats();
+
+    /**
+     * Find the ids which have the most misses in a fully-associative LRU cache of some size,
+     * see ReuseStats::CountMisses.
+     *
+     * @param size  The number of addresses held by the cache.
+     * @param k  The number of ids to find.
+     * @param top  A std::vector which will contain up to k (id, misses) pairs, ordered by decreasing
+     * misses then increasing id. It is an error to pass this vector non-empty.
+     *
+     * @return none
+     */
+    void GetTopMissIds(uint64_t size, uint32_t k, std::vector<std::pair<uint64_t, uint64_t> >& top);
+
     /**
      * Get a std::vector containing all of the unique indices processed
      * by this ReuseDistance object.
@@ -260,6 +637,59 @@ public:
      * @return none
      */
     virtual void SkipAddresses(uint64_t amount);
+
+    /**
+     * Remove an address from the active window, as if it had been evicted. The next access to
+     * the address will be a miss. Useful for modeling coherence invalidations.
+     *
+     * @param addr  The address to remove. Nothing happens if addr is not in the active window.
+     *
+     * @return none
+     */
+    virtual void Invalidate(uint64_t addr);
+
+    /**
+     * Describe the internal state of this ReuseDistance: window size, hash load, tree depth,
+     * the number of ReuseStats objects and allocations, and the estimated bytes held by each
+     * structure. This walks the whole window, so it should not be called on every access.
+     *
+     * @param s  The structure to fill in.
+     *
+     * @return none
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s);
+
+    /**
+     * Print the result of GetEngineStats to an output stream, one field per line. Every line
+     * is preceded by a '#', so the output can be mixed with the output of Print.
+     *
+     * @param f  The output stream to print to.
+     *
+     * @return none
+     */
+    void PrintEngineStats(std::ostream& f);
+
+    /**
+     * Get the current sampling rate. This is 1 unless a memory budget was given to the
+     * constructor and has been approached.
+     *
+     * @return The number of addresses represented by each tracked address.
+     */
+    uint64_t GetSampleRate();
+
+    /**
+     * Multiply every distance and every count recorded so far, for an address stream that was
+     * itself sampled (see ReuseTraceReader::GetPeriod). If 1 in every p accesses was sampled,
+     * ScaleStats(p, p) estimates the histograms of the full stream: p accesses stand behind each
+     * sample, and about p times as many distinct addresses were touched between two samples of
+     * the same address. Distances are not capped at the window size afterwards.
+     *
+     * @param distance  The factor for distances.
+     * @param count  The factor for counts.
+     *
+     * @return none
+     */
+    void ScaleStats(uint64_t distance, uint64_t count);
 };
 
 /**
@@ -269,18 +699,40 @@ public:
  */
 class ReuseStats {
 private:
-    reuse_map_type<uint64_t, uint64_t> distcounts;
+    uint64_t id;
     uint64_t accesses;
+    ReuseStatsConfig* config;
 
-    uint64_t id;
-    uint64_t binindividual;
-    uint64_t maxtracking;
-    uint64_t invalid;
+    // the bins, sorted by distance. bins points at first until a second bin is needed, then at
+    // a block from the config's arena
+    ReuseBin* bins;
+    uint32_t bincount;
+    uint32_t bincapacity;
+    ReuseBin first;
+
+    // once there are more than SpillBins bins they move here, and bins is no longer used
+    reuse_map_type<uint64_t, uint64_t>* spill;
+
+    // prefix sums for queries, allocated by the first query
+    ReuseQueries* queries;
 
     uint64_t GetBin(uint64_t value);
+    void Add(uint64_t bin, uint64_t count);
+    void Grow();
+    void Release();
+    const ReuseBin* GetSortedBins(uint64_t* n, std::vector<ReuseBin>& scratch);
+    void BuildQueries();
+
+    ReuseStats(const ReuseStats&);
+    ReuseStats& operator=(const ReuseStats&);
+
+    friend class ReuseExport;
 
 public:
 
+    // the largest number of bins kept in a sorted array
+    static const uint32_t SpillBins = 128;
+
     /**
      * Contructs a ReuseStats object.
      *
@@ -289,13 +741,28 @@ public:
      * @param num  Any value above this is considered a miss
      * @param inv  The value which represents a miss
      */
-    ReuseStats(uint64_t idx, uint64_t bin, uint64_t num, uint64_t inv)
-        : accesses(0), id(idx), binindividual(bin), maxtracking(num), invalid(inv) {}
+    ReuseStats(uint64_t idx, uint64_t bin, uint64_t num, uint64_t inv);
+
+    /**
+     * Contructs a ReuseStats object whose binning parameters are shared with other ReuseStats.
+     * This is how a ReuseDistance creates the ReuseStats for each id.
+     *
+     * @param idx  The unique id for this ReuseStats
+     * @param c  The shared parameters, which must outlive this ReuseStats.
+     */
+    ReuseStats(uint64_t idx, ReuseStatsConfig* c);
 
     /**
      * Destroys a ReuseStats object.
      */
-    ~ReuseStats() {}
+    ~ReuseStats();
+
+    /**
+     * Get the unique id of this ReuseStats.
+     *
+     * @return The id.
+     */
+    uint64_t GetId() { return id; }
 
     /**
      * Increment the counter for some distance.
@@ -306,6 +773,16 @@ public:
      */
     void Update(uint64_t dist);
 
+    /**
+     * Add to the counter for some distance, as if Update(dist) were called count times.
+     *
+     * @param dist  A reuse distance observed in the memory address stream.
+     * @param count  The number of times it was observed.
+     *
+     * @return none
+     */
+    void Update(uint64_t dist, uint64_t count);
+
     /**
      * Increment the number of misses. That is, addresses which were not found inside
      * the active address window. This is equivalent Update(0), but is faster.
@@ -322,6 +799,119 @@ public:
      */
     virtual uint64_t GetMissCount();
 
+    /**
+     * Get the number of misses. Unlike GetMissCount, this does not modify the ReuseStats
+     * object, so it is safe to call concurrently with other read-only methods.
+     *
+     * @return The number of misses to this ReuseDistance object
+     */
+    uint64_t GetMissCountConst();
+
+    /**
+     * Get the number of bytes that Format will write for this ReuseStats.
+     *
+     * @return The exact number of bytes produced by Format.
+     */
+    uint64_t FormatLength();
+
+    /**
+     * Write the same bin lines produced by Print (without annotations) into a buffer.
+     * Does not modify the ReuseStats object.
+     *
+     * @param buf  The buffer to receive the output. It must have room for at least FormatLength() bytes.
+     *
+     * @return A pointer to the byte following the last byte written.
+     */
+    char* Format(char* buf);
+
+    /**
+     * Add all of the counts from another ReuseStats into this one. The other ReuseStats should have been
+     * created with the same binning parameters as this one.
+     *
+     * @param other  The ReuseStats whose counts are added to this one.
+     *
+     * @return none
+     */
+    void Merge(ReuseStats* other);
+
+    /**
+     * Multiply every distance and every count held by this ReuseStats. Distances which land
+     * above the individually tracked range are rebinned. Misses stay misses, and are only
+     * scaled in count.
+     *
+     * @param distance  The factor for distances.
+     * @param count  The factor for counts.
+     *
+     * @return none
+     */
+    void Scale(uint64_t distance, uint64_t count);
+
+    /**
+     * Get the number of distinct distance bins held by this ReuseStats.
+     *
+     * @return The number of bins.
+     */
+    uint64_t GetBinCount();
+
+    /**
+     * Estimate the number of bytes held by this ReuseStats, including the object itself.
+     *
+     * @return The estimated number of bytes.
+     */
+    uint64_t GetBytes();
+
+    /**
+     * Count the accesses whose distance is at most d. Distances are counted by bin, so a bin is
+     * included if its upper bound is at most d. Misses are never included. The first query after
+     * an update takes time linear in the number of bins; later ones take logarithmic time.
+     *
+     * @param d  The distance.
+     *
+     * @return The number of accesses.
+     */
+    uint64_t CountAtMost(uint64_t d);
+
+    /**
+     * Count the accesses whose distance is in [a, b], by bin as for CountAtMost.
+     *
+     * @param a  The smallest distance.
+     * @param b  The largest distance.
+     *
+     * @return The number of accesses.
+     */
+    uint64_t CountRange(uint64_t a, uint64_t b);
+
+    /**
+     * Find the fraction of accesses whose distance is at most d, by bin as for CountAtMost.
+     *
+     * @param d  The distance.
+     *
+     * @return The fraction of accesses, or 0 if there have been no accesses.
+     */
+    double GetCDF(uint64_t d);
+
+    /**
+     * Find the smallest distance bin at or below which at least a fraction q of accesses fall.
+     * Misses are treated as larger than any distance.
+     *
+     * @param q  The quantile, in [0, 1]. For example 0.99 gives the 99th percentile.
+     *
+     * @return The upper bound of the bin, or the value which represents a miss if the quantile
+     * falls among the misses or there have been no accesses.
+     */
+    uint64_t GetQuantile(double q);
+
+    /**
+     * Count the misses in a fully-associative LRU cache which holds some number of addresses.
+     * These are the accesses whose distance is greater than size, plus the misses. Only meaningful
+     * for reuse distances.
+     *
+     * @param size  The number of addresses held by the cache.
+     *
+     * @return The number of misses.
+     */
+    uint64_t CountMisses(uint64_t size);
+
     /**
      * Print a summary of the current reuse distances and counts for some id.
      *
@@ -388,24 +978,50 @@ public:
 class SpatialLocality : public ReuseDistance {
 private:
 
-    // [address -> sequence]
-    std::map<uint64_t, uint64_t> awindow;
-
-    // list of the addresses in the window, ordered by sequence id
-    std::list<uint64_t> swindow;
+    // the most recent addresses, see SpatialWindow.hpp. NULL when the distances are found by a
+    // MultiSpatialLocality
+    SpatialWindow* engine;
 
+    void Init(uint64_t size, uint64_t bin, uint64_t max, uint32_t e);
 
-    void Init(uint64_t size, uint64_t bin, uint64_t max);
-
-    virtual ReuseStats* GetStats(uint64_t id, bool gen);
     virtual const std::string Describe() { return "SPATIAL"; }
 
     static const uint64_t Invalid = INVALID_SPATIAL;
 
+    // no window at all, for the per-size stats of a MultiSpatialLocality
+    static const uint32_t EngineShared = 4;
+
+    friend class MultiSpatialLocality;
+
 public:
 
     static const uint64_t DefaultWindowSize = 64;
 
+    /**
+     * Choose the window implementation based on the window size.
+     */
+    static const uint32_t EngineAuto = 0;
+
+    /**
+     * An ordered map plus a list. Reasonable for any window size.
+     */
+    static const uint32_t EngineMap = 1;
+
+    /**
+     * A ring buffer which is scanned in full with SIMD instructions. Only good for small windows.
+     */
+    static const uint32_t EngineScan = 2;
+
+    /**
+     * A B+-tree of sorted address blocks plus a ring buffer. Good for large windows.
+     */
+    static const uint32_t EngineBlocked = 3;
+
+    /**
+     * EngineAuto uses EngineScan for windows of this size or smaller, and EngineBlocked for anything larger.
+     */
+    static const uint64_t ScanWindowLimit = 512;
+
     /**
      * Contructs a ReuseDistance object.
      *
@@ -417,30 +1033,39 @@ public:
      * @param n  All distances greater than n will be counted as infinite. Use n == ReuseDistance::Infinity for no limit. n >= b is enforced at runtime.
      *
      */
-    SpatialLocality(uint64_t w, uint64_t b, uint64_t n) : ReuseDistance(0) { SpatialLocality::Init(w, b, n); }
+    SpatialLocality(uint64_t w, uint64_t b, uint64_t n) : ReuseDistance(0) { SpatialLocality::Init(w, b, n, EngineAuto); }
+
+    /**
+     * Constructs a SpatialLocality object which uses a specific window implementation. Otherwise
+     * equivalent to the other 3-argument constructor.
+     *
+     * @param e  The window implementation. One of SpatialLocality::EngineAuto, SpatialLocality::EngineMap,
+     * SpatialLocality::EngineScan or SpatialLocality::EngineBlocked.
+     */
+    SpatialLocality(uint64_t w, uint64_t b, uint64_t n, uint32_t e) : ReuseDistance(0) { SpatialLocality::Init(w, b, n, e); }
 
     /**
      * Constructs a SpatialLocality object. Equivalent to calling the other 3-argument constructor
      * with n == ReuseDistance::Infinity
      */
-    SpatialLocality(uint64_t w, uint64_t b) : ReuseDistance(0) { SpatialLocality::Init(w, b, INFINITY_REUSE); }
+    SpatialLocality(uint64_t w, uint64_t b) : ReuseDistance(0) { SpatialLocality::Init(w, b, INFINITY_REUSE, EngineAuto); }
 
     /**
      * Constructs a SpatialLocality object. Equivalent to calling the other 3-argument constructor
      * with w == b and n == ReuseDistance::Infinity
      */
-    SpatialLocality(uint64_t w) : ReuseDistance(0) { SpatialLocality::Init(w, w, INFINITY_REUSE); }
+    SpatialLocality(uint64_t w) : ReuseDistance(0) { SpatialLocality::Init(w, w, INFINITY_REUSE, EngineAuto); }
  
     /**
      * Constructs a SpatialLocality object. Equivalent to calling the other 3-argument constructor
      * with w == b == SpatialLocality::DefaultWindowSize and n == ReuseDistance::Infinity
      */
-    SpatialLocality() : ReuseDistance(0) {  SpatialLocality::Init(DefaultWindowSize, DefaultWindowSize, INFINITY_REUSE); }
+    SpatialLocality() : ReuseDistance(0) {  SpatialLocality::Init(DefaultWindowSize, DefaultWindowSize, INFINITY_REUSE, EngineAuto); }
 
     /**
      * Destroys a SpatialLocality object.
      */
-    virtual ~SpatialLocality() {}
+    virtual ~SpatialLocality();
 
     /**
      * Get a std::vector containing all of the addresses currently in this SpatialLocality
@@ -471,4 +1096,1032 @@ public:
      * @return none
      */
     virtual void SkipAddresses(uint64_t amount);
+
+    /**
+     * Remove every copy of an address from the active window.
+     *
+     * @param addr  The address to remove. Nothing happens if addr is not in the active window.
+     *
+     * @return none
+     */
+    virtual void Invalidate(uint64_t addr);
+
+    /**
+     * Describe the internal state of this SpatialLocality. See ReuseDistance::GetEngineStats.
+     * SpatialLocality has no address hash, and its window holds duplicate addresses.
+     *
+     * @param s  The structure to fill in.
+     *
+     * @return none
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s);
+};
+
+/**
+ * @class MultiSpatialLocality
+ *
+ * Finds spatial locality for several window sizes in a single pass. The result is the same as
+ * running a separate SpatialLocality for each size, but the sizes share their windows (see
+ * SpatialWindowMulti in SpatialWindow.hpp): small windows are answered by one scan and larger
+ * windows of similar size search one tree. The Print methods print one SPATIALSTATS block per window size, smallest first. The
+ * stats for each size are kept in a SpatialLocality object which can be queried through GetWindow.
+ */
+class MultiSpatialLocality : public ReuseDistance {
+private:
+    SpatialWindowMulti* engine;
+
+    // the stats for each window size, in ascending order of size
+    std::vector<SpatialLocality*> windows;
+
+    // the distance found for each window size by the last Process
+    std::vector<uint64_t> best;
+
+    // when persize is set, each window size w uses b == w
+    void Init(const std::vector<uint64_t>& sizes, uint64_t b, uint64_t n, bool persize);
+
+    virtual const std::string Describe() { return "SPATIAL"; }
+
+public:
+
+    /**
+     * Constructs a MultiSpatialLocality object.
+     *
+     * @param sizes  The window sizes. Each must be finite and positive, which is enforced at runtime.
+     * Duplicates are ignored.
+     * @param b  All distances not greater than b will be tracked individually, for every window size.
+     * See the SpatialLocality constructor.
+     * @param n  All distances greater than n will be counted as infinite, for every window size. See
+     * the SpatialLocality constructor.
+     */
+    MultiSpatialLocality(const std::vector<uint64_t>& sizes, uint64_t b, uint64_t n) : ReuseDistance(0) { MultiSpatialLocality::Init(sizes, b, n, false); }
+
+    /**
+     * Constructs a MultiSpatialLocality object. Each window size w is binned as in SpatialLocality(w),
+     * with b == w and n == ReuseDistance::Infinity.
+     *
+     * @param sizes  The window sizes.
+     */
+    MultiSpatialLocality(const std::vector<uint64_t>& sizes) : ReuseDistance(0) { MultiSpatialLocality::Init(sizes, 0, INFINITY_REUSE, true); }
+
+    /**
+     * Destroys a MultiSpatialLocality object.
+     */
+    virtual ~MultiSpatialLocality();
+
+    using ReuseDistance::Print;
+    using ReuseDistance::Process;
+
+    /**
+     * Print the statistics for every window size, smallest first. See ReuseDistance::Print.
+     *
+     * @param f  The output stream to print results to.
+     * @param annotate  Also print annotations describing the meaning of output fields, preceded by a '#'.
+     *
+     * @return none
+     */
+    virtual void Print(std::ostream& f, bool annotate=false);
+
+    /**
+     * Print the statistics for every window size, formatting each in parallel. See ReuseDistance::Print.
+     *
+     * @param f  The output stream to print results to.
+     * @param annotate  Also print annotations describing the meaning of output fields, preceded by a '#'.
+     * @param threads  The number of threads used to format the output.
+     *
+     * @return none
+     */
+    virtual void Print(std::ostream& f, bool annotate, uint32_t threads);
+
+    /**
+     * Process a single memory address for every window size.
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    virtual void Process(ReuseEntry& addr);
+
+    /**
+     * Get the distinct addresses in the largest window, sorted in ascending order.
+     *
+     * @param addrs  A std::vector which will contain the addresses. addrs.size() == 0 is enforced at runtime.
+     *
+     * @return none
+     */
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+
+    /**
+     * Pretend that some number of addresses in the stream were skipped. This flushes every window.
+     *
+     * @param amount  The number of addresses to skip.
+     *
+     * @return none
+     */
+    virtual void SkipAddresses(uint64_t amount);
+
+    /**
+     * Remove every copy of an address from every window.
+     *
+     * @param addr  The address to remove.
+     *
+     * @return none
+     */
+    virtual void Invalidate(uint64_t addr);
+
+    /**
+     * Describe the internal state of this MultiSpatialLocality. See ReuseDistance::GetEngineStats.
+     * The stats fields cover every window size.
+     *
+     * @param s  The structure to fill in.
+     *
+     * @return none
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s);
+
+    /**
+     * Get the number of window sizes.
+     *
+     * @return The number of window sizes.
+     */
+    uint32_t GetWindowCount() { return windows.size(); }
+
+    /**
+     * Get the statistics for one window size. The object may be printed and queried, but it must
+     * not be given addresses.
+     *
+     * @param i  The index of the window size, in ascending order of size. i < GetWindowCount() is enforced at runtime.
+     *
+     * @return The SpatialLocality holding the statistics for that window size.
+     */
+    SpatialLocality* GetWindow(uint32_t i);
+};
+
+/**
+ * @class StrideLocality
+ *
+ * Tracks the stride of each access: the signed difference between its address and the address
+ * of the previous access with the same id. The last address of each id is kept in a flat table,
+ * so an access takes a single lookup no matter how many ids there are. This is much cheaper
+ * than SpatialLocality, and it is what a stride prefetcher sees.
+ *
+ * The ReuseStats of each id (GetStats) hold the magnitude of its strides, binned as for
+ * ReuseDistance. The first access of an id has no stride and is counted as a miss. The sign of
+ * each stride is kept separately, and GetStrides returns the signed histogram. Print gives each
+ * id's signed histogram, with negative strides first, and its dominant stride.
+ */
+class StrideLocality : public ReuseDistance {
+private:
+    // [id -> last address and stats], open-addressed. see StrideSlot in ReuseDistance.cpp
+    StrideSlot* slots;
+    uint64_t shift;
+    uint64_t slotcount;
+
+    // the most recently found slot, since consecutive accesses often share an id
+    StrideSlot* lastslot;
+
+    // the magnitudes of the negative strides of each id, binned like the stats
+    ReuseStatsTable backward;
+
+    void Init(uint64_t b, uint64_t n);
+    StrideSlot* FindSlot(uint64_t id);
+    void Grow();
+
+    virtual const std::string Describe() { return "STRIDE"; }
+
+public:
+
+    static const uint64_t Invalid = INVALID_SPATIAL;
+
+    /**
+     * Constructs a StrideLocality object.
+     *
+     * @param b  All stride magnitudes not greater than b will be tracked individually. All are tracked
+     * individually if b == ReuseDistance::Infinity. Beyond individual tracking, magnitudes are tracked in
+     * bins whose boundaries are the powers of two greater than b and not greater than n.
+     * @param n  Strides whose magnitude is greater than n will be counted as misses. Use n == ReuseDistance::Infinity
+     * for no limit. n >= b is enforced at runtime.
+     */
+    StrideLocality(uint64_t b, uint64_t n) : ReuseDistance(0) { StrideLocality::Init(b, n); }
+
+    /**
+     * Constructs a StrideLocality object. Equivalent to calling the other constructor with
+     * n == ReuseDistance::Infinity
+     */
+    StrideLocality(uint64_t b) : ReuseDistance(0) { StrideLocality::Init(b, INFINITY_REUSE); }
+
+    /**
+     * Destroys a StrideLocality object.
+     */
+    virtual ~StrideLocality();
+
+    using ReuseDistance::Print;
+    using ReuseDistance::Process;
+
+    /**
+     * Print the signed stride histogram of every id. Each id line also gives the id's dominant
+     * stride and how many times it was seen (see GetDominantStride).
+     *
+     * @param f  The output stream to print results to.
+     * @param annotate  Also print annotations describing the meaning of output fields, preceded by a '#'.
+     *
+     * @return none
+     */
+    virtual void Print(std::ostream& f, bool annotate=false);
+
+    /**
+     * Equivalent to the 2-argument Print. Stride histograms are small, so they are not formatted in parallel.
+     *
+     * @param f  The output stream to print results to.
+     * @param annotate  Also print annotations describing the meaning of output fields, preceded by a '#'.
+     * @param threads  Ignored.
+     *
+     * @return none
+     */
+    virtual void Print(std::ostream& f, bool annotate, uint32_t threads);
+
+    /**
+     * Process a single memory address.
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    virtual void Process(ReuseEntry& addr);
+
+    /**
+     * Get the last address of every id, sorted in ascending order without duplicates.
+     *
+     * @param addrs  A std::vector which will contain the addresses. addrs.size() == 0 is enforced at runtime.
+     *
+     * @return none
+     */
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+
+    /**
+     * Forget the last address of every id, so the next access of each id has no stride.
+     *
+     * @param amount  The number of addresses to skip.
+     *
+     * @return none
+     */
+    virtual void SkipAddresses(uint64_t amount);
+
+    /**
+     * Strides do not depend on which addresses are held anywhere, so this does nothing.
+     *
+     * @param addr  The address.
+     *
+     * @return none
+     */
+    virtual void Invalidate(uint64_t addr);
+
+    /**
+     * Describe the internal state of this StrideLocality. See ReuseDistance::GetEngineStats.
+     * windowsize is the number of ids with a last address and hashbytes covers the table which
+     * holds them. statsobjects counts ids, while statsbins and statsbytes include the negative strides.
+     *
+     * @param s  The structure to fill in.
+     *
+     * @return none
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s);
+
+    /**
+     * Get the signed stride histogram of an id.
+     *
+     * @param id  The unique id.
+     * @param strides  A std::vector which will contain (stride, count) pairs in ascending order of stride,
+     * leaving out misses. A stride beyond individual tracking stands for its whole bin and is the
+     * bin's bound farthest from 0. It is an error to pass this vector non-empty.
+     *
+     * @return none
+     */
+    void GetStrides(uint64_t id, std::vector<std::pair<int64_t, uint64_t> >& strides);
+
+    /**
+     * Find the most common stride of an id among the strides tracked individually. Ties go to the
+     * stride with the smaller magnitude, then to the positive one.
+     *
+     * @param id  The unique id.
+     * @param stride  Receives the dominant stride, or 0 if there is none.
+     *
+     * @return The number of times the dominant stride was seen, or 0 if there is none.
+     */
+    uint64_t GetDominantStride(uint64_t id, int64_t* stride);
+};
+
+/**
+ * @struct ByteReuseEntry
+ *
+ * ByteReuseEntry is used to pass objects of different sizes into a ByteReuseDistance.
+ *
+ * @field id  The unique id of the entity which generated the memory address.
+ * Statistics are tracked seperately for each unique id.
+ * @field address  The address (or key) of the object.
+ * @field size  The size of the object in bytes.
+ */
+struct ByteReuseEntry {
+    uint64_t id;
+    uint64_t address;
+    uint64_t size;
 };
+
+/**
+ * @class ByteReuseDistance
+ *
+ * Tracks reuse distances in bytes for a stream of objects of different sizes, for sizing caches
+ * whose entries are not all the same size. The distance of an access is the total size of the
+ * distinct objects accessed since the previous access to the same object, including the object
+ * itself, so an LRU cache of at least that many bytes would have hit. Distances and bins are in
+ * bytes. The output has the same format as ReuseDistance.
+ *
+ * The window is ordered by last access, and the bytes in it are kept in a Fenwick tree indexed by
+ * access slot, so finding a distance takes O(log n).
+ */
+class ByteReuseDistance : public ReuseDistance {
+private:
+    // [address -> slot of its last access]
+    reuse_map_type<uint64_t, uint64_t> bwindow;
+
+    // per slot, in access order: the Fenwick tree of sizes, the address and the size (or
+    // DeadSlot if the slot's object has been accessed again or evicted)
+    std::vector<uint64_t> fenwick;
+    std::vector<uint64_t> slotaddr;
+    std::vector<uint64_t> slotsize;
+
+    // the next slot to be used, the oldest slot which might be live, and the bytes in the window
+    uint64_t next;
+    uint64_t oldest;
+    uint64_t bytes;
+
+    static const uint64_t DeadSlot = 0xFFFFFFFFFFFFFFFFL;
+
+    void Add(uint64_t slot, int64_t size);
+    uint64_t Before(uint64_t slot);
+    void Remove(uint64_t slot);
+    void Compact();
+
+    virtual const std::string Describe() { return "BYTEREUSE"; }
+
+public:
+
+    // the slots allocated when the window is first used
+    static const uint64_t InitialSlots = 1024;
+
+    /**
+     * Contructs a ByteReuseDistance object.
+     *
+     * @param w  The window size in bytes. The least recently used objects are evicted when the window
+     * holds more than w bytes, so w is also the largest distance which will be found. No limit is imposed
+     * if ReuseDistance::Infinity is used.
+     * @param b  All distances (in bytes) not greater than b will be tracked individually. All distances are
+     * tracked individually if b == ReuseDistance::Infinity. Beyond that, distances are tracked in bins whose
+     * boundaries are the powers of two greater than b.
+     */
+    ByteReuseDistance(uint64_t w, uint64_t b);
+
+    /**
+     * Destroys a ByteReuseDistance object.
+     */
+    virtual ~ByteReuseDistance();
+
+    using ReuseDistance::Process;
+
+    /**
+     * Process a single object.
+     *
+     * @param obj  The structure describing the object to process.
+     *
+     * @return none
+     */
+    void Process(ByteReuseEntry& obj);
+
+    /**
+     * Process multiple objects. Equivalent to calling Process on each element of the input array.
+     *
+     * @param objs  An array of structures describing objects to process.
+     * @param count  The number of elements in objs.
+     *
+     * @return none
+     */
+    void Process(ByteReuseEntry* objs, uint64_t count);
+
+    /**
+     * Process a single memory address as an object of 1 byte. A stream processed only through this
+     * method has the same distances as it would in a ReuseDistance.
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    virtual void Process(ReuseEntry& addr);
+
+    /**
+     * Get a std::vector containing all of the addresses currently in this ByteReuseDistance
+     * object's active window.
+     *
+     * @param addrs  A std::vector which will contain the addresses. It is an error to
+     * pass this vector non-empty (that is addrs.size() == 0 is enforced at runtime).
+     *
+     * @return none
+     */
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+
+    /**
+     * Pretend that some number of addresses in the stream were skipped. This has the effect of
+     * flushing the entire window.
+     *
+     * @param amount  The number of addresses to skip.
+     *
+     * @return none
+     */
+    virtual void SkipAddresses(uint64_t amount);
+
+    /**
+     * Remove an object from the active window, as if it had been evicted.
+     *
+     * @param addr  The address of the object. Nothing happens if it is not in the active window.
+     *
+     * @return none
+     */
+    virtual void Invalidate(uint64_t addr);
+
+    /**
+     * Describe the internal state of this ByteReuseDistance. See ReuseDistance::GetEngineStats.
+     * windowsize is the number of objects in the window and treedepth is the depth of the
+     * Fenwick tree.
+     *
+     * @param s  The structure to fill in.
+     *
+     * @return none
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s);
+};
+
+/**
+ * @class ReuseTime
+ *
+ * Tracks reuse times, the number of accesses between an access and the previous access to the
+ * same address. This needs one hash lookup per access and no window tree, so it is much faster
+ * than ReuseDistance. The per-id reuse time histograms are binned and printed like ReuseDistance.
+ *
+ * Reuse times are converted into approximate reuse distances and miss ratios with the
+ * higher-order theory of locality (Xiang et al., ASPLOS 2013). The average footprint fp(w), the
+ * number of distinct addresses in a window of w accesses, is found from the reuse time, first
+ * access time and last access time histograms of the whole stream. An access with reuse time t
+ * has a reuse distance of about fp(t), and the miss ratio of a fully-associative LRU cache of c
+ * addresses is about fp(w + 1) - fp(w) where fp(w) = c. The histograms behind the conversion keep
+ * times below FineExact exactly, and group larger times by their top FineBits bits.
+ */
+class ReuseTime : public ReuseDistance {
+private:
+    // [address -> time of its last access]
+    reuse_map_type<uint64_t, uint64_t> lastaccess;
+
+    // the number of accesses processed, which is the time of the last access
+    uint64_t now;
+
+    // the number of first accesses, which is the number of distinct addresses unless the index was flushed
+    uint64_t distinct;
+
+    // [time bin -> (count, sum of times)] for the conversion: reuse times, first access times and
+    // last access times of addresses which have left the index
+    reuse_map_type<uint64_t, std::pair<uint64_t, double> > reusetimes;
+    reuse_map_type<uint64_t, std::pair<uint64_t, double> > firsttimes;
+    reuse_map_type<uint64_t, std::pair<uint64_t, double> > lasttimes;
+
+    // sum over all time bins from fpkeys[i] up of the counts and of the times, built by
+    // BuildFootprint when now has changed
+    std::vector<uint64_t> fpkeys;
+    std::vector<double> fpcounts;
+    std::vector<double> fpsums;
+    uint64_t fpnow;
+
+    void BuildFootprint();
+    void Retire(uint64_t last);
+
+    virtual const std::string Describe() { return "REUSETIME"; }
+
+public:
+
+    // the conversion keeps times below this exactly
+    static const uint64_t FineExact = 4096;
+
+    // and groups larger times by this many significant bits
+    static const uint64_t FineBits = 12;
+
+    /**
+     * Contructs a ReuseTime object.
+     *
+     * @param b  All reuse times not greater than b will be tracked individually. All reuse times are tracked
+     * individually if b == ReuseDistance::Infinity. Beyond individual tracking, reuse times are tracked in bins
+     * whose boundaries are the powers of two greater than b.
+     */
+    ReuseTime(uint64_t b);
+
+    /**
+     * Destroys a ReuseTime object.
+     */
+    virtual ~ReuseTime();
+
+    using ReuseDistance::Process;
+
+    /**
+     * Process a single memory address.
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    virtual void Process(ReuseEntry& addr);
+
+    /**
+     * Get a std::vector containing all of the addresses seen by this ReuseTime, least recently
+     * used first.
+     *
+     * @param addrs  A std::vector which will contain the addresses. It is an error to
+     * pass this vector non-empty (that is addrs.size() == 0 is enforced at runtime).
+     *
+     * @return none
+     */
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+
+    /**
+     * Forget the last access of every address, so the next access to each is a first access.
+     * The skipped addresses take no part in the footprint.
+     *
+     * @param amount  The number of addresses to skip.
+     *
+     * @return none
+     */
+    virtual void SkipAddresses(uint64_t amount);
+
+    /**
+     * Forget the last access of an address, so the next access to it is a first access.
+     *
+     * @param addr  The address. Nothing happens if it has not been seen.
+     *
+     * @return none
+     */
+    virtual void Invalidate(uint64_t addr);
+
+    /**
+     * Describe the internal state of this ReuseTime. See ReuseDistance::GetEngineStats. windowsize
+     * is the number of addresses in the index and windowbytes covers the conversion histograms.
+     *
+     * @param s  The structure to fill in.
+     *
+     * @return none
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s);
+
+    /**
+     * Get the average footprint of all windows of some length in the stream processed so far.
+     *
+     * @param w  The window length in accesses, clamped to the number of accesses processed.
+     *
+     * @return The average number of distinct addresses in a window of w accesses.
+     */
+    double GetFootprint(uint64_t w);
+
+    /**
+     * Estimate the miss ratio of a fully-associative LRU cache from the footprint.
+     *
+     * @param c  The number of addresses held by the cache.
+     *
+     * @return The estimated fraction of accesses which miss, which is never less than the fraction
+     * of first accesses.
+     */
+    double GetMissRatio(uint64_t c);
+
+    /**
+     * Estimate the miss ratios of several cache sizes. Equivalent to calling GetMissRatio on each
+     * size, but faster when the sizes are in ascending order.
+     *
+     * @param sizes  The numbers of addresses held by each cache.
+     * @param ratios  A std::vector which will contain the miss ratio of each size. It is an error to
+     * pass this vector non-empty.
+     *
+     * @return none
+     */
+    void GetMissRatioCurve(std::vector<uint64_t>& sizes, std::vector<double>& ratios);
+
+    /**
+     * Convert the reuse time histogram of an id into an approximate reuse distance histogram, by
+     * mapping each reuse time t to the distance fp(t).
+     *
+     * @param id  The unique id.
+     *
+     * @return A new ReuseStats holding reuse distances, with the same binning as this ReuseTime,
+     * which the caller must delete. NULL if no ReuseStats is associated with id.
+     */
+    ReuseStats* GetDistanceStats(uint64_t id);
+};
+
+/**
+ * @struct ThreadedReuseEntry
+ *
+ * ThreadedReuseEntry is used to pass memory addresses into a ThreadedReuseDistance.
+ *
+ * @field id  The unique id of the entity which generated the memory address.
+ * Statistics are tracked seperately for each unique id.
+ * @field address  A memory address.
+ * @field thread  The thread which made the access.
+ * @field write  Non-zero if the access is a write.
+ */
+struct ThreadedReuseEntry {
+    uint64_t id;
+    uint64_t address;
+    uint32_t thread;
+    uint32_t write;
+};
+
+class ReuseWorkerPool;
+
+/**
+ * @class ThreadedReuseDistance
+ *
+ * Tracks reuse distances for an interleaved memory address stream generated by multiple threads.
+ * Two kinds of reuse distance are found for every access: the shared reuse distance, which is
+ * found using a single window for all threads (as with a shared cache), and the private reuse distance,
+ * which is found using a window that only holds the addresses accessed by the same thread (as with a private
+ * cache). Optionally a write by one thread invalidates the address in the private windows of every other
+ * thread. The private windows are spread over a set of worker threads, each of which owns the windows for a
+ * subset of the traced threads. The Print methods print the shared stats followed by the private stats, which are
+ * identified by the string PRIVATE in place of REUSE.
+ */
+class ThreadedReuseDistance : public ReuseDistance {
+private:
+    ReuseWorkerPool* pool;
+
+    // [worker -> [thread -> private window]]. each worker only ever touches its own map
+    std::vector<reuse_map_type<uint32_t, ReuseDistance*> > windows;
+
+    uint64_t privatecapacity;
+    bool invalidate;
+
+    // [worker -> the addresses it has yet to process]. a worker is given the accesses of its own
+    // threads, and when invalidating, the writes of every other thread
+    std::vector<std::vector<ThreadedReuseEntry> > batches;
+    uint64_t pending;
+
+    void Init(uint64_t p, uint32_t n, bool inv);
+    void Buffer(ThreadedReuseEntry& addr);
+    static void ProcessPrivate(void* arg, uint32_t worker);
+    ReuseDistance* MergePrivate();
+
+public:
+
+    static const uint32_t DefaultWorkers = 4;
+
+    // addresses are handed to the workers this many at a time
+    static const uint64_t BatchSize = 65536;
+
+    /**
+     * Constructs a ThreadedReuseDistance object.
+     *
+     * @param w  The maximum shared window size. See the ReuseDistance constructor.
+     * @param b  All distances not greater than b will be tracked individually. See the ReuseDistance constructor.
+     * @param p  The maximum private window size, used for every thread.
+     * @param n  The number of worker threads used to update the private windows. n > 0 is enforced at runtime.
+     * @param inv  If true, a write to an address invalidates that address in the private windows of all other threads.
+     */
+    ThreadedReuseDistance(uint64_t w, uint64_t b, uint64_t p, uint32_t n, bool inv) : ReuseDistance(w, b) { ThreadedReuseDistance::Init(p, n, inv); }
+
+    /**
+     * Constructs a ThreadedReuseDistance object. Equivalent to calling the other constructor with
+     * b == ReuseDistance::DefaultBinIndividual, n == ThreadedReuseDistance::DefaultWorkers and inv == false.
+     */
+    ThreadedReuseDistance(uint64_t w, uint64_t p) : ReuseDistance(w) { ThreadedReuseDistance::Init(p, DefaultWorkers, false); }
+
+    /**
+     * Destroys a ThreadedReuseDistance object.
+     */
+    virtual ~ThreadedReuseDistance();
+
+    using ReuseDistance::Print;
+    using ReuseDistance::Process;
+
+    /**
+     * Print the shared statistics followed by the private statistics. See ReuseDistance::Print for the output format.
+     *
+     * @param f  The output stream to print results to.
+     * @param annotate  Also print annotations describing the meaning of output fields, preceded by a '#'.
+     *
+     * @return none
+     */
+    virtual void Print(std::ostream& f, bool annotate=false);
+
+    /**
+     * Print the shared statistics followed by the private statistics, formatting each in parallel.
+     * See ReuseDistance::Print.
+     *
+     * @param f  The output stream to print results to.
+     * @param annotate  Also print annotations describing the meaning of output fields, preceded by a '#'.
+     * @param threads  The number of threads used to format the output.
+     *
+     * @return none
+     */
+    virtual void Print(std::ostream& f, bool annotate, uint32_t threads);
+
+    /**
+     * Process multiple memory addresses from multiple threads. The shared window is updated by the
+     * calling thread while the private windows are updated by the worker threads, which are handed
+     * the addresses BatchSize at a time. Addresses left over are kept until the batch fills or the
+     * statistics are next read (see Flush).
+     *
+     * @param addrs  An array of structures describing memory addresses to process, in the order they occurred.
+     * @param count  The number of elements in addrs.
+     *
+     * @return none
+     */
+    void Process(ThreadedReuseEntry* addrs, uint64_t count);
+
+    /**
+     * Process a single memory address. The shared window is updated at once, while the address
+     * waits in the batch for the private windows.
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    void Process(ThreadedReuseEntry& addr);
+
+    /**
+     * Process a single memory address as a read made by thread 0.
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    virtual void Process(ReuseEntry& addr);
+
+    /**
+     * Hand the partial batch to the workers and wait for them. See ReuseDistance::Flush.
+     *
+     * @return none
+     */
+    virtual void Flush();
+
+    /**
+     * Pretend that some number of addresses in the stream were skipped. This flushes the shared window
+     * and every private window.
+     *
+     * @param amount  The number of addresses to skip.
+     *
+     * @return none
+     */
+    virtual void SkipAddresses(uint64_t amount);
+
+    /**
+     * Get the ReuseStats object holding the private reuse distances of some id for some thread.
+     *
+     * @param thread  The thread.
+     * @param id  The unique id.
+     *
+     * @return The ReuseStats object, or NULL if that thread never accessed memory using id.
+     */
+    ReuseStats* GetPrivateStats(uint32_t thread, uint64_t id);
+};
+
+struct ReuseShard;
+
+/**
+ * @class ShardedReuseDistance
+ *
+ * Tracks reuse distances within each id rather than across the whole stream: every id has a window
+ * of its own, which only holds the addresses accessed with that id (such as the addresses of one
+ * thread, one array or one NUMA domain). Ids are spread over a set of worker threads by a hash of
+ * the id, and each worker owns the windows, the statistics bins and the bin memory of its ids
+ * outright, so the workers never synchronize with each other. The calling thread sorts each batch
+ * of addresses by worker, then every worker runs through its share. The output of Print is that of
+ * a ReuseDistance whose distances are the per-id distances.
+ */
+class ShardedReuseDistance : public ReuseDistance {
+private:
+    ReuseWorkerPool* pool;
+    std::vector<ReuseShard*> shards;
+
+    void Init(uint32_t n);
+    uint32_t Shard(uint64_t id);
+    static void ProcessShard(void* arg, uint32_t worker);
+
+    // addresses sorted into the shards' batches but not yet handed to the workers
+    uint64_t pending;
+    void Buffer(ReuseEntry& addr);
+
+protected:
+    virtual void ProcessArray(ReuseEntry* rs, uint64_t count);
+
+public:
+
+    static const uint32_t DefaultWorkers = 4;
+
+    // addresses are handed to the workers this many at a time
+    static const uint64_t BatchSize = 65536;
+
+    /**
+     * Constructs a ShardedReuseDistance object.
+     *
+     * @param w  The maximum window size of each id. See the ReuseDistance constructor.
+     * @param b  All distances not greater than b will be tracked individually. See the ReuseDistance constructor.
+     * @param n  The number of worker threads. n > 0 is enforced at runtime.
+     */
+    ShardedReuseDistance(uint64_t w, uint64_t b, uint32_t n);
+
+    /**
+     * Constructs a ShardedReuseDistance object. Equivalent to calling the other constructor with
+     * b == ReuseDistance::DefaultBinIndividual and n == ShardedReuseDistance::DefaultWorkers.
+     */
+    ShardedReuseDistance(uint64_t w);
+
+    /**
+     * Destroys a ShardedReuseDistance object.
+     */
+    virtual ~ShardedReuseDistance();
+
+    using ReuseDistance::Process;
+
+    /**
+     * Process a single memory address. Addresses are gathered into a batch which is handed to the
+     * workers once it holds BatchSize addresses, or when the statistics are next read (see Flush).
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    virtual void Process(ReuseEntry& addr);
+
+    /**
+     * Hand the partial batch to the workers and wait for them. See ReuseDistance::Flush.
+     *
+     * @return none
+     */
+    virtual void Flush();
+
+    /**
+     * Get a std::vector containing the addresses in the window of every id, in increasing order
+     * and without duplicates.
+     *
+     * @param addrs  A std::vector which will contain the addresses. It is an error to
+     * pass this vector non-empty (that is addrs.size() == 0 is enforced at runtime).
+     *
+     * @return none
+     */
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+
+    /**
+     * Get a std::vector containing the addresses in the window of one id, least recently used first.
+     *
+     * @param id  The id.
+     * @param addrs  A std::vector which will contain the addresses. It is an error to
+     * pass this vector non-empty (that is addrs.size() == 0 is enforced at runtime).
+     *
+     * @return none
+     */
+    void GetActiveAddresses(uint64_t id, std::vector<uint64_t>& addrs);
+
+    /**
+     * Pretend that some number of addresses in the stream were skipped. This flushes the window of every id.
+     *
+     * @param amount  The number of addresses to skip.
+     *
+     * @return none
+     */
+    virtual void SkipAddresses(uint64_t amount);
+
+    /**
+     * Remove an address from the window of every id.
+     *
+     * @param addr  The address to remove.
+     *
+     * @return none
+     */
+    virtual void Invalidate(uint64_t addr);
+
+    /**
+     * Describe the internal state of this ShardedReuseDistance. The window fields are summed over
+     * the windows of all ids, and treedepth is the greatest depth of any of them.
+     *
+     * @param s  The structure to fill in.
+     *
+     * @return none
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s);
+};
+
+/**
+ * @class AnalyzerSet
+ *
+ * Runs several analyzers (ReuseDistance, SpatialLocality or any other subclass of ReuseDistance)
+ * over the same address stream at once. Addresses are collected into batches, and the work that
+ * every analyzer would otherwise repeat (masking addresses to a granularity and mapping ids) is
+ * done once per batch by the calling thread. Each batch is then handed to all of the analyzers,
+ * each of which runs on a worker thread, while the next batch is being collected. Every analyzer
+ * sees exactly the same stream it would see if it were given the addresses directly. The
+ * analyzers are not owned by the AnalyzerSet, and must not be used while it has addresses in
+ * flight (see Flush).
+ */
+class AnalyzerSet {
+private:
+    std::vector<ReuseDistance*> analyzers;
+
+    ReuseWorkerPool* pool;
+    uint32_t threads;
+
+    uint64_t mask;
+    uint64_t (*idmap)(uint64_t id, void* arg);
+    void* idarg;
+
+    // the caller fills staged[filling] while the workers analyze staged[analyzing]
+    std::vector<ReuseEntry> staged[2];
+    uint32_t filling;
+    uint32_t analyzing;
+    bool running;
+
+    void Dispatch();
+    static void ProcessBatch(void* arg, uint32_t worker);
+
+public:
+
+    // the number of addresses handed to the analyzers at a time
+    static const uint64_t BatchSize = 65536;
+
+    /**
+     * Constructs an AnalyzerSet object.
+     *
+     * @param g  The granularity in bytes: the low bits of every address are cleared so that it is
+     * a multiple of g. Must be a power of 2, which is enforced at runtime. Use 1 to leave addresses alone.
+     * @param t  The number of worker threads, or 0 for one thread per analyzer. The analyzers are
+     * shared round-robin among the threads if there are fewer threads than analyzers.
+     */
+    AnalyzerSet(uint64_t g, uint32_t t);
+
+    /**
+     * Constructs an AnalyzerSet object. Equivalent to calling the other constructor with g == 1 and t == 0.
+     */
+    AnalyzerSet();
+
+    /**
+     * Destroys an AnalyzerSet object, after finishing any addresses in flight. The analyzers are not deleted.
+     */
+    ~AnalyzerSet();
+
+    /**
+     * Add an analyzer to the set. All analyzers must be added before the first address is processed,
+     * which is enforced at runtime.
+     *
+     * @param r  The analyzer.
+     *
+     * @return none
+     */
+    void Add(ReuseDistance* r);
+
+    /**
+     * Map the id of every address before it is given to the analyzers, for instance to fold
+     * instruction addresses into function or loop ids. Must be set before the first address is processed.
+     *
+     * @param fn  Returns the id to use for an id, or NULL to leave ids alone.
+     * @param arg  Passed to every call of fn.
+     *
+     * @return none
+     */
+    void SetIdMap(uint64_t (*fn)(uint64_t id, void* arg), void* arg);
+
+    /**
+     * Process multiple memory addresses. Returns once the addresses have been copied, which
+     * may be before the analyzers have seen them.
+     *
+     * @param addrs  An array of structures describing memory addresses to process, in the order they occurred.
+     * @param count  The number of elements in addrs.
+     *
+     * @return none
+     */
+    void Process(ReuseEntry* addrs, uint64_t count);
+
+    /**
+     * Process a single memory address. Returns once the address has been copied.
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    void Process(ReuseEntry& addr);
+
+    /**
+     * Hand every address processed so far to the analyzers and wait for them to finish, after
+     * which the analyzers can be printed or queried.
+     *
+     * @return none
+     */
+    void Flush();
+
+    /**
+     * Get the number of analyzers in the set.
+     *
+     * @return The number of analyzers.
+     */
+    uint32_t GetSize() { return analyzers.size(); }
+};
+
+#endif /* _ReuseDistance_hpp_ */
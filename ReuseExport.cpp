@@ -0,0 +1,420 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <ReuseExport.hpp>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+ReuseExport::ReuseExport(const char* n, uint64_t i, uint64_t b){
+    Init(n, i, b);
+}
+
+ReuseExport::ReuseExport(const char* n){
+    Init(n, DefaultIds, DefaultBins);
+}
+
+void ReuseExport::Init(const char* n, uint64_t i, uint64_t b){
+    name = n;
+    base = NULL;
+    bytes = sizeof(ReuseExportHeader) + i * sizeof(ReuseExportId) + b * sizeof(ReuseExportBin);
+    full = false;
+
+    fd = shm_open(n, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && ftruncate(fd, bytes) == 0){
+        void* m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED){
+            base = (char*)m;
+        }
+    }
+    if (base == NULL){
+        if (fd >= 0){
+            close(fd);
+            shm_unlink(n);
+        }
+        fd = -1;
+        return;
+    }
+
+    header = (ReuseExportHeader*)base;
+    ids = (ReuseExportId*)(header + 1);
+    bins = (ReuseExportBin*)(ids + i);
+
+    // a new segment is all zeros, so only the sizes need filling in before it is marked ready
+    header->bytes = bytes;
+    header->idcapacity = i;
+    header->bincapacity = b;
+    __sync_synchronize();
+    header->magic = REUSE_EXPORT_MAGIC;
+}
+
+ReuseExport::~ReuseExport(){
+    if (base){
+        munmap(base, bytes);
+    }
+    if (fd >= 0){
+        close(fd);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool ReuseExport::IsOpen(){
+    return (base != NULL);
+}
+
+// write the totals and bins of the i'th id. a histogram which outgrows its room is moved to the
+// end of the bin area, or cut short if the last compaction already ran out of room. false means
+// that a compaction is needed. while compacting, the room has already been chosen
+bool ReuseExport::WriteId(ReuseDistance* r, uint64_t i, bool compacting){
+    ReuseStats* s = r->stats.At(i);
+    ReuseStatsConfig* c = s->config;
+
+    uint64_t n;
+    const ReuseBin* sorted = s->GetSortedBins(&n, scratch);
+
+    uint64_t misses = 0;
+    uint64_t valid = n;
+    for (uint64_t j = 0; j < n; j++){
+        if (sorted[j].distance == c->invalid){
+            misses = sorted[j].count;
+            valid--;
+        }
+    }
+
+    ReuseExportId& rec = ids[i];
+    if (!compacting && valid > rec.room){
+        uint64_t want = valid + valid / 2 + 1;
+        if (header->binsused + want <= header->bincapacity){
+            rec.first = header->binsused;
+            rec.room = want;
+            header->binsused += want;
+        } else if (!full){
+            return false;
+        }
+    }
+
+    ReuseExportBin* b = bins + rec.first;
+    uint64_t k = 0;
+    for (uint64_t j = 0; j < n && k < rec.room; j++){
+        uint64_t d = sorted[j].distance;
+        if (d == c->invalid) continue;
+
+        uint64_t p = d / 2 + 1;
+        if (c->binindividual == ReuseDistance::Infinity || d <= c->binindividual){
+            p = d;
+        }
+        b[k].lower = p;
+        b[k].upper = d;
+        b[k].count = sorted[j].count;
+        k++;
+    }
+
+    rec.id = s->GetId();
+    rec.accesses = s->GetAccessCount();
+    rec.misses = misses;
+    rec.count = k;
+    rec.total = valid;
+    return true;
+}
+
+// lay every histogram out again from the start of the bin area. if they all fit, the space left
+// over is shared out as room to grow, otherwise the ids seen last are cut short
+void ReuseExport::Compact(ReuseDistance* r){
+    uint64_t n = header->idcount;
+    vector<uint64_t> need(n);
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < n; i++){
+        ReuseStats* s = r->stats.At(i);
+        uint64_t k;
+        const ReuseBin* sorted = s->GetSortedBins(&k, scratch);
+        need[i] = k;
+        for (uint64_t j = 0; j < k; j++){
+            if (sorted[j].distance == s->config->invalid){
+                need[i]--;
+            }
+        }
+        total += need[i];
+    }
+
+    uint64_t spare = 0;
+    if (n && total < header->bincapacity){
+        spare = (header->bincapacity - total) / n;
+    }
+
+    header->binsused = 0;
+    for (uint64_t i = 0; i < n; i++){
+        uint64_t room = need[i] + min(need[i] / 2 + 1, spare);
+        room = min(room, header->bincapacity - header->binsused);
+
+        ids[i].first = header->binsused;
+        ids[i].room = room;
+        header->binsused += room;
+        WriteId(r, i, true);
+    }
+    full = (total > header->bincapacity);
+}
+
+void ReuseExport::Publish(ReuseDistance* r){
+    if (!IsOpen()){
+        return;
+    }
+    r->Flush();
+
+    uint64_t n = r->stats.Size();
+    assert(n >= published.size() && "a ReuseExport must be given the same ReuseDistance every time");
+
+    header->version++;
+    __sync_synchronize();
+
+    string d = r->Describe();
+    memset(header->name, 0, sizeof(header->name));
+    strncpy(header->name, d.c_str(), sizeof(header->name) - 1);
+    header->capacity = r->capacity;
+    header->binindividual = r->binindividual;
+    header->maxtracking = r->maxtracking;
+
+    uint64_t tot = 0, mis = 0;
+    bool compact = false;
+    for (uint64_t i = 0; i < n; i++){
+        ReuseStats* s = r->stats.At(i);
+        uint64_t acc = s->GetAccessCount();
+
+        // ids with no record only count towards the totals
+        if (i >= header->idcapacity){
+            tot += acc;
+            mis += s->GetMissCount();
+            continue;
+        }
+
+        if (i == published.size()){
+            published.push_back(acc);
+            memset(&ids[i], 0, sizeof(ReuseExportId));
+        } else if (published[i] == acc){
+            continue;
+        }
+        published[i] = acc;
+
+        // a compaction rewrites every id, so once one is needed the rest can wait for it
+        if (!compact && !WriteId(r, i, false)){
+            compact = true;
+        }
+    }
+
+    header->idcount = min(n, header->idcapacity);
+    header->dropped = n - header->idcount;
+    if (compact){
+        Compact(r);
+    }
+
+    for (uint64_t i = 0; i < header->idcount; i++){
+        tot += ids[i].accesses;
+        mis += ids[i].misses;
+    }
+    header->accesses = tot;
+    header->misses = mis;
+    header->publishes++;
+
+    __sync_synchronize();
+    header->version++;
+}
+
+ReuseExportReader::ReuseExportReader(const char* n){
+    base = NULL;
+    bytes = 0;
+    memset(&copy, 0, sizeof(copy));
+
+    fd = shm_open(n, O_RDONLY, 0);
+    if (fd < 0){
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(ReuseExportHeader)){
+        bytes = st.st_size;
+        void* m = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED){
+            base = (char*)m;
+        }
+    }
+    if (base == NULL){
+        close(fd);
+        fd = -1;
+    }
+}
+
+ReuseExportReader::~ReuseExportReader(){
+    if (base){
+        munmap(base, bytes);
+    }
+    if (fd >= 0){
+        close(fd);
+    }
+}
+
+bool ReuseExportReader::IsOpen(){
+    return (base != NULL);
+}
+
+// take one copy of the segment. the copy is good if the version was even before it and is the same after
+bool ReuseExportReader::TryRead(){
+    const ReuseExportHeader* h = (const ReuseExportHeader*)base;
+    uint64_t v = h->version;
+    if (v & 1){
+        return false;
+    }
+    __sync_synchronize();
+
+    memcpy(&copy, base, sizeof(ReuseExportHeader));
+    if (copy.magic != REUSE_EXPORT_MAGIC || copy.bytes > bytes
+        || copy.idcount > copy.idcapacity || copy.binsused > copy.bincapacity){
+        return false;
+    }
+
+    const ReuseExportId* xi = (const ReuseExportId*)(h + 1);
+    const ReuseExportBin* xb = (const ReuseExportBin*)(xi + copy.idcapacity);
+    ids.assign(xi, xi + copy.idcount);
+    bins.assign(xb, xb + copy.binsused);
+
+    __sync_synchronize();
+    if (h->version != v){
+        return false;
+    }
+
+    for (uint64_t i = 0; i < ids.size(); i++){
+        if (ids[i].first + ids[i].count > bins.size()){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ReuseExportReader::Read(){
+    if (!IsOpen()){
+        return false;
+    }
+    for (uint32_t i = 0; i < ReadAttempts; i++){
+        if (TryRead()){
+            return true;
+        }
+        sched_yield();
+    }
+    ids.clear();
+    bins.clear();
+    memset(&copy, 0, sizeof(copy));
+    return false;
+}
+
+const ReuseExportHeader& ReuseExportReader::GetHeader(){
+    return copy;
+}
+
+uint64_t ReuseExportReader::GetIdCount(){
+    return ids.size();
+}
+
+const ReuseExportId& ReuseExportReader::GetId(uint64_t i){
+    assert(i < ids.size());
+    return ids[i];
+}
+
+const ReuseExportBin* ReuseExportReader::GetBins(uint64_t i){
+    assert(i < ids.size());
+    if (bins.empty()){
+        return NULL;
+    }
+    return &bins[0] + ids[i].first;
+}
+
+void ReuseExportReader::Print(ostream& f, bool annotate){
+    string d(copy.name, strnlen(copy.name, sizeof(copy.name)));
+
+    // ids are printed in increasing order, as ReuseDistance::Print does
+    vector<pair<uint64_t, uint64_t> > order;
+    uint64_t truncated = 0;
+    for (uint64_t i = 0; i < ids.size(); i++){
+        order.push_back(pair<uint64_t, uint64_t>(ids[i].id, i));
+        if (ids[i].count < ids[i].total){
+            truncated++;
+        }
+    }
+    sort(order.begin(), order.end());
+
+    if (annotate){
+        f << "# "
+          << d << "STATS"
+          << TAB << "<window_size>"
+          << TAB << "<bin_indiv>"
+          << TAB << "<max_track>"
+          << TAB << "<id_count>"
+          << TAB << "<tot_access>"
+          << TAB << "<tot_miss>"
+          << ENDL;
+
+        f << "# "
+          << TAB << d << "ID"
+          << TAB << "<id>"
+          << TAB << "<id_access>"
+          << TAB << "<id_miss>"
+          << ENDL;
+
+        ReuseStats::PrintFormat(f);
+    }
+    if (copy.dropped || truncated){
+        f << "# export"
+          << TAB << "publishes" << TAB << dec << copy.publishes
+          << TAB << "dropped" << TAB << copy.dropped
+          << TAB << "truncated" << TAB << truncated
+          << ENDL;
+    }
+
+    f << d << "STATS"
+      << TAB << dec << copy.capacity
+      << TAB << copy.binindividual
+      << TAB << copy.maxtracking
+      << TAB << ids.size()
+      << TAB << copy.accesses
+      << TAB << copy.misses
+      << ENDL;
+
+    for (uint64_t i = 0; i < order.size(); i++){
+        const ReuseExportId& r = ids[order[i].second];
+        f << TAB << d << "ID"
+          << TAB << dec << r.id
+          << TAB << r.accesses
+          << TAB << r.misses
+          << ENDL;
+
+        const ReuseExportBin* b = GetBins(order[i].second);
+        for (uint64_t j = 0; j < r.count; j++){
+            f << TAB
+              << TAB << b[j].lower
+              << TAB << b[j].upper
+              << TAB << b[j].count
+              << ENDL;
+        }
+    }
+}
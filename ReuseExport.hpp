@@ -0,0 +1,294 @@
+/**
+ * @file
+ * @author Michael Laurenzano <michaell@sdsc.edu>
+ * @version 0.01
+ *
+ * @section LICENSE
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * ReuseExport publishes the per-id histograms of a running ReuseDistance into a POSIX shared
+ * memory segment, and ReuseExportReader reads them from another process, so a long analysis
+ * can be watched without stopping it to call Print.
+ */
+
+#ifndef _ReuseExport_hpp_
+#define _ReuseExport_hpp_
+
+#include <ReuseDistance.hpp>
+
+// "REUSEEXP"
+#define REUSE_EXPORT_MAGIC (0x5245555345455850L)
+
+/**
+ * @struct ReuseExportHeader
+ *
+ * The start of an export segment. It is followed by idcapacity ReuseExportId records and then
+ * bincapacity ReuseExportBin records.
+ *
+ * @field magic  REUSE_EXPORT_MAGIC once the segment is ready to be read.
+ * @field version  Odd while the segment is being written, and incremented again when the write is done.
+ * @field bytes  The size of the segment.
+ * @field publishes  The number of times the segment has been written.
+ * @field name  The output name of the ReuseDistance (REUSE, SPATIAL, ...), 0-terminated.
+ * @field capacity  The window size of the ReuseDistance.
+ * @field binindividual  The largest distance tracked individually.
+ * @field maxtracking  The largest distance which is not a miss.
+ * @field accesses  The number of accesses of every id, including ids which did not fit.
+ * @field misses  The number of misses of every id, including ids which did not fit.
+ * @field idcount  The number of ReuseExportId records in use.
+ * @field idcapacity  The number of ReuseExportId records in the segment.
+ * @field binsused  The number of ReuseExportBin records in use, including ones which are no longer referenced.
+ * @field bincapacity  The number of ReuseExportBin records in the segment.
+ * @field dropped  The number of ids which had no room for a ReuseExportId record.
+ */
+struct ReuseExportHeader {
+    uint64_t magic;
+    volatile uint64_t version;
+    uint64_t bytes;
+    uint64_t publishes;
+    char name[16];
+    uint64_t capacity;
+    uint64_t binindividual;
+    uint64_t maxtracking;
+    uint64_t accesses;
+    uint64_t misses;
+    uint64_t idcount;
+    uint64_t idcapacity;
+    uint64_t binsused;
+    uint64_t bincapacity;
+    uint64_t dropped;
+};
+
+/**
+ * @struct ReuseExportId
+ *
+ * The totals of one id and where its bins are. Records are in the order the ids were first seen.
+ *
+ * @field id  The id.
+ * @field accesses  The number of accesses to the id.
+ * @field misses  The number of those accesses which were misses.
+ * @field first  The index of the id's first ReuseExportBin.
+ * @field count  The number of bins held, in increasing order of distance.
+ * @field room  The number of bins reserved at first.
+ * @field total  The number of bins the id has. count < total if they did not all fit.
+ */
+struct ReuseExportId {
+    uint64_t id;
+    uint64_t accesses;
+    uint64_t misses;
+    uint64_t first;
+    uint64_t count;
+    uint64_t room;
+    uint64_t total;
+};
+
+/**
+ * @struct ReuseExportBin
+ *
+ * One distance bin, with the same boundaries and count as a bin line of ReuseDistance::Print.
+ */
+struct ReuseExportBin {
+    uint64_t lower;
+    uint64_t upper;
+    uint64_t count;
+};
+
+/**
+ * @class ReuseExport
+ *
+ * A shared memory segment which receives the histograms of a ReuseDistance. The segment has a fixed
+ * size. Each call to Publish rewrites the records and bins of the ids whose access count changed
+ * since the previous call and leaves the others alone, so publishing costs a pass over the ids plus
+ * the bins of the busy ones. A histogram which outgrows its room is moved to the end of the bin area,
+ * and the bin area is compacted when it fills up. Readers use the version field of the header as a
+ * sequence lock: a copy is good if version was even and unchanged before and after it was taken.
+ *
+ * Publish must not be called at the same time as Process on the same ReuseDistance. The simplest
+ * way to arrange that is ReuseDistance::SetExport.
+ */
+class ReuseExport {
+private:
+    std::string name;
+    int fd;
+    char* base;
+    uint64_t bytes;
+
+    ReuseExportHeader* header;
+    ReuseExportId* ids;
+    ReuseExportBin* bins;
+
+    // the access count of each exported id when it was last written, by position in the stats table
+    std::vector<uint64_t> published;
+
+    // set by a compaction which could not fit every histogram. until the next compaction, histograms
+    // which outgrow their room are cut short instead of compacting on every Publish
+    bool full;
+
+    std::vector<ReuseBin> scratch;
+
+    void Init(const char* n, uint64_t i, uint64_t b);
+    bool WriteId(ReuseDistance* r, uint64_t i, bool compacting);
+    void Compact(ReuseDistance* r);
+
+public:
+
+    // the number of ids and bins given to a segment by the 1-argument constructor
+    static const uint64_t DefaultIds = 4096;
+    static const uint64_t DefaultBins = 262144;
+
+    /**
+     * Contructs a ReuseExport object, creating a new shared memory segment.
+     *
+     * @param n  The name of the segment, which should start with '/' (see shm_open). An existing
+     * segment with the same name is replaced.
+     * @param i  The number of ids which have room in the segment. Ids seen after the first i are
+     * only counted in the totals.
+     * @param b  The number of bins which have room in the segment, for all ids together.
+     */
+    ReuseExport(const char* n, uint64_t i, uint64_t b);
+
+    /**
+     * Contructs a ReuseExport object. Equivalent to calling the other constructor with
+     * i == ReuseExport::DefaultIds and b == ReuseExport::DefaultBins.
+     */
+    ReuseExport(const char* n);
+
+    /**
+     * Destroys a ReuseExport object and removes its segment. Readers which have it open keep
+     * their copy.
+     */
+    ~ReuseExport();
+
+    /**
+     * Find out whether the segment could be created.
+     *
+     * @return true if the segment is open.
+     */
+    bool IsOpen();
+
+    /**
+     * Write the histograms of a ReuseDistance into the segment, after flushing its held back
+     * addresses (see ReuseDistance::Flush). Nothing happens if the segment is not open.
+     *
+     * @param r  The ReuseDistance, which should be the same one every time.
+     *
+     * @return none
+     */
+    void Publish(ReuseDistance* r);
+};
+
+/**
+ * @class ReuseExportReader
+ *
+ * Opens the segment of a ReuseExport and takes consistent copies of it.
+ */
+class ReuseExportReader {
+private:
+    int fd;
+    char* base;
+    uint64_t bytes;
+
+    ReuseExportHeader copy;
+    std::vector<ReuseExportId> ids;
+    std::vector<ReuseExportBin> bins;
+
+    bool TryRead();
+
+public:
+
+    // the number of times Read tries to take a copy before giving up
+    static const uint32_t ReadAttempts = 1000;
+
+    /**
+     * Contructs a ReuseExportReader object.
+     *
+     * @param n  The name given to the ReuseExport.
+     */
+    ReuseExportReader(const char* n);
+
+    /**
+     * Destroys a ReuseExportReader object.
+     */
+    ~ReuseExportReader();
+
+    /**
+     * Find out whether the segment could be opened.
+     *
+     * @return true if the segment is open.
+     */
+    bool IsOpen();
+
+    /**
+     * Copy the segment. The copy is kept until the next call to Read, and is what the other
+     * methods look at.
+     *
+     * @return true if a consistent copy was taken, false if the segment is not open, is not a
+     * ReuseExport segment or was being written on every attempt.
+     */
+    bool Read();
+
+    /**
+     * Get the header of the copy.
+     *
+     * @return The header.
+     */
+    const ReuseExportHeader& GetHeader();
+
+    /**
+     * Get the number of ids in the copy.
+     *
+     * @return The number of ids.
+     */
+    uint64_t GetIdCount();
+
+    /**
+     * Get the record of an id in the copy.
+     *
+     * @param i  The position of the id, 0 <= i < GetIdCount().
+     *
+     * @return The record.
+     */
+    const ReuseExportId& GetId(uint64_t i);
+
+    /**
+     * Get the bins of an id in the copy.
+     *
+     * @param i  The position of the id, 0 <= i < GetIdCount().
+     *
+     * @return GetId(i).count bins in increasing order of distance.
+     */
+    const ReuseExportBin* GetBins(uint64_t i);
+
+    /**
+     * Print the copy to an output stream in the format of ReuseDistance::Print. The output is the
+     * same as that of Print on the ReuseDistance at the time of the Publish, except that there are
+     * no sampling lines, and a '#' line counting the ids which did not fit is printed if there were
+     * any.
+     *
+     * @param f  The output stream to print to.
+     * @param annotate  Also print annotations describing the meaning of output fields, preceded by a '#'.
+     *
+     * @return none
+     */
+    void Print(std::ostream& f, bool annotate=false);
+};
+
+#endif /* _ReuseExport_hpp_ */
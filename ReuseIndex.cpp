@@ -0,0 +1,208 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ReuseIndex.hpp>
+
+#include <string.h>
+
+using namespace std;
+
+ReusePageTable::ReusePageTable()
+    : lastkey(0), lastdir(NULL), size(0), pages(0), shift(MaxShift), low((1 << MaxShift) - 1)
+{
+}
+
+// an address has come in with one of the dropped bits set, so everything is put back in with
+// fewer bits dropped. this happens at most MaxShift times
+void ReusePageTable::Reshift(uint64_t s){
+    vector<uint64_t> addrs;
+    GetAddresses(addrs);
+    vector<uint64_t> values;
+    values.reserve(addrs.size());
+    for (vector<uint64_t>::const_iterator it = addrs.begin(); it != addrs.end(); it++){
+        values.push_back(Get(*it));
+    }
+
+    Clear();
+    shift = s;
+    low = (1UL << shift) - 1;
+    for (uint64_t i = 0; i < addrs.size(); i++){
+        Put(addrs[i], values[i]);
+    }
+}
+
+ReusePageTable::~ReusePageTable(){
+    Clear();
+    for (vector<ReusePage*>::const_iterator it = spare.begin(); it != spare.end(); it++){
+        delete *it;
+    }
+}
+
+ReusePage** ReusePageTable::FindDirectory(uint64_t key, bool gen){
+    reuse_map_type<uint64_t, ReusePage**>::const_iterator it = dirs.find(key);
+    ReusePage** d;
+    if (it != dirs.end()){
+        d = it->second;
+    } else if (gen){
+        d = new ReusePage*[DirSize];
+        memset(d, 0, DirSize * sizeof(ReusePage*));
+        dirs[key] = d;
+    } else {
+        return NULL;
+    }
+
+    lastkey = key;
+    lastdir = d;
+    return d;
+}
+
+ReusePage* ReusePageTable::NewPage(){
+    pages++;
+    if (spare.size()){
+        ReusePage* p = spare.back();
+        spare.pop_back();
+        return p;
+    }
+    ReusePage* p = new ReusePage();
+    memset(p, 0, sizeof(ReusePage));
+    return p;
+}
+
+// directories are only freed by Clear, since there are few of them
+void ReusePageTable::FreePage(ReusePage** d, uint64_t p){
+    spare.push_back(d[p]);
+    d[p] = NULL;
+    pages--;
+}
+
+void ReusePageTable::Clear(){
+    for (reuse_map_type<uint64_t, ReusePage**>::const_iterator it = dirs.begin(); it != dirs.end(); it++){
+        ReusePage** d = it->second;
+        for (uint64_t i = 0; i < DirSize; i++){
+            if (d[i]){
+                memset(d[i], 0, sizeof(ReusePage));
+                spare.push_back(d[i]);
+            }
+        }
+        delete[] d;
+    }
+    dirs.clear();
+    lastdir = NULL;
+    size = 0;
+    pages = 0;
+}
+
+void ReusePageTable::GetAddresses(vector<uint64_t>& addrs){
+    for (reuse_map_type<uint64_t, ReusePage**>::const_iterator it = dirs.begin(); it != dirs.end(); it++){
+        ReusePage** d = it->second;
+        for (uint64_t i = 0; i < DirSize; i++){
+            if (d[i] == NULL){
+                continue;
+            }
+            uint64_t base = (it->first << (PageBits + DirBits)) | (i << PageBits);
+            for (uint64_t j = 0; j < PageSize; j++){
+                if (d[i]->values[j]){
+                    addrs.push_back((base | j) << shift);
+                }
+            }
+        }
+    }
+}
+
+uint64_t ReusePageTable::GetBytes(){
+    return (pages + spare.size()) * sizeof(ReusePage) + dirs.size() * DirSize * sizeof(ReusePage*)
+#ifdef HAVE_UNORDERED_MAP
+        + dirs.size() * (sizeof(pair<const uint64_t, ReusePage**>) + 2 * sizeof(void*)) + dirs.bucket_count() * sizeof(void*);
+#else
+        + dirs.size() * (sizeof(pair<const uint64_t, ReusePage**>) + 4 * sizeof(void*));
+#endif
+}
+
+uint64_t ReusePageTable::GetAllocations(){
+    return pages + spare.size() + 2 * dirs.size();
+}
+
+ReuseIndex::ReuseIndex(uint32_t i)
+    : pagetable(NULL)
+{
+    if (i == ReuseDistance::IndexPageTable){
+        pagetable = new ReusePageTable();
+    } else {
+        assert(i == ReuseDistance::IndexHash);
+    }
+}
+
+ReuseIndex::~ReuseIndex(){
+    if (pagetable){
+        delete pagetable;
+    }
+}
+
+void ReuseIndex::Clear(){
+    if (pagetable){
+        pagetable->Clear();
+    } else {
+        map.clear();
+    }
+}
+
+void ReuseIndex::Shrink(){
+#ifdef HAVE_UNORDERED_MAP
+    map.rehash(0);
+#endif
+}
+
+void ReuseIndex::GetAddresses(vector<uint64_t>& addrs){
+    if (pagetable){
+        pagetable->GetAddresses(addrs);
+        return;
+    }
+    for (reuse_map_type<uint64_t, uint64_t>::const_iterator it = map.begin(); it != map.end(); it++){
+        addrs.push_back(it->first);
+    }
+}
+
+// one node per entry, plus the bucket array for a hash
+uint64_t ReuseIndex::GetBytes(){
+    if (pagetable){
+        return pagetable->GetBytes();
+    }
+#ifdef HAVE_UNORDERED_MAP
+    return map.size() * (sizeof(pair<const uint64_t, uint64_t>) + 2 * sizeof(void*)) + map.bucket_count() * sizeof(void*);
+#else
+    return map.size() * (sizeof(pair<const uint64_t, uint64_t>) + 4 * sizeof(void*));
+#endif
+}
+
+void ReuseIndex::GetEngineStats(ReuseEngineStats& s){
+    s.hashsize = Size();
+    s.hashbytes = GetBytes();
+    if (pagetable){
+        s.hashbuckets = 0;
+        s.loadfactor = 0;
+        s.allocations += pagetable->GetAllocations();
+        return;
+    }
+#ifdef HAVE_UNORDERED_MAP
+    s.hashbuckets = map.bucket_count();
+    s.loadfactor = map.load_factor();
+#endif
+    s.allocations += map.size();
+}
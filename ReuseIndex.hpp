@@ -0,0 +1,243 @@
+/**
+ * @file
+ * @author Michael Laurenzano <michaell@sdsc.edu>
+ * @version 0.01
+ *
+ * @section LICENSE
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * The address indexes used internally by ReuseDistance, which map each address in a window
+ * to the sequence number or position of its latest access.
+ */
+
+#ifndef _ReuseIndex_hpp_
+#define _ReuseIndex_hpp_
+
+#include <ReuseDistance.hpp>
+
+// one leaf of a ReusePageTable. every value is 0 when count is 0
+struct ReusePage;
+
+/**
+ * @class ReusePageTable
+ *
+ * An address index shaped like a multi-level page table. Low bits which are 0 in every address
+ * (up to MaxShift of them, such as the offset of a cache line) are dropped. The next PageBits
+ * select a value in a dense leaf page, the next DirBits select the page in a directory, and the
+ * directories are found by the remaining bits in a hash with a one-entry cache in front of it.
+ * Nearby addresses share pages and cache lines, and memory is allocated a page at a time.
+ * Emptied pages are kept for reuse. Only a good choice when addresses are clustered, since a
+ * page is allocated for every region of 2^PageBits addresses that is touched.
+ */
+class ReusePageTable {
+private:
+    // [address >> (PageBits + DirBits) -> array of 2^DirBits pages, NULL where there are none]
+    reuse_map_type<uint64_t, ReusePage**> dirs;
+
+    // the directory used most recently
+    uint64_t lastkey;
+    ReusePage** lastdir;
+
+    // empty pages which can be reused
+    std::vector<ReusePage*> spare;
+
+    uint64_t size;
+    uint64_t pages;
+
+    // the number of low bits dropped from every address, and a mask of them
+    uint64_t shift;
+    uint64_t low;
+
+    void Reshift(uint64_t s);
+    ReusePage** FindDirectory(uint64_t key, bool gen);
+    ReusePage* NewPage();
+    void FreePage(ReusePage** d, uint64_t p);
+
+    inline ReusePage** Directory(uint64_t key, bool gen){
+        key >>= PageBits + DirBits;
+        if (lastdir && key == lastkey){
+            return lastdir;
+        }
+        return FindDirectory(key, gen);
+    }
+
+public:
+
+    static const uint64_t PageBits = 9;
+    static const uint64_t DirBits = 9;
+    static const uint64_t PageSize = 1 << PageBits;
+    static const uint64_t DirSize = 1 << DirBits;
+    static const uint64_t MaxShift = 12;
+
+    ReusePageTable();
+    ~ReusePageTable();
+
+    inline uint64_t Get(uint64_t addr);
+    inline void Put(uint64_t addr, uint64_t v);
+    inline bool Erase(uint64_t addr);
+
+    uint64_t Size() { return size; }
+    void Clear();
+    void GetAddresses(std::vector<uint64_t>& addrs);
+    uint64_t GetBytes();
+    uint64_t GetAllocations();
+};
+
+struct ReusePage {
+    uint64_t values[ReusePageTable::PageSize];
+    uint64_t count;
+};
+
+inline uint64_t ReusePageTable::Get(uint64_t addr){
+    if (addr & low){
+        return 0;
+    }
+    uint64_t k = addr >> shift;
+    ReusePage** d = Directory(k, false);
+    if (d == NULL){
+        return 0;
+    }
+    ReusePage* p = d[(k >> PageBits) & (DirSize - 1)];
+    return p ? p->values[k & (PageSize - 1)] : 0;
+}
+
+inline void ReusePageTable::Put(uint64_t addr, uint64_t v){
+    if (addr & low){
+        Reshift(__builtin_ctzll(addr));
+    }
+    uint64_t k = addr >> shift;
+    ReusePage** d = Directory(k, true);
+    ReusePage*& p = d[(k >> PageBits) & (DirSize - 1)];
+    if (p == NULL){
+        p = NewPage();
+    }
+    uint64_t& value = p->values[k & (PageSize - 1)];
+    if (value == 0){
+        p->count++;
+        size++;
+    }
+    value = v;
+}
+
+inline bool ReusePageTable::Erase(uint64_t addr){
+    if (addr & low){
+        return false;
+    }
+    uint64_t k = addr >> shift;
+    ReusePage** d = Directory(k, false);
+    if (d == NULL){
+        return false;
+    }
+    uint64_t i = (k >> PageBits) & (DirSize - 1);
+    ReusePage* p = d[i];
+    if (p == NULL || p->values[k & (PageSize - 1)] == 0){
+        return false;
+    }
+    p->values[k & (PageSize - 1)] = 0;
+    size--;
+    if (--p->count == 0){
+        FreePage(d, i);
+    }
+    return true;
+}
+
+/**
+ * @class ReuseIndex
+ *
+ * Maps an address to a non-zero value, using either a hash or a ReusePageTable. Get returns 0
+ * for an address which is not in the index.
+ */
+class ReuseIndex {
+private:
+    reuse_map_type<uint64_t, uint64_t> map;
+
+    // used instead of map when it is not NULL
+    ReusePageTable* pagetable;
+
+public:
+
+    /**
+     * @param i  One of ReuseDistance::IndexHash or ReuseDistance::IndexPageTable.
+     */
+    ReuseIndex(uint32_t i);
+    ~ReuseIndex();
+
+    inline uint64_t Get(uint64_t addr){
+        if (pagetable){
+            return pagetable->Get(addr);
+        }
+        reuse_map_type<uint64_t, uint64_t>::const_iterator it = map.find(addr);
+        return it == map.end() ? 0 : it->second;
+    }
+
+    inline void Put(uint64_t addr, uint64_t v){
+        if (pagetable){
+            pagetable->Put(addr, v);
+        } else {
+            map[addr] = v;
+        }
+    }
+
+    inline bool Erase(uint64_t addr){
+        if (pagetable){
+            return pagetable->Erase(addr);
+        }
+        return map.erase(addr) > 0;
+    }
+
+    /**
+     * Make Get return 0 for an address which is expected to be Put again soon. The hash keeps
+     * the address's entry, with a value of 0, so that the next Put does not allocate one. Erase
+     * removes such an entry.
+     */
+    inline void Park(uint64_t addr){
+        if (pagetable){
+            pagetable->Erase(addr);
+        } else {
+            reuse_map_type<uint64_t, uint64_t>::iterator it = map.find(addr);
+            if (it != map.end()){
+                it->second = 0;
+            }
+        }
+    }
+
+    uint64_t Size() { return pagetable ? pagetable->Size() : map.size(); }
+    void Clear();
+
+    /**
+     * Give memory back after many addresses have been erased.
+     */
+    void Shrink();
+
+    /**
+     * Get every address in the index, in no particular order.
+     */
+    void GetAddresses(std::vector<uint64_t>& addrs);
+
+    uint64_t GetBytes();
+
+    /**
+     * Fill in the hashsize, hashbuckets, loadfactor and hashbytes fields of s, and add to its allocations.
+     */
+    void GetEngineStats(ReuseEngineStats& s);
+};
+
+#endif /* _ReuseIndex_hpp_ */
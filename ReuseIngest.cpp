@@ -0,0 +1,230 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ReuseIngest.hpp>
+
+#include <sched.h>
+#include <time.h>
+
+using namespace std;
+
+// how long the analyzer thread sleeps when none of the producers have anything for it
+#define INGEST_IDLE_NSEC (20000)
+
+ReuseProducer::ReuseProducer(ReuseIngest* o, uint64_t r, uint64_t b)
+    : owner(o), ringsize(r), blocksize(b), head(0), tail(0), fill(0), pending(0), pressured(0), dropped(0)
+{
+    assert(ringsize > 1 && "ring must have at least 2 blocks");
+    assert(blocksize > 0 && "blocks must hold at least 1 address");
+
+    ring = new ReuseBlock[ringsize];
+    for (uint64_t i = 0; i < ringsize; i++){
+        ring[i].count = 0;
+        ring[i].skip = 0;
+        ring[i].entries = new ReuseEntry[blocksize];
+    }
+    cur = ring[0].entries;
+}
+
+ReuseProducer::~ReuseProducer(){
+    for (uint64_t i = 0; i < ringsize; i++){
+        delete[] ring[i].entries;
+    }
+    delete[] ring;
+}
+
+void ReuseProducer::Publish(bool wait){
+    // the block after this one must be free before this one can be handed over
+    if (head + 1 - tail >= ringsize){
+        uint32_t policy = owner->policy;
+        if (policy == ReuseIngest::PolicySample && ++pressured % owner->samplerate == 0){
+            wait = true;
+        }
+        if (policy == ReuseIngest::PolicyBlock){
+            wait = true;
+        }
+
+        if (!wait){
+            if (policy == ReuseIngest::PolicySample){
+                pending += fill;
+            }
+            dropped = dropped + fill;
+            fill = 0;
+            return;
+        }
+
+        while (head + 1 - tail >= ringsize){
+            sched_yield();
+        }
+        __sync_synchronize();
+    }
+
+    ReuseBlock* b = &ring[head % ringsize];
+    b->count = fill;
+    b->skip = pending;
+    pending = 0;
+
+    // entries must be visible before the analyzer can see the new head
+    __sync_synchronize();
+    head = head + 1;
+
+    cur = ring[head % ringsize].entries;
+    fill = 0;
+}
+
+void ReuseProducer::Flush(){
+    if (fill > 0 || pending > 0){
+        Publish(true);
+    }
+}
+
+uint64_t ReuseProducer::GetDropCount(){
+    return dropped;
+}
+
+ReuseIngest::ReuseIngest(ReuseDistance* r, uint32_t p, uint64_t rs, uint64_t bs, uint32_t s){
+    Init(r, p, rs, bs, s);
+}
+
+ReuseIngest::ReuseIngest(ReuseDistance* r, uint32_t p){
+    Init(r, p, DefaultRingSize, DefaultBlockSize, DefaultSampleRate);
+}
+
+void ReuseIngest::Init(ReuseDistance* r, uint32_t p, uint64_t rs, uint64_t bs, uint32_t s){
+    analyzer = r;
+    policy = p;
+    ringsize = rs;
+    blocksize = bs;
+    samplerate = s;
+
+    assert(analyzer);
+    assert((policy == PolicyBlock || policy == PolicyDrop || policy == PolicySample) && "unknown backpressure policy");
+    assert(samplerate > 0);
+
+    maxproducers = DefaultMaxProducers;
+    producers = new ReuseProducer*[maxproducers];
+    producercount = 0;
+    pthread_mutex_init(&registerlock, NULL);
+
+    processed = 0;
+    running = true;
+    int ret = pthread_create(&thread, NULL, ReuseIngest::Analyze, this);
+    assert(ret == 0 && "unable to create analyzer thread");
+}
+
+ReuseIngest::~ReuseIngest(){
+    // producers are done at this point, so their partial blocks can be handed over from here
+    for (uint32_t i = 0; i < producercount; i++){
+        producers[i]->Flush();
+    }
+    Drain();
+
+    running = false;
+    pthread_join(thread, NULL);
+
+    for (uint32_t i = 0; i < producercount; i++){
+        delete producers[i];
+    }
+    delete[] producers;
+    pthread_mutex_destroy(&registerlock);
+}
+
+ReuseProducer* ReuseIngest::Register(){
+    pthread_mutex_lock(&registerlock);
+    assert(producercount < maxproducers && "too many producers registered");
+
+    ReuseProducer* p = new ReuseProducer(this, ringsize, blocksize);
+    producers[producercount] = p;
+
+    // the producer must be fully constructed before the analyzer can see it
+    __sync_synchronize();
+    producercount = producercount + 1;
+    pthread_mutex_unlock(&registerlock);
+
+    return p;
+}
+
+bool ReuseIngest::Poll(){
+    bool work = false;
+    uint32_t count = producercount;
+    __sync_synchronize();
+
+    for (uint32_t i = 0; i < count; i++){
+        ReuseProducer* p = producers[i];
+
+        // only take what is there now so one busy producer cannot starve the others
+        uint64_t h = p->head;
+        __sync_synchronize();
+
+        while (p->tail != h){
+            ReuseBlock* b = &p->ring[p->tail % p->ringsize];
+            if (b->skip){
+                analyzer->SkipAddresses(b->skip);
+            }
+            analyzer->Process(b->entries, b->count);
+            processed = processed + b->count;
+
+            // done reading the block before the producer can reuse it
+            __sync_synchronize();
+            p->tail = p->tail + 1;
+            work = true;
+        }
+    }
+    return work;
+}
+
+void* ReuseIngest::Analyze(void* arg){
+    ReuseIngest* ingest = (ReuseIngest*)arg;
+    struct timespec idle;
+    idle.tv_sec = 0;
+    idle.tv_nsec = INGEST_IDLE_NSEC;
+
+    while (ingest->running){
+        if (!ingest->Poll()){
+            nanosleep(&idle, NULL);
+        }
+    }
+    ingest->Poll();
+    return NULL;
+}
+
+void ReuseIngest::Drain(){
+    uint32_t count = producercount;
+    for (uint32_t i = 0; i < count; i++){
+        ReuseProducer* p = producers[i];
+        while (p->tail != p->head){
+            sched_yield();
+        }
+    }
+    __sync_synchronize();
+}
+
+uint64_t ReuseIngest::GetDropCount(){
+    uint64_t d = 0;
+    uint32_t count = producercount;
+    for (uint32_t i = 0; i < count; i++){
+        d += producers[i]->GetDropCount();
+    }
+    return d;
+}
+
+uint64_t ReuseIngest::GetProcessedCount(){
+    return processed;
+}
@@ -0,0 +1,235 @@
+/**
+ * @file
+ * @author Michael Laurenzano <michaell@sdsc.edu>
+ * @version 0.01
+ *
+ * @section LICENSE
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * The ReuseIngest class allows many application threads to feed a single
+ * ReuseDistance (or SpatialLocality) without locking. Each application thread
+ * writes into its own ReuseProducer, which hands full blocks of addresses to a
+ * dedicated analyzer thread through a lock-free single-producer/single-consumer ring.
+ */
+
+#ifndef _ReuseIngest_hpp_
+#define _ReuseIngest_hpp_
+
+#include <pthread.h>
+#include <ReuseDistance.hpp>
+
+class ReuseIngest;
+
+/**
+ * @struct ReuseBlock
+ *
+ * A block of addresses handed from a ReuseProducer to the analyzer thread.
+ *
+ * @field count  The number of valid elements in entries.
+ * @field skip  The number of addresses that were discarded by the producer just before
+ * this block. These are passed to ReuseDistance::SkipAddresses before the block is processed.
+ * @field entries  The addresses.
+ */
+struct ReuseBlock {
+    uint64_t count;
+    uint64_t skip;
+    ReuseEntry* entries;
+};
+
+/**
+ * @class ReuseProducer
+ *
+ * The per-thread front-end of a ReuseIngest. A ReuseProducer must only be used by a single
+ * application thread. Get one by calling ReuseIngest::Register from that thread.
+ */
+class ReuseProducer {
+private:
+    ReuseIngest* owner;
+
+    // ring of blocks. head is only written by the producer, tail only by the analyzer
+    ReuseBlock* ring;
+    uint64_t ringsize;
+    uint64_t blocksize;
+    volatile uint64_t head;
+    volatile uint64_t tail;
+
+    // the block currently being filled, which is ring[head % ringsize]
+    ReuseEntry* cur;
+    uint64_t fill;
+
+    // addresses discarded by this producer
+    uint64_t pending;
+    uint64_t pressured;
+    volatile uint64_t dropped;
+
+    void Publish(bool wait);
+
+    ReuseProducer(ReuseIngest* o, uint64_t r, uint64_t b);
+    ~ReuseProducer();
+
+    friend class ReuseIngest;
+
+public:
+
+    /**
+     * Add a memory address to the stream. This only stores the address into a buffer; the
+     * address is analyzed later by the analyzer thread.
+     *
+     * @param addr  The structure describing the memory address to process.
+     *
+     * @return none
+     */
+    inline void Process(ReuseEntry& addr){
+        cur[fill++] = addr;
+        if (fill == blocksize){
+            Publish(false);
+        }
+    }
+
+    /**
+     * Hand any buffered addresses to the analyzer thread, even if the current block is not full.
+     * Should be called by the owning thread before it exits or goes idle for a long time.
+     *
+     * @return none
+     */
+    void Flush();
+
+    /**
+     * Get the number of addresses from this producer that were discarded because the analyzer
+     * thread could not keep up.
+     *
+     * @return The number of discarded addresses.
+     */
+    uint64_t GetDropCount();
+};
+
+/**
+ * @class ReuseIngest
+ *
+ * Feeds addresses from many application threads into a single ReuseDistance, which is only
+ * ever touched by a dedicated analyzer thread. Addresses from a single producer are analyzed in order,
+ * but addresses from different producers are interleaved at block granularity.
+ */
+class ReuseIngest {
+private:
+    ReuseDistance* analyzer;
+
+    uint32_t policy;
+    uint32_t samplerate;
+    uint64_t ringsize;
+    uint64_t blocksize;
+
+    // producers are only ever added, so the analyzer can read this without locking
+    ReuseProducer** producers;
+    volatile uint32_t producercount;
+    uint32_t maxproducers;
+    pthread_mutex_t registerlock;
+
+    pthread_t thread;
+    volatile bool running;
+    volatile uint64_t processed;
+
+    void Init(ReuseDistance* r, uint32_t p, uint64_t rs, uint64_t bs, uint32_t s);
+    static void* Analyze(void* arg);
+    bool Poll();
+
+    friend class ReuseProducer;
+
+public:
+
+    /**
+     * When the analyzer falls behind, wait for it to catch up.
+     */
+    static const uint32_t PolicyBlock = 0;
+
+    /**
+     * When the analyzer falls behind, discard the addresses and count them.
+     */
+    static const uint32_t PolicyDrop = 1;
+
+    /**
+     * When the analyzer falls behind, discard the addresses and count them, and also keep 1 out of every
+     * samplerate blocks even if the producer has to wait for it. The discarded addresses are reported to
+     * the ReuseDistance with SkipAddresses, so the result is equivalent to interval-based sampling.
+     */
+    static const uint32_t PolicySample = 2;
+
+    static const uint64_t DefaultRingSize = 64;
+    static const uint64_t DefaultBlockSize = 4096;
+    static const uint32_t DefaultSampleRate = 16;
+    static const uint32_t DefaultMaxProducers = 1024;
+
+    /**
+     * Constructs a ReuseIngest object and starts its analyzer thread.
+     *
+     * @param r  The ReuseDistance which will analyze the addresses. r must not be used by any other thread
+     * until this ReuseIngest is destroyed.
+     * @param p  The backpressure policy. One of ReuseIngest::PolicyBlock, ReuseIngest::PolicyDrop or ReuseIngest::PolicySample.
+     * @param rs  The number of blocks in each producer's ring.
+     * @param bs  The number of addresses in each block.
+     * @param s  The sample rate used by ReuseIngest::PolicySample.
+     */
+    ReuseIngest(ReuseDistance* r, uint32_t p, uint64_t rs, uint64_t bs, uint32_t s);
+
+    /**
+     * Constructs a ReuseIngest object. Equivalent to calling the other constructor with
+     * rs == ReuseIngest::DefaultRingSize, bs == ReuseIngest::DefaultBlockSize and
+     * s == ReuseIngest::DefaultSampleRate
+     */
+    ReuseIngest(ReuseDistance* r, uint32_t p);
+
+    /**
+     * Destroys a ReuseIngest object. Any addresses still buffered by producers are analyzed
+     * before the analyzer thread is stopped, so all producing threads must be done producing by this point.
+     * The ReuseDistance passed to the constructor is not destroyed.
+     */
+    ~ReuseIngest();
+
+    /**
+     * Create a ReuseProducer for the calling thread. The ReuseProducer is owned by this ReuseIngest.
+     *
+     * @return A new ReuseProducer.
+     */
+    ReuseProducer* Register();
+
+    /**
+     * Wait until the analyzer thread has processed every block that has been handed to it.
+     *
+     * @return none
+     */
+    void Drain();
+
+    /**
+     * Get the total number of addresses that were discarded because the analyzer could not keep up.
+     *
+     * @return The number of discarded addresses.
+     */
+    uint64_t GetDropCount();
+
+    /**
+     * Get the total number of addresses that were processed by the analyzer thread.
+     *
+     * @return The number of processed addresses.
+     */
+    uint64_t GetProcessedCount();
+};
+
+#endif /* _ReuseIngest_hpp_ */
@@ -0,0 +1,119 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ReuseThreads.hpp>
+
+#include <assert.h>
+#include <stdlib.h>
+
+// each worker needs to know its own index as well as the pool
+struct WorkerArgs {
+    ReuseWorkerPool* pool;
+    uint32_t index;
+};
+
+ReuseWorkerPool::ReuseWorkerPool(uint32_t n)
+    : count(n), generation(0), remaining(0), stopping(false), job(NULL), jobarg(NULL)
+{
+    assert(count > 0 && "worker pool needs at least 1 thread");
+
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&start, NULL);
+    pthread_cond_init(&done, NULL);
+
+    threads = new pthread_t[count];
+    for (uint32_t i = 0; i < count; i++){
+        WorkerArgs* a = new WorkerArgs();
+        a->pool = this;
+        a->index = i;
+        int ret = pthread_create(&threads[i], NULL, ReuseWorkerPool::Work, a);
+        assert(ret == 0 && "unable to create worker thread");
+    }
+}
+
+ReuseWorkerPool::~ReuseWorkerPool(){
+    Wait();
+
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&start);
+    pthread_mutex_unlock(&lock);
+
+    for (uint32_t i = 0; i < count; i++){
+        pthread_join(threads[i], NULL);
+    }
+    delete[] threads;
+
+    pthread_cond_destroy(&done);
+    pthread_cond_destroy(&start);
+    pthread_mutex_destroy(&lock);
+}
+
+void* ReuseWorkerPool::Work(void* arg){
+    WorkerArgs* a = (WorkerArgs*)arg;
+    ReuseWorkerPool* pool = a->pool;
+    uint32_t index = a->index;
+    delete a;
+
+    uint64_t seen = 0;
+    while (true){
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stopping){
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stopping){
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        void (*fn)(void*, uint32_t) = pool->job;
+        void* fnarg = pool->jobarg;
+        pthread_mutex_unlock(&pool->lock);
+
+        fn(fnarg, index);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->remaining--;
+        if (pool->remaining == 0){
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+void ReuseWorkerPool::Start(void (*fn)(void* arg, uint32_t worker), void* arg){
+    pthread_mutex_lock(&lock);
+    assert(remaining == 0 && "only one job can run at a time");
+    job = fn;
+    jobarg = arg;
+    remaining = count;
+    generation++;
+    pthread_cond_broadcast(&start);
+    pthread_mutex_unlock(&lock);
+}
+
+void ReuseWorkerPool::Wait(){
+    pthread_mutex_lock(&lock);
+    while (remaining > 0){
+        pthread_cond_wait(&done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,100 @@
+/**
+ * @file
+ * @author Michael Laurenzano <michaell@sdsc.edu>
+ * @version 0.01
+ *
+ * @section LICENSE
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * ReuseWorkerPool is a small fork-join pool of persistent threads used internally
+ * by the analyzers that spread their work over several threads.
+ */
+
+#ifndef _ReuseThreads_hpp_
+#define _ReuseThreads_hpp_
+
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * @class ReuseWorkerPool
+ *
+ * A fixed set of worker threads which all run the same job each time Start is called.
+ * Only one job can be in flight at a time, and only one thread may call Start/Wait.
+ */
+class ReuseWorkerPool {
+private:
+    pthread_t* threads;
+    uint32_t count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    uint64_t generation;
+    uint32_t remaining;
+    bool stopping;
+
+    void (*job)(void* arg, uint32_t worker);
+    void* jobarg;
+
+    static void* Work(void* arg);
+
+public:
+
+    /**
+     * Constructs a ReuseWorkerPool and starts its threads.
+     *
+     * @param n  The number of worker threads. n > 0 is enforced at runtime.
+     */
+    ReuseWorkerPool(uint32_t n);
+
+    /**
+     * Destroys a ReuseWorkerPool, waiting for any job in flight and then stopping the threads.
+     */
+    ~ReuseWorkerPool();
+
+    /**
+     * Start running a job on every worker thread. Returns immediately.
+     *
+     * @param fn  The job. It is called once on each worker, with the worker's index in [0, GetSize()).
+     * @param arg  Passed to every call of fn.
+     *
+     * @return none
+     */
+    void Start(void (*fn)(void* arg, uint32_t worker), void* arg);
+
+    /**
+     * Wait for the job started by the last call to Start to finish on every worker.
+     *
+     * @return none
+     */
+    void Wait();
+
+    /**
+     * Get the number of worker threads.
+     *
+     * @return The number of worker threads.
+     */
+    uint32_t GetSize() { return count; }
+};
+
+#endif /* _ReuseThreads_hpp_ */
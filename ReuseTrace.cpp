@@ -0,0 +1,486 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <ReuseTrace.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+static inline bool IsSpace(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// find the next token in [p, e), moving p past it. commas also separate tokens if asked to
+static inline bool NextToken(const char*& p, const char* e, const char*& tb, const char*& te, bool commas){
+    while (p < e && (IsSpace(*p) || (commas && *p == ','))){
+        p++;
+    }
+    if (p == e){
+        return false;
+    }
+    tb = p;
+    while (p < e && !IsSpace(*p) && !(commas && *p == ',')){
+        p++;
+    }
+    te = p;
+    return true;
+}
+
+// a hex number of at most 16 digits, with or without a leading 0x
+static inline bool ParseHex(const char* b, const char* e, uint64_t& v){
+    if (e - b > 2 && b[0] == '0' && (b[1] == 'x' || b[1] == 'X')){
+        b += 2;
+    }
+    if (b == e || e - b > 16){
+        return false;
+    }
+    v = 0;
+    for (; b < e; b++){
+        char c = *b;
+        uint64_t d;
+        if (c >= '0' && c <= '9'){
+            d = c - '0';
+        } else if (c >= 'a' && c <= 'f'){
+            d = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F'){
+            d = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        v = (v << 4) | d;
+    }
+    return true;
+}
+
+static inline bool ParseDecimal(const char* b, const char* e, uint64_t& v){
+    if (b == e || e - b > 19){
+        return false;
+    }
+    v = 0;
+    for (; b < e; b++){
+        if (*b < '0' || *b > '9'){
+            return false;
+        }
+        v = v * 10 + (*b - '0');
+    }
+    return true;
+}
+
+ReuseTraceReader::ReuseTraceReader(const char* path){
+    if (strcmp(path, "-") == 0){
+        Init(0, false);
+    } else {
+        Init(open(path, O_RDONLY), true);
+    }
+}
+
+ReuseTraceReader::ReuseTraceReader(int f){
+    Init(f, false);
+}
+
+void ReuseTraceReader::Init(int f, bool o){
+    fd = f;
+    owned = o;
+
+    buffersize = BufferSize;
+    buffer = new char[buffersize];
+    start = 0;
+    end = 0;
+    eof = (fd < 0);
+
+    lines = 0;
+    records = 0;
+    periods = 0;
+}
+
+ReuseTraceReader::~ReuseTraceReader(){
+    if (owned && fd >= 0){
+        close(fd);
+    }
+    delete[] buffer;
+}
+
+bool ReuseTraceReader::IsOpen(){
+    return (fd >= 0);
+}
+
+// the next line of input, without its newline. a last line with no newline is still a line
+bool ReuseTraceReader::NextLine(const char** b, const char** e){
+    while (true){
+        char* nl = (char*)memchr(buffer + start, '\n', end - start);
+        if (nl){
+            *b = buffer + start;
+            *e = nl;
+            start = nl - buffer + 1;
+            return true;
+        }
+        if (eof){
+            if (start == end){
+                return false;
+            }
+            *b = buffer + start;
+            *e = buffer + end;
+            start = end;
+            return true;
+        }
+
+        // keep the partial line and fill the rest of the buffer
+        if (start){
+            memmove(buffer, buffer + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        if (end == buffersize){
+            char* bigger = new char[buffersize * 2];
+            memcpy(bigger, buffer, end);
+            delete[] buffer;
+            buffer = bigger;
+            buffersize *= 2;
+        }
+
+        ssize_t got = read(fd, buffer + end, buffersize - end);
+        if (got > 0){
+            end += got;
+        } else if (got == 0 || errno != EINTR){
+            eof = true;
+        }
+    }
+}
+
+uint64_t ReuseTraceReader::Read(ReuseEntry* entries, uint64_t count){
+    return Read(entries, NULL, count);
+}
+
+uint64_t ReuseTraceReader::Read(ReuseEntry* entries, ReuseAccess* accesses, uint64_t count){
+    uint64_t n = 0;
+    const char* b;
+    const char* e;
+    ReuseAccess scratch;
+    while (n < count && NextLine(&b, &e)){
+        lines++;
+        if (ParseLine(b, e, entries[n], accesses ? accesses[n] : scratch)){
+            records++;
+            n++;
+        }
+    }
+    return n;
+}
+
+uint64_t ReuseTraceReader::GetLineCount(){
+    return lines;
+}
+
+uint64_t ReuseTraceReader::GetRecordCount(){
+    return records;
+}
+
+uint64_t ReuseTraceReader::GetSkippedCount(){
+    return lines - records;
+}
+
+uint64_t ReuseTraceReader::GetPeriod(){
+    if (records == 0 || periods < records){
+        return 1;
+    }
+    return (periods + records / 2) / records;
+}
+
+PerfScriptReader::PerfScriptReader(const char* path, uint64_t p)
+    : ReuseTraceReader(path), period(p)
+{
+}
+
+PerfScriptReader::PerfScriptReader(int f, uint64_t p)
+    : ReuseTraceReader(f), period(p)
+{
+}
+
+// a timestamp is digits and dots, such as 1138.316131
+static inline bool IsTimestamp(const char* b, const char* e){
+    if (b == e){
+        return false;
+    }
+    for (; b < e; b++){
+        if ((*b < '0' || *b > '9') && *b != '.'){
+            return false;
+        }
+    }
+    return true;
+}
+
+// whether [b, e) contains the string w
+static inline bool Contains(const char* b, const char* e, const char* w){
+    uint64_t n = strlen(w);
+    for (; b + n <= e; b++){
+        if (memcmp(b, w, n) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PerfScriptReader::ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a){
+    const char* p = b;
+    const char* tb;
+    const char* te;
+
+    // find the event name, remembering the field before it
+    const char* pb = NULL;
+    const char* pe = NULL;
+    while (true){
+        if (!NextToken(p, e, tb, te, false) || *tb == '#'){
+            return false;
+        }
+        if (te[-1] == ':' && !IsTimestamp(tb, te - 1)){
+            break;
+        }
+        pb = tb;
+        pe = te;
+    }
+
+    uint64_t pd = period;
+    if (pd == 0 && (pb == NULL || !ParseDecimal(pb, pe, pd))){
+        return false;
+    }
+    a.type = Contains(tb, te, "store") ? AccessWrite : AccessRead;
+    a.size = 0;
+
+    uint64_t addr;
+    uint64_t ip;
+    if (!NextToken(p, e, tb, te, false) || !ParseHex(tb, te, addr)){
+        return false;
+    }
+    if (!NextToken(p, e, tb, te, false) || !ParseHex(tb, te, ip)){
+        return false;
+    }
+
+    r.id = ip;
+    r.address = addr;
+    periods += pd;
+    return true;
+}
+
+PerfRawReader::PerfRawReader(const char* path, uint64_t p)
+    : ReuseTraceReader(path), period(p), ipcolumn(2), addrcolumn(3), dsrccolumn(5)
+{
+    assert(period > 0);
+}
+
+PerfRawReader::PerfRawReader(int f, uint64_t p)
+    : ReuseTraceReader(f), period(p), ipcolumn(2), addrcolumn(3), dsrccolumn(5)
+{
+    assert(period > 0);
+}
+
+// the header is a comma-separated list of column names
+void PerfRawReader::ParseHeader(const char* b, const char* e){
+    uint32_t ip = 0xFFFFFFFF;
+    uint32_t addr = 0xFFFFFFFF;
+    uint32_t dsrc = 0xFFFFFFFF;
+    uint32_t col = 0;
+    while (b < e){
+        const char* c = (const char*)memchr(b, ',', e - b);
+        if (c == NULL){
+            c = e;
+        }
+
+        const char* nb = b;
+        const char* ne = c;
+        while (nb < ne && IsSpace(*nb)){
+            nb++;
+        }
+        while (ne > nb && IsSpace(ne[-1])){
+            ne--;
+        }
+        if (ne - nb == 2 && memcmp(nb, "IP", 2) == 0){
+            ip = col;
+        } else if (ne - nb == 4 && memcmp(nb, "ADDR", 4) == 0){
+            addr = col;
+        } else if (ne - nb == 4 && memcmp(nb, "DSRC", 4) == 0){
+            dsrc = col;
+        }
+
+        col++;
+        b = c + 1;
+    }
+
+    if (ip != 0xFFFFFFFF && addr != 0xFFFFFFFF){
+        ipcolumn = ip;
+        addrcolumn = addr;
+        dsrccolumn = dsrc;
+    }
+}
+
+// the operation is the low 5 bits of perf's data source, where 0x4 is a store
+#define PERF_MEM_OP_MASK (0x1F)
+#define PERF_MEM_OP_STORE (0x4)
+
+bool PerfRawReader::ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a){
+    const char* p = b;
+    while (p < e && IsSpace(*p)){
+        p++;
+    }
+    if (p < e && *p == '#'){
+        ParseHeader(p + 1, e);
+        return false;
+    }
+
+    const char* tb;
+    const char* te;
+    uint64_t ip = 0;
+    uint64_t addr = 0;
+    uint64_t dsrc = 0;
+    uint32_t needed = (dsrccolumn == 0xFFFFFFFF) ? 2 : 3;
+    uint32_t found = 0;
+    for (uint32_t col = 0; found < needed && NextToken(p, e, tb, te, true); col++){
+        if (col == ipcolumn){
+            if (!ParseHex(tb, te, ip)){
+                return false;
+            }
+            found++;
+        } else if (col == addrcolumn){
+            if (!ParseHex(tb, te, addr)){
+                return false;
+            }
+            found++;
+        } else if (col == dsrccolumn){
+            if (!ParseHex(tb, te, dsrc)){
+                dsrc = 0;
+            }
+            found++;
+        }
+    }
+    if (found < 2){
+        return false;
+    }
+
+    r.id = ip;
+    r.address = addr;
+    a.type = ((dsrc & PERF_MEM_OP_MASK) & PERF_MEM_OP_STORE) ? AccessWrite : AccessRead;
+    a.size = 0;
+    periods += period;
+    return true;
+}
+
+DineroReader::DineroReader(const char* path, uint32_t s)
+    : ReuseTraceReader(path), size(s)
+{
+}
+
+DineroReader::DineroReader(int f, uint32_t s)
+    : ReuseTraceReader(f), size(s)
+{
+}
+
+bool DineroReader::ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a){
+    const char* p = b;
+    const char* tb;
+    const char* te;
+
+    if (!NextToken(p, e, tb, te, false) || te - tb != 1 || *tb < '0' || *tb > '2'){
+        return false;
+    }
+    a.type = *tb - '0';
+
+    if (!NextToken(p, e, tb, te, false) || !ParseHex(tb, te, r.address)){
+        return false;
+    }
+
+    a.size = size;
+    if (NextToken(p, e, tb, te, false)){
+        uint64_t s;
+        if (!ParseDecimal(tb, te, s) || s > 0xFFFFFFFF){
+            return false;
+        }
+        a.size = s;
+    }
+
+    r.id = a.type;
+    periods++;
+    return true;
+}
+
+LackeyReader::LackeyReader(const char* path)
+    : ReuseTraceReader(path)
+{
+}
+
+LackeyReader::LackeyReader(int f)
+    : ReuseTraceReader(f)
+{
+}
+
+bool LackeyReader::ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a){
+    const char* p = b;
+    while (p < e && IsSpace(*p)){
+        p++;
+    }
+    if (e - p < 4 || !IsSpace(p[1])){
+        return false;
+    }
+
+    switch (*p){
+    case 'I':
+        a.type = AccessFetch;
+        break;
+    case 'L':
+        a.type = AccessRead;
+        break;
+    case 'S':
+        a.type = AccessWrite;
+        break;
+    case 'M':
+        a.type = AccessModify;
+        break;
+    default:
+        return false;
+    }
+    p++;
+    while (p < e && IsSpace(*p)){
+        p++;
+    }
+
+    const char* c = p;
+    while (c < e && *c != ','){
+        c++;
+    }
+    if (c == e || !ParseHex(p, c, r.address)){
+        return false;
+    }
+
+    const char* se = c + 1;
+    while (se < e && !IsSpace(*se)){
+        se++;
+    }
+    uint64_t s;
+    if (!ParseDecimal(c + 1, se, s) || s > 0xFFFFFFFF){
+        return false;
+    }
+    a.size = s;
+
+    r.id = a.type;
+    periods++;
+    return true;
+}
@@ -0,0 +1,332 @@
+/**
+ * @file
+ * @author Michael Laurenzano <michaell@sdsc.edu>
+ * @version 0.01
+ *
+ * @section LICENSE
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * The ReuseTraceReader classes turn text address traces into arrays of ReuseEntry
+ * which can be passed straight to ReuseDistance::Process. Input is read in large
+ * blocks and scanned by hand, so parsing is not the bottleneck of an analysis.
+ */
+
+#ifndef _ReuseTrace_hpp_
+#define _ReuseTrace_hpp_
+
+#include <ReuseDistance.hpp>
+
+/**
+ * @struct ReuseAccess
+ *
+ * What a trace says about an access besides its address, returned alongside each ReuseEntry.
+ *
+ * @field type  One of ReuseTraceReader::AccessRead, AccessWrite, AccessFetch or AccessModify.
+ * @field size  The size of the access in bytes, or 0 if the trace does not record it.
+ */
+struct ReuseAccess {
+    uint32_t type;
+    uint32_t size;
+};
+
+/**
+ * @class ReuseTraceReader
+ *
+ * The base of every trace reader. It reads its input a block at a time and hands each line
+ * to the format's ParseLine. Lines which do not hold an address (headers, comments and
+ * anything malformed) are counted and skipped.
+ */
+class ReuseTraceReader {
+private:
+    int fd;
+    bool owned;
+
+    // [start, end) of buffer holds input which has not been parsed yet
+    char* buffer;
+    uint64_t buffersize;
+    uint64_t start;
+    uint64_t end;
+    bool eof;
+
+    void Init(int f, bool o);
+    bool NextLine(const char** b, const char** e);
+
+protected:
+    uint64_t lines;
+    uint64_t records;
+
+    // the sum of the sampling periods of all records
+    uint64_t periods;
+
+    /**
+     * Parse a single line of input, which does not include its newline.
+     *
+     * @param b  The first character of the line.
+     * @param e  One past the last character of the line.
+     * @param r  Where to put the address and id found on the line.
+     * @param a  Where to put the type and size of the access.
+     *
+     * @return true if the line held an address, false if it should be skipped.
+     */
+    virtual bool ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a) = 0;
+
+public:
+
+    // access types, numbered as in the Dinero din format
+    static const uint32_t AccessRead = 0;
+    static const uint32_t AccessWrite = 1;
+    static const uint32_t AccessFetch = 2;
+
+    // a load and a store to the same address, such as a read-modify-write instruction
+    static const uint32_t AccessModify = 3;
+
+    // the size of the input buffer. it grows if a single line does not fit
+    static const uint64_t BufferSize = 1 << 20;
+
+    /**
+     * Constructs a ReuseTraceReader which reads a file.
+     *
+     * @param path  The file to read, or "-" for standard input.
+     */
+    ReuseTraceReader(const char* path);
+
+    /**
+     * Constructs a ReuseTraceReader which reads an open file descriptor, such as a pipe
+     * from another program. The descriptor is not closed by the reader.
+     *
+     * @param f  The file descriptor.
+     */
+    ReuseTraceReader(int f);
+
+    /**
+     * Destroys a ReuseTraceReader object.
+     */
+    virtual ~ReuseTraceReader();
+
+    /**
+     * Find out whether the input could be opened.
+     *
+     * @return true if the input is open.
+     */
+    bool IsOpen();
+
+    /**
+     * Read addresses from the input.
+     *
+     * @param entries  An array which receives the addresses.
+     * @param count  The number of elements in entries.
+     *
+     * @return The number of addresses put into entries. Less than count only at the end of the input.
+     */
+    uint64_t Read(ReuseEntry* entries, uint64_t count);
+
+    /**
+     * Read addresses from the input, along with the type and size of each access.
+     *
+     * @param entries  An array which receives the addresses.
+     * @param accesses  An array which receives the type and size of each address, or NULL.
+     * @param count  The number of elements in entries and accesses.
+     *
+     * @return The number of addresses put into entries. Less than count only at the end of the input.
+     */
+    uint64_t Read(ReuseEntry* entries, ReuseAccess* accesses, uint64_t count);
+
+    /**
+     * Get the number of lines read so far.
+     *
+     * @return The number of lines.
+     */
+    uint64_t GetLineCount();
+
+    /**
+     * Get the number of addresses read so far.
+     *
+     * @return The number of addresses.
+     */
+    uint64_t GetRecordCount();
+
+    /**
+     * Get the number of lines read so far which did not hold an address.
+     *
+     * @return The number of skipped lines.
+     */
+    uint64_t GetSkippedCount();
+
+    /**
+     * Get the mean number of accesses that each address read so far stands for. This is 1 for
+     * a complete trace and the mean sampling period for a sampled one, and can be passed to
+     * ReuseDistance::ScaleStats once the addresses have been processed.
+     *
+     * @return The mean sampling period, rounded to the nearest integer and at least 1.
+     */
+    uint64_t GetPeriod();
+};
+
+/**
+ * @class PerfScriptReader
+ *
+ * Reads the output of `perf script` for a `perf mem record` session. Each sample becomes a
+ * ReuseEntry whose id is the instruction address and whose address is the data address.
+ * The reader expects the fields printed by
+ *
+ *   perf script -F [comm,tid,pid,cpu,time,]period,event,addr,ip[,sym,symoff,dso]
+ *
+ * The event name (the first field ending in ':' that is not a timestamp) must be present. The
+ * period is the field just before it, and the data and instruction addresses are the two
+ * fields after it. The data_src and weight fields must not be requested, since they would
+ * come between the data and instruction addresses; use PerfRawReader for those. Lines with
+ * no event name, such as callchain frames, are skipped. Samples of an event whose name
+ * contains "store" are writes and all others are reads. perf does not record access sizes.
+ */
+class PerfScriptReader : public ReuseTraceReader {
+private:
+    uint64_t period;
+
+protected:
+    virtual bool ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a);
+
+public:
+
+    /**
+     * Constructs a PerfScriptReader object.
+     *
+     * @param path  The file to read, or "-" for standard input.
+     * @param p  The sampling period of every sample, for output that does not have the
+     * period field. 0 means that the period is read from each sample.
+     */
+    PerfScriptReader(const char* path, uint64_t p);
+
+    /**
+     * Constructs a PerfScriptReader object which reads an open file descriptor.
+     *
+     * @param f  The file descriptor, which is not closed by the reader.
+     * @param p  The sampling period of every sample, or 0 to read it from each sample.
+     */
+    PerfScriptReader(int f, uint64_t p);
+};
+
+/**
+ * @class PerfRawReader
+ *
+ * Reads the raw samples dumped by `perf mem report -D`. The header line
+ * ("# PID, TID, IP, ADDR, ...") gives the positions of the IP and ADDR columns; before
+ * any header is seen they are taken to be the third and fourth columns. Columns may be
+ * separated by white space or commas (`perf mem report -D -x ,`). The raw dump does not
+ * include the sampling period, so it is given to the constructor. A sample is a write if the
+ * operation in its DSRC column (the sixth column unless the header says otherwise) is a store,
+ * and a read otherwise.
+ */
+class PerfRawReader : public ReuseTraceReader {
+private:
+    uint64_t period;
+    uint32_t ipcolumn;
+    uint32_t addrcolumn;
+    uint32_t dsrccolumn;
+
+    void ParseHeader(const char* b, const char* e);
+
+protected:
+    virtual bool ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a);
+
+public:
+
+    /**
+     * Constructs a PerfRawReader object.
+     *
+     * @param path  The file to read, or "-" for standard input.
+     * @param p  The sampling period of every sample.
+     */
+    PerfRawReader(const char* path, uint64_t p);
+
+    /**
+     * Constructs a PerfRawReader object which reads an open file descriptor.
+     *
+     * @param f  The file descriptor, which is not closed by the reader.
+     * @param p  The sampling period of every sample.
+     */
+    PerfRawReader(int f, uint64_t p);
+};
+
+/**
+ * @class DineroReader
+ *
+ * Reads traces in the Dinero IV din format. Each line holds a label, a hex address and
+ * optionally a decimal size: label 0 is a read, 1 a write and 2 an instruction fetch. Lines
+ * with other labels (the escape records 3 and 4) are skipped. There are no instruction
+ * addresses in din traces, so the id of each ReuseEntry is its access type.
+ */
+class DineroReader : public ReuseTraceReader {
+private:
+    uint32_t size;
+
+protected:
+    virtual bool ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a);
+
+public:
+
+    /**
+     * Constructs a DineroReader object.
+     *
+     * @param path  The file to read, or "-" for standard input.
+     * @param s  The size of accesses whose line has no size.
+     */
+    DineroReader(const char* path, uint32_t s);
+
+    /**
+     * Constructs a DineroReader object which reads an open file descriptor.
+     *
+     * @param f  The file descriptor, which is not closed by the reader.
+     * @param s  The size of accesses whose line has no size.
+     */
+    DineroReader(int f, uint32_t s);
+};
+
+/**
+ * @class LackeyReader
+ *
+ * Reads the output of `valgrind --tool=lackey --trace-mem=yes`. Each access line is a type
+ * (I, L, S or M), a hex address, a comma and a decimal size, such as " L 04222cb0,8".
+ * Valgrind's own messages (lines starting with "==") are skipped. An M line becomes a
+ * single access of type AccessModify. As with DineroReader, the id of each ReuseEntry is
+ * its access type.
+ */
+class LackeyReader : public ReuseTraceReader {
+protected:
+    virtual bool ParseLine(const char* b, const char* e, ReuseEntry& r, ReuseAccess& a);
+
+public:
+
+    /**
+     * Constructs a LackeyReader object.
+     *
+     * @param path  The file to read, or "-" for standard input.
+     */
+    LackeyReader(const char* path);
+
+    /**
+     * Constructs a LackeyReader object which reads an open file descriptor.
+     *
+     * @param f  The file descriptor, which is not closed by the reader.
+     */
+    LackeyReader(int f);
+};
+
+#endif /* _ReuseTrace_hpp_ */
@@ -0,0 +1,862 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ReuseWindow.hpp>
+
+#include <immintrin.h>
+#include <string.h>
+
+using namespace std;
+
+//#define REUSE_DEBUG
+#ifdef REUSE_DEBUG
+#define debug_assert(...) assert(__VA_ARGS__)
+#else
+#define debug_assert(...)
+#endif
+
+// the number of set bits in words[0, n), plus those in tail
+static uint64_t PopcountScalar(const uint64_t* words, uint64_t n, uint64_t tail){
+    uint64_t sum = __builtin_popcountll(tail);
+    for (uint64_t i = 0; i < n; i++){
+        sum += __builtin_popcountll(words[i]);
+    }
+    return sum;
+}
+
+__attribute__((target("popcnt")))
+static uint64_t PopcountNative(const uint64_t* words, uint64_t n, uint64_t tail){
+    uint64_t sum = __builtin_popcountll(tail);
+    for (uint64_t i = 0; i < n; i++){
+        sum += __builtin_popcountll(words[i]);
+    }
+    return sum;
+}
+
+__attribute__((target("popcnt,avx512f,avx512vpopcntdq")))
+static uint64_t PopcountAVX512(const uint64_t* words, uint64_t n, uint64_t tail){
+    uint64_t sum = __builtin_popcountll(tail);
+    uint64_t i = 0;
+    if (n >= 8){
+        __m512i total = _mm512_setzero_si512();
+        for (; i + 8 <= n; i += 8){
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+        }
+        sum += _mm512_reduce_add_epi64(total);
+    }
+    for (; i < n; i++){
+        sum += __builtin_popcountll(words[i]);
+    }
+    return sum;
+}
+
+ReuseWindowBitmap::ReuseWindowBitmap(uint64_t c, uint32_t i)
+    : positions(i), size(0), mask(0), bits(NULL), groups(NULL), supers(NULL), addrs(NULL),
+      capacity(c), count(0), head(1), oldest(1)
+{
+    assert(capacity > 0 && capacity != ReuseDistance::Infinity);
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq")){
+        popcount = PopcountAVX512;
+    } else if (__builtin_cpu_supports("popcnt")){
+        popcount = PopcountNative;
+    } else {
+        popcount = PopcountScalar;
+    }
+}
+
+ReuseWindowBitmap::~ReuseWindowBitmap(){
+    if (bits){
+        delete[] bits;
+        delete[] groups;
+        delete[] supers;
+        delete[] addrs;
+    }
+}
+
+// the ring has at least twice as many slots as the window has addresses, so that it is
+// renumbered at most once every capacity accesses
+void ReuseWindowBitmap::Allocate(){
+    size = GroupSize;
+    while (size < 2 * capacity){
+        size <<= 1;
+    }
+    mask = size - 1;
+
+    uint64_t ngroups = size / GroupSize;
+    uint64_t nsupers = (size + SuperSize - 1) / SuperSize;
+
+    bits = new uint64_t[size / 64];
+    groups = new uint16_t[ngroups];
+    supers = new uint32_t[nsupers];
+    addrs = new uint64_t[size];
+
+    memset(bits, 0, size / 64 * sizeof(uint64_t));
+    memset(groups, 0, ngroups * sizeof(uint16_t));
+    memset(supers, 0, nsupers * sizeof(uint32_t));
+}
+
+inline void ReuseWindowBitmap::Set(uint64_t slot){
+    debug_assert((bits[slot >> 6] & (1UL << (slot & 63))) == 0);
+    bits[slot >> 6] |= 1UL << (slot & 63);
+    groups[slot / GroupSize]++;
+    supers[slot / SuperSize]++;
+}
+
+inline void ReuseWindowBitmap::Clear(uint64_t slot){
+    debug_assert(bits[slot >> 6] & (1UL << (slot & 63)));
+    bits[slot >> 6] &= ~(1UL << (slot & 63));
+    groups[slot / GroupSize]--;
+    supers[slot / SuperSize]--;
+}
+
+// the number of set bits in slots [0, slot)
+uint64_t ReuseWindowBitmap::Before(uint64_t slot){
+    uint64_t sum = 0;
+
+    uint64_t s = slot / SuperSize;
+    for (uint64_t i = 0; i < s; i++){
+        sum += supers[i];
+    }
+
+    uint64_t g = slot / GroupSize;
+    for (uint64_t i = s * (SuperSize / GroupSize); i < g; i++){
+        sum += groups[i];
+    }
+
+    uint64_t w = g * (GroupSize / 64);
+    uint64_t r = slot & 63;
+    uint64_t tail = r ? bits[slot >> 6] & ((1UL << r) - 1) : 0;
+    return sum + popcount(bits + w, (slot >> 6) - w, tail);
+}
+
+// the first position at or after p which is in use. there must be one before head, and p must
+// not be older than head - size, or a slot could be mistaken for an older position
+uint64_t ReuseWindowBitmap::NextLive(uint64_t p){
+    debug_assert(count > 0 && head - p <= size);
+    while (true){
+        uint64_t s = p & mask;
+        uint64_t w = bits[s >> 6] >> (s & 63);
+        if (w){
+            return p + __builtin_ctzll(w);
+        }
+        p += 64 - (s & 63);
+    }
+}
+
+// renumber the positions in use so that they end just before head, keeping their order
+void ReuseWindowBitmap::Compact(){
+    vector<uint64_t> live;
+    live.reserve(count);
+
+    uint64_t p = oldest;
+    if (head - p > size){
+        p = head - size;
+    }
+    for (uint64_t i = 0; i < count; i++){
+        p = NextLive(p);
+        live.push_back(addrs[p & mask]);
+        p++;
+    }
+
+    memset(bits, 0, size / 64 * sizeof(uint64_t));
+    memset(groups, 0, size / GroupSize * sizeof(uint16_t));
+    memset(supers, 0, (size + SuperSize - 1) / SuperSize * sizeof(uint32_t));
+
+    oldest = head - count;
+    for (uint64_t i = 0; i < count; i++){
+        uint64_t q = oldest + i;
+        Set(q & mask);
+        addrs[q & mask] = live[i];
+        positions.Put(live[i], q);
+    }
+}
+
+// the number of positions in use from p to the newest, wrapping around the ring
+uint64_t ReuseWindowBitmap::Distance(uint64_t p){
+    uint64_t result;
+    uint64_t sp = p & mask;
+    uint64_t sh = head & mask;
+    if (sp < sh){
+        result = Before(sh) - Before(sp);
+    } else {
+        result = count - (Before(sp) - Before(sh));
+    }
+    debug_assert(result > 0 && result <= count);
+    return result;
+}
+
+uint64_t ReuseWindowBitmap::Process(uint64_t addr){
+    if (bits == NULL){
+        Allocate();
+    }
+
+    uint64_t result = ReuseDistance::Infinity;
+
+    uint64_t p = positions.Get(addr);
+    if (p){
+        result = Distance(p);
+        Clear(p & mask);
+        count--;
+    }
+
+    Push(addr);
+    return result;
+}
+
+uint64_t ReuseWindowBitmap::Take(uint64_t addr){
+    if (bits == NULL){
+        return ReuseDistance::Infinity;
+    }
+
+    uint64_t p = positions.Get(addr);
+    if (p == 0){
+        return ReuseDistance::Infinity;
+    }
+
+    uint64_t result = Distance(p);
+    Clear(p & mask);
+    positions.Park(addr);
+    count--;
+    return result;
+}
+
+void ReuseWindowBitmap::Push(uint64_t addr){
+    if (bits == NULL){
+        Allocate();
+    }
+
+    if (count == capacity){
+        Evict();
+    }
+    count++;
+
+    if (bits[(head & mask) >> 6] & (1UL << (head & 63))){
+        // addr is not marked at the moment, so it is left out
+        count--;
+        Compact();
+        count++;
+    }
+
+    Set(head & mask);
+    addrs[head & mask] = addr;
+    positions.Put(addr, head);
+    head++;
+}
+
+void ReuseWindowBitmap::Evict(){
+    uint64_t lru = oldest;
+    if (head - lru > size){
+        lru = head - size;
+    }
+    lru = NextLive(lru);
+    Clear(lru & mask);
+    positions.Erase(addrs[lru & mask]);
+    oldest = lru + 1;
+    count--;
+}
+
+void ReuseWindowBitmap::Flush(){
+    if (count == 0){
+        return;
+    }
+
+    memset(bits, 0, size / 64 * sizeof(uint64_t));
+    memset(groups, 0, size / GroupSize * sizeof(uint16_t));
+    memset(supers, 0, (size + SuperSize - 1) / SuperSize * sizeof(uint32_t));
+    positions.Clear();
+
+    count = 0;
+    oldest = head;
+}
+
+bool ReuseWindowBitmap::Invalidate(uint64_t addr){
+    uint64_t p = positions.Get(addr);
+    if (p == 0){
+        // Take may have parked it
+        positions.Erase(addr);
+        return false;
+    }
+
+    Clear(p & mask);
+    positions.Erase(addr);
+    count--;
+    return true;
+}
+
+void ReuseWindowBitmap::GetActiveAddresses(vector<uint64_t>& addrs){
+    uint64_t p = oldest;
+    if (head - p > size){
+        p = head - size;
+    }
+    for (uint64_t i = 0; i < count; i++){
+        p = NextLive(p);
+        addrs.push_back(this->addrs[p & mask]);
+        p++;
+    }
+}
+
+void ReuseWindowBitmap::GetEngineStats(ReuseEngineStats& s){
+    s.windowsize = count;
+    s.treedepth = 0;
+    if (bits){
+        s.windowbytes = size / 64 * sizeof(uint64_t) + size / GroupSize * sizeof(uint16_t)
+            + (size + SuperSize - 1) / SuperSize * sizeof(uint32_t) + size * sizeof(uint64_t);
+        s.allocations += 4;
+    } else {
+        s.windowbytes = 0;
+    }
+    positions.GetEngineStats(s);
+}
+
+struct BTreeNode {
+    uint32_t n;
+    uint32_t leaf;
+
+    // sorted sequence numbers in a leaf. in an inner node, keys[i] is a lower bound on the sequence
+    // numbers under kids[i]. unused keys are BTreeEmpty, so whole arrays can be compared
+    uint64_t keys[BTREE_FANOUT];
+};
+
+struct BTreeLeaf : public BTreeNode {
+    uint64_t addrs[BTREE_FANOUT];
+};
+
+struct BTreeInner : public BTreeNode {
+    // the number of sequence numbers under each child
+    uint64_t counts[BTREE_FANOUT];
+    BTreeNode* kids[BTREE_FANOUT];
+};
+
+// greater than any sequence number, and still positive as a signed number
+static const uint64_t BTreeEmpty = 0x7FFFFFFFFFFFFFFFL;
+
+// the number of keys[0, BTREE_FANOUT) which are <= key
+static uint32_t CountAtMostScalar(const uint64_t* keys, uint64_t key){
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < BTREE_FANOUT; i++){
+        n += (keys[i] <= key);
+    }
+    return n;
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint32_t CountAtMostAVX2(const uint64_t* keys, uint64_t key){
+    __m256i k = _mm256_set1_epi64x(key);
+    uint32_t above = 0;
+    for (uint32_t i = 0; i < BTREE_FANOUT; i += 4){
+        __m256i gt = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i*)(keys + i)), k);
+        above += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(gt)));
+    }
+    return BTREE_FANOUT - above;
+}
+
+static BTreeLeaf* NewBTreeLeaf(){
+    BTreeLeaf* l = new BTreeLeaf();
+    l->n = 0;
+    l->leaf = 1;
+    for (uint32_t i = 0; i < BTREE_FANOUT; i++){
+        l->keys[i] = BTreeEmpty;
+    }
+    return l;
+}
+
+static BTreeInner* NewBTreeInner(){
+    BTreeInner* in = new BTreeInner();
+    in->n = 0;
+    in->leaf = 0;
+    for (uint32_t i = 0; i < BTREE_FANOUT; i++){
+        in->keys[i] = BTreeEmpty;
+    }
+    return in;
+}
+
+ReuseWindowBTree::ReuseWindowBTree(uint64_t c, uint32_t i)
+    : positions(i), root(NULL), height(0), leaves(0), inners(0), capacity(c), count(0), head(1)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        countatmost = CountAtMostAVX2;
+    } else {
+        countatmost = CountAtMostScalar;
+    }
+}
+
+ReuseWindowBTree::~ReuseWindowBTree(){
+    if (root){
+        Free(root, height);
+    }
+}
+
+void ReuseWindowBTree::Free(BTreeNode* node, uint32_t h){
+    if (h == 0){
+        delete (BTreeLeaf*)node;
+        leaves--;
+        return;
+    }
+    BTreeInner* in = (BTreeInner*)node;
+    for (uint32_t i = 0; i < in->n; i++){
+        Free(in->kids[i], h - 1);
+    }
+    delete in;
+    inners--;
+}
+
+// add the largest key so far to the rightmost leaf. if it is full, a new leaf is hung from the
+// lowest node on the rightmost path which has room, through a chain of new single-child nodes
+void ReuseWindowBTree::Append(uint64_t key, uint64_t addr){
+    if (root == NULL){
+        root = NewBTreeLeaf();
+        height = 0;
+        leaves++;
+    }
+
+    BTreeInner* path[BTREE_MAXDEPTH];
+    BTreeNode* node = root;
+    for (uint32_t h = height; h > 0; h--){
+        path[h] = (BTreeInner*)node;
+        node = path[h]->kids[path[h]->n - 1];
+    }
+
+    BTreeLeaf* leaf = (BTreeLeaf*)node;
+    if (leaf->n < BTREE_FANOUT){
+        leaf->keys[leaf->n] = key;
+        leaf->addrs[leaf->n] = addr;
+        leaf->n++;
+        for (uint32_t h = 1; h <= height; h++){
+            path[h]->counts[path[h]->n - 1]++;
+        }
+        return;
+    }
+
+    uint32_t top = 1;
+    while (top <= height && path[top]->n == BTREE_FANOUT){
+        top++;
+    }
+    if (top > height){
+        assert(height + 1 < BTREE_MAXDEPTH);
+        BTreeInner* r = NewBTreeInner();
+        inners++;
+        r->keys[0] = 0;
+        r->counts[0] = count;
+        r->kids[0] = root;
+        r->n = 1;
+        root = r;
+        height++;
+        path[height] = r;
+    }
+
+    BTreeLeaf* fresh = NewBTreeLeaf();
+    leaves++;
+    fresh->keys[0] = key;
+    fresh->addrs[0] = addr;
+    fresh->n = 1;
+
+    BTreeNode* below = fresh;
+    for (uint32_t h = 1; h < top; h++){
+        BTreeInner* in = NewBTreeInner();
+        inners++;
+        in->keys[0] = key;
+        in->counts[0] = 1;
+        in->kids[0] = below;
+        in->n = 1;
+        below = in;
+    }
+
+    BTreeInner* at = path[top];
+    at->keys[at->n] = key;
+    at->counts[at->n] = 1;
+    at->kids[at->n] = below;
+    at->n++;
+    for (uint32_t h = top + 1; h <= height; h++){
+        path[h]->counts[path[h]->n - 1]++;
+    }
+}
+
+// take a key out of the tree, unlinking any nodes that are left empty
+//
+// returns the number of keys smaller than key, and puts the address stored with it into addr
+uint64_t ReuseWindowBTree::Remove(uint64_t key, uint64_t* addr){
+    BTreeInner* path[BTREE_MAXDEPTH];
+    uint32_t slot[BTREE_MAXDEPTH];
+    uint64_t rank = 0;
+
+    BTreeNode* node = root;
+    for (uint32_t h = height; h > 0; h--){
+        BTreeInner* in = (BTreeInner*)node;
+        uint32_t c = countatmost(in->keys, key) - 1;
+        debug_assert(c < in->n);
+        for (uint32_t i = 0; i < c; i++){
+            rank += in->counts[i];
+        }
+        in->counts[c]--;
+        path[h] = in;
+        slot[h] = c;
+        node = in->kids[c];
+    }
+
+    BTreeLeaf* leaf = (BTreeLeaf*)node;
+    uint32_t p = countatmost(leaf->keys, key - 1);
+    debug_assert(p < leaf->n && leaf->keys[p] == key);
+    rank += p;
+    *addr = leaf->addrs[p];
+
+    leaf->n--;
+    memmove(leaf->keys + p, leaf->keys + p + 1, (leaf->n - p) * sizeof(uint64_t));
+    memmove(leaf->addrs + p, leaf->addrs + p + 1, (leaf->n - p) * sizeof(uint64_t));
+    leaf->keys[leaf->n] = BTreeEmpty;
+    if (leaf->n){
+        return rank;
+    }
+
+    delete leaf;
+    leaves--;
+    for (uint32_t h = 1; h <= height; h++){
+        BTreeInner* in = path[h];
+        uint32_t c = slot[h];
+        in->n--;
+        memmove(in->keys + c, in->keys + c + 1, (in->n - c) * sizeof(uint64_t));
+        memmove(in->counts + c, in->counts + c + 1, (in->n - c) * sizeof(uint64_t));
+        memmove(in->kids + c, in->kids + c + 1, (in->n - c) * sizeof(BTreeNode*));
+        in->keys[in->n] = BTreeEmpty;
+        if (in->n){
+            return rank;
+        }
+        delete in;
+        inners--;
+    }
+    root = NULL;
+    height = 0;
+    return rank;
+}
+
+// lay the window out again in full leaves, once its leaves are on average less than a quarter full
+void ReuseWindowBTree::Rebuild(){
+    vector<uint64_t> addrs;
+    addrs.reserve(count);
+    GetActiveAddresses(addrs);
+
+    vector<uint64_t> keys;
+    keys.reserve(count);
+    for (uint64_t i = 0; i < addrs.size(); i++){
+        keys.push_back(positions.Get(addrs[i]));
+    }
+
+    Free(root, height);
+    root = NULL;
+    height = 0;
+
+    uint64_t n = count;
+    count = 0;
+    for (uint64_t i = 0; i < n; i++){
+        Append(keys[i], addrs[i]);
+        count++;
+    }
+}
+
+uint64_t ReuseWindowBTree::Process(uint64_t addr){
+    uint64_t result = ReuseDistance::Infinity;
+
+    uint64_t p = positions.Get(addr);
+    if (p){
+        uint64_t a;
+        result = count - Remove(p, &a);
+        debug_assert(a == addr && result > 0 && result <= count);
+        count--;
+    }
+
+    Push(addr);
+    return result;
+}
+
+uint64_t ReuseWindowBTree::Take(uint64_t addr){
+    uint64_t p = positions.Get(addr);
+    if (p == 0){
+        return ReuseDistance::Infinity;
+    }
+
+    uint64_t a;
+    uint64_t result = count - Remove(p, &a);
+    debug_assert(a == addr && result > 0 && result <= count);
+    positions.Park(addr);
+    count--;
+
+    if (leaves > 4 * (count / BTREE_FANOUT) + 4){
+        Rebuild();
+    }
+    return result;
+}
+
+void ReuseWindowBTree::Push(uint64_t addr){
+    if (capacity != ReuseDistance::Infinity && count == capacity){
+        Evict();
+    }
+
+    Append(head, addr);
+    positions.Put(addr, head);
+    head++;
+    count++;
+
+    if (leaves > 4 * (count / BTREE_FANOUT) + 4){
+        Rebuild();
+    }
+}
+
+// the least recently used address is first in the leftmost leaf
+void ReuseWindowBTree::Evict(){
+    BTreeNode* node = root;
+    for (uint32_t h = height; h > 0; h--){
+        node = ((BTreeInner*)node)->kids[0];
+    }
+    uint64_t a;
+    Remove(node->keys[0], &a);
+    positions.Erase(a);
+    count--;
+}
+
+void ReuseWindowBTree::Flush(){
+    if (root){
+        Free(root, height);
+    }
+    root = NULL;
+    height = 0;
+    positions.Clear();
+    count = 0;
+}
+
+bool ReuseWindowBTree::Invalidate(uint64_t addr){
+    uint64_t p = positions.Get(addr);
+    if (p == 0){
+        // Take may have parked it
+        positions.Erase(addr);
+        return false;
+    }
+
+    uint64_t a;
+    Remove(p, &a);
+    positions.Erase(addr);
+    count--;
+
+    if (leaves > 4 * (count / BTREE_FANOUT) + 4){
+        Rebuild();
+    }
+    return true;
+}
+
+static void WalkBTree(BTreeNode* node, uint32_t h, vector<uint64_t>& addrs){
+    if (h == 0){
+        BTreeLeaf* leaf = (BTreeLeaf*)node;
+        addrs.insert(addrs.end(), leaf->addrs, leaf->addrs + leaf->n);
+        return;
+    }
+    BTreeInner* in = (BTreeInner*)node;
+    for (uint32_t i = 0; i < in->n; i++){
+        WalkBTree(in->kids[i], h - 1, addrs);
+    }
+}
+
+void ReuseWindowBTree::GetActiveAddresses(vector<uint64_t>& addrs){
+    if (root){
+        WalkBTree(root, height, addrs);
+    }
+}
+
+void ReuseWindowBTree::GetEngineStats(ReuseEngineStats& s){
+    s.windowsize = count;
+    s.treedepth = root ? height + 1 : 0;
+    s.windowbytes = leaves * sizeof(BTreeLeaf) + inners * sizeof(BTreeInner);
+    s.allocations += leaves + inners;
+    positions.GetEngineStats(s);
+}
+
+// a bit for each of addrs[0, FrontSize) which is equal to addr
+static uint32_t FindFrontScalar(const uint64_t* addrs, uint64_t addr){
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < ReuseWindowFront::FrontSize; i++){
+        found |= (uint32_t)(addrs[i] == addr) << i;
+    }
+    return found;
+}
+
+__attribute__((target("avx2")))
+static uint32_t FindFrontAVX2(const uint64_t* addrs, uint64_t addr){
+    __m256i a = _mm256_set1_epi64x(addr);
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < ReuseWindowFront::FrontSize; i += 4){
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(addrs + i)), a);
+        found |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+    }
+    return found;
+}
+
+ReuseWindowFront::ReuseWindowFront(ReuseWindow* b, uint64_t c)
+    : n(0), back(b), capacity(c), count(0), direct(false), accesses(0), shorts(0)
+{
+    assert(capacity == ReuseDistance::Infinity || capacity > FrontSize);
+    memset(front, 0, sizeof(front));
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        findfront = FindFrontAVX2;
+    } else {
+        findfront = FindFrontScalar;
+    }
+}
+
+ReuseWindowFront::~ReuseWindowFront(){
+    delete back;
+}
+
+// the place of addr in front, or FrontSize if it is not there. slots past n may hold anything
+inline uint32_t ReuseWindowFront::Find(uint64_t addr){
+    uint32_t found = findfront(front, addr) & ((1U << n) - 1);
+    if (found == 0){
+        return FrontSize;
+    }
+    return __builtin_ctz(found);
+}
+
+// move addr from front[i] to front[0]
+inline void ReuseWindowFront::Promote(uint64_t addr, uint32_t i){
+    memmove(front + 1, front, i * sizeof(uint64_t));
+    front[0] = addr;
+}
+
+// Take for an address which is not in front
+inline uint64_t ReuseWindowFront::TakeBack(uint64_t addr){
+    uint64_t result = back->Take(addr);
+    if (result != ReuseDistance::Infinity){
+        result += n;
+        count--;
+    }
+    return result;
+}
+
+// turn the front on or off for the next interval. the front is emptied least recently used first,
+// which leaves back with the whole window
+void ReuseWindowFront::Adapt(){
+    bool want = (shorts * FrontShare < accesses);
+    if (want && !direct){
+        for (uint32_t i = n; i > 0; i--){
+            back->Push(front[i - 1]);
+        }
+        n = 0;
+    }
+    direct = want;
+    accesses = 0;
+    shorts = 0;
+}
+
+uint64_t ReuseWindowFront::Process(uint64_t addr){
+    uint64_t result;
+    if (direct){
+        result = back->Process(addr);
+        if (result == ReuseDistance::Infinity && (capacity == ReuseDistance::Infinity || count < capacity)){
+            count++;
+        }
+    } else if (n && front[0] == addr){
+        // runs of the same address never get past this
+        result = 1;
+    } else {
+        uint32_t i = Find(addr);
+        if (i < FrontSize){
+            Promote(addr, i);
+            result = i + 1;
+        } else {
+            result = TakeBack(addr);
+            Push(addr);
+        }
+    }
+
+    if (result != ReuseDistance::Infinity && result <= FrontSize){
+        shorts++;
+    }
+    if (++accesses == AdaptInterval){
+        Adapt();
+    }
+    return result;
+}
+
+uint64_t ReuseWindowFront::Take(uint64_t addr){
+    uint32_t i = Find(addr);
+    if (i < FrontSize){
+        n--;
+        memmove(front + i, front + i + 1, (n - i) * sizeof(uint64_t));
+        count--;
+        return i + 1;
+    }
+    return TakeBack(addr);
+}
+
+// back only receives addresses from front while there is room for them, so it never evicts on its own
+void ReuseWindowFront::Push(uint64_t addr){
+    if (capacity != ReuseDistance::Infinity && count == capacity){
+        Evict();
+    }
+    count++;
+
+    if (direct){
+        back->Push(addr);
+        return;
+    }
+    if (n == FrontSize){
+        back->Push(front[FrontSize - 1]);
+        n--;
+    }
+    Promote(addr, n);
+    n++;
+}
+
+void ReuseWindowFront::Evict(){
+    if (count > n){
+        back->Evict();
+    } else {
+        n--;
+    }
+    count--;
+}
+
+void ReuseWindowFront::Flush(){
+    n = 0;
+    count = 0;
+    back->Flush();
+}
+
+bool ReuseWindowFront::Invalidate(uint64_t addr){
+    uint64_t d = Take(addr);
+
+    // drop the index entry which Take may have left in back
+    back->Invalidate(addr);
+    return d != ReuseDistance::Infinity;
+}
+
+void ReuseWindowFront::GetActiveAddresses(vector<uint64_t>& addrs){
+    back->GetActiveAddresses(addrs);
+    for (uint32_t i = n; i > 0; i--){
+        addrs.push_back(front[i - 1]);
+    }
+}
+
+void ReuseWindowFront::GetEngineStats(ReuseEngineStats& s){
+    back->GetEngineStats(s);
+    s.windowsize += n;
+    s.windowbytes += sizeof(front);
+}
@@ -0,0 +1,303 @@
+/**
+ * @file
+ * @author Michael Laurenzano <michaell@sdsc.edu>
+ * @version 0.01
+ *
+ * @section LICENSE
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Alternative LRU windows used internally by ReuseDistance. Each keeps the most recently
+ * used distinct addresses of a stream and finds how far down the LRU stack an address is.
+ */
+
+#ifndef _ReuseWindow_hpp_
+#define _ReuseWindow_hpp_
+
+#include <ReuseDistance.hpp>
+#include <ReuseIndex.hpp>
+
+/**
+ * @class ReuseWindow
+ *
+ * Holds up to capacity distinct addresses, ordered by their latest access.
+ */
+class ReuseWindow {
+public:
+    virtual ~ReuseWindow() {}
+
+    /**
+     * Find the reuse distance of an address, then move it to the top of the window, dropping
+     * the least recently used address if the window is full.
+     *
+     * @param addr  The address.
+     *
+     * @return The number of distinct addresses accessed since the last access to addr,
+     * including addr itself, or ReuseDistance::Infinity if addr is not in the window.
+     */
+    virtual uint64_t Process(uint64_t addr) = 0;
+
+    /**
+     * Find the reuse distance of an address and remove it from the window.
+     *
+     * @param addr  The address.
+     *
+     * @return The same as Process(addr), but addr is no longer in the window afterwards. The
+     * address index may keep an empty entry for it (see ReuseIndex::Park) until it is pushed
+     * again or invalidated.
+     */
+    virtual uint64_t Take(uint64_t addr) = 0;
+
+    /**
+     * Put an address on top of the window, dropping the least recently used address if the
+     * window is full.
+     *
+     * @param addr  The address, which must not be in the window.
+     */
+    virtual void Push(uint64_t addr) = 0;
+
+    /**
+     * Remove the least recently used address from the window, which must not be empty.
+     */
+    virtual void Evict() = 0;
+
+    /**
+     * Remove every address from the window.
+     */
+    virtual void Flush() = 0;
+
+    /**
+     * Remove an address from the window.
+     *
+     * @return true if the address was in the window.
+     */
+    virtual bool Invalidate(uint64_t addr) = 0;
+
+    /**
+     * Get the addresses in the window, least recently used first.
+     */
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs) = 0;
+
+    /**
+     * Fill in the windowsize, treedepth, hash and window fields of s, and add to its allocations.
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s) = 0;
+};
+
+/**
+ * @class ReuseWindowBitmap
+ *
+ * A window for small capacities. The latest access to each address in the window is given a
+ * position, and a ring of bits over the most recent positions marks which of them are still
+ * the latest access to their address. The reuse distance of an address is the number of marked
+ * positions from its own to the newest, which is found with popcounts over a few words plus
+ * per-group and per-supergroup counts. When the ring runs into a marked position, the marked
+ * positions are renumbered so that they are adjacent. Nothing is allocated until the first
+ * address is processed.
+ */
+class ReuseWindowBitmap : public ReuseWindow {
+private:
+    // [address -> position of its latest access]. positions start at 1
+    ReuseIndex positions;
+
+    // the ring has size positions, a power of 2. position p is at slot p & mask
+    uint64_t size;
+    uint64_t mask;
+
+    // 1 bit per slot, the number of set bits in each group of slots and in each supergroup
+    uint64_t* bits;
+    uint16_t* groups;
+    uint32_t* supers;
+
+    // the address whose latest access is at each slot
+    uint64_t* addrs;
+
+    uint64_t capacity;
+    uint64_t count;
+
+    // the next position to give out, and a position no later than the oldest one in use
+    uint64_t head;
+    uint64_t oldest;
+
+    uint64_t (*popcount)(const uint64_t* words, uint64_t n, uint64_t tail);
+
+    void Allocate();
+    void Set(uint64_t slot);
+    void Clear(uint64_t slot);
+    uint64_t Before(uint64_t slot);
+    uint64_t NextLive(uint64_t p);
+    void Compact();
+    uint64_t Distance(uint64_t p);
+
+public:
+
+    // the number of slots counted by each entry of groups and supers
+    static const uint64_t GroupSize = 1024;
+    static const uint64_t SuperSize = 16384;
+
+    /**
+     * @param c  The capacity of the window.
+     * @param i  The address index, ReuseDistance::IndexHash or ReuseDistance::IndexPageTable.
+     */
+    ReuseWindowBitmap(uint64_t c, uint32_t i);
+    virtual ~ReuseWindowBitmap();
+
+    virtual uint64_t Process(uint64_t addr);
+    virtual uint64_t Take(uint64_t addr);
+    virtual void Push(uint64_t addr);
+    virtual void Evict();
+    virtual void Flush();
+    virtual bool Invalidate(uint64_t addr);
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+    virtual void GetEngineStats(ReuseEngineStats& s);
+};
+
+// the number of keys in a leaf and children in an inner node of a ReuseWindowBTree
+#define BTREE_FANOUT (32)
+
+// the greatest depth of a ReuseWindowBTree, which would take more than 32^15 leaves to reach
+#define BTREE_MAXDEPTH (16)
+
+struct BTreeNode;
+struct BTreeLeaf;
+struct BTreeInner;
+
+/**
+ * @class ReuseWindowBTree
+ *
+ * A window for any capacity, including unlimited ones. Each address in the window is kept under
+ * the sequence number of its latest access in a counted B+-tree with BTREE_FANOUT keys per node,
+ * so a node covers a few cache lines rather than the three keys of a tree234 node. Inner nodes
+ * keep the number of addresses under each child next to its key, and the child to follow is
+ * found by comparing the whole key array at once. New sequence numbers are always the largest,
+ * so they are only ever appended to the rightmost leaf and nodes never need to be split. Leaves
+ * which are emptied are unlinked, and the tree is rebuilt when its leaves become mostly empty.
+ */
+class ReuseWindowBTree : public ReuseWindow {
+private:
+    // [address -> sequence number of its latest access]. sequence numbers start at 1
+    ReuseIndex positions;
+
+    // NULL when the window is empty. height is the number of inner levels above the leaves
+    BTreeNode* root;
+    uint32_t height;
+
+    uint64_t leaves;
+    uint64_t inners;
+
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t head;
+
+    uint32_t (*countatmost)(const uint64_t* keys, uint64_t key);
+
+    void Append(uint64_t key, uint64_t addr);
+    uint64_t Remove(uint64_t key, uint64_t* addr);
+    void Free(BTreeNode* node, uint32_t h);
+    void Rebuild();
+
+public:
+
+    /**
+     * @param c  The capacity of the window, or ReuseDistance::Infinity.
+     * @param i  The address index, ReuseDistance::IndexHash or ReuseDistance::IndexPageTable.
+     */
+    ReuseWindowBTree(uint64_t c, uint32_t i);
+    virtual ~ReuseWindowBTree();
+
+    virtual uint64_t Process(uint64_t addr);
+    virtual uint64_t Take(uint64_t addr);
+    virtual void Push(uint64_t addr);
+    virtual void Evict();
+    virtual void Flush();
+    virtual bool Invalidate(uint64_t addr);
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+    virtual void GetEngineStats(ReuseEngineStats& s);
+};
+
+/**
+ * @class ReuseWindowFront
+ *
+ * Sits in front of another window and keeps the FrontSize most recently used addresses itself,
+ * most recent first, in a small array. An address found in the array is at a distance of its
+ * place in the array, and only the array is reordered, so the window behind it is not touched at
+ * all. The array is searched with one vector compare per 4 addresses. The window behind holds the
+ * rest of the LRU stack, and only sees an address when it falls off the end of the array (Push)
+ * or is used again from below it (Take). Distances are the same as those of a single window.
+ *
+ * When fewer than 1 in FrontShare distances in an interval of AdaptInterval accesses are
+ * FrontSize or less, the array is emptied into the window behind, which is then used directly
+ * until short distances are common again.
+ */
+class ReuseWindowFront : public ReuseWindow {
+public:
+
+    // the number of addresses kept in front
+    static const uint32_t FrontSize = 16;
+
+    // how often, in accesses, the front is turned on or off, and the share of short distances
+    // needed to keep it on
+    static const uint64_t AdaptInterval = 1024;
+    static const uint64_t FrontShare = 2;
+
+private:
+    // the top n addresses of the LRU stack, most recent first
+    uint64_t front[FrontSize];
+    uint32_t n;
+
+    // the rest of the stack. count is the number of addresses in front and back together
+    ReuseWindow* back;
+    uint64_t capacity;
+    uint64_t count;
+
+    // front is empty and unused while direct is set
+    bool direct;
+    uint64_t accesses;
+    uint64_t shorts;
+
+    // a bit for each of front[0, FrontSize) which is equal to addr
+    uint32_t (*findfront)(const uint64_t* addrs, uint64_t addr);
+
+    uint32_t Find(uint64_t addr);
+    void Promote(uint64_t addr, uint32_t i);
+    uint64_t TakeBack(uint64_t addr);
+    void Adapt();
+
+public:
+
+    /**
+     * @param b  The empty window to put behind the front. It is deleted along with the ReuseWindowFront.
+     * @param c  The capacity of b, which is also the capacity of the whole window. It is either
+     * greater than FrontSize or ReuseDistance::Infinity.
+     */
+    ReuseWindowFront(ReuseWindow* b, uint64_t c);
+    virtual ~ReuseWindowFront();
+
+    virtual uint64_t Process(uint64_t addr);
+    virtual uint64_t Take(uint64_t addr);
+    virtual void Push(uint64_t addr);
+    virtual void Evict();
+    virtual void Flush();
+    virtual bool Invalidate(uint64_t addr);
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+    virtual void GetEngineStats(ReuseEngineStats& s);
+};
+
+#endif /* _ReuseWindow_hpp_ */
@@ -0,0 +1,894 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <SpatialWindow.hpp>
+
+#include <immintrin.h>
+#include <string.h>
+
+using namespace std;
+
+//#define REUSE_DEBUG
+#ifdef REUSE_DEBUG
+#define debug_assert(...) assert(__VA_ARGS__)
+#else
+#define debug_assert(...)
+#endif
+
+inline uint64_t uint64abs(uint64_t a){
+    if (a < 0x8000000000000000L){
+        return a;
+    } else {
+        return 0 - a;
+    }
+}
+
+uint64_t SpatialWindowMap::Process(uint64_t addr){
+    // find the address closest to addr
+    uint64_t bestdiff = INVALID_SPATIAL;
+
+    if (awindow.size() > 0){
+
+        map<uint64_t, uint64_t>::const_iterator it = awindow.upper_bound(addr);
+        if (it == awindow.end()){
+            it--;
+        }
+
+        // only need to check the values immediately equal, >, and < than addr
+        for (uint32_t i = 0; i < 3; i++, it--){
+            uint64_t cur = it->first;
+            uint64_t diff = uint64abs(cur - addr);
+
+            if (diff < bestdiff){
+                bestdiff = diff;
+            }
+
+            if (it == awindow.begin()){
+                break;
+            }
+        }
+    }
+
+    // remove the oldest address in the window
+    if (swindow.size() >= size){
+        uint64_t a = swindow.front();
+        swindow.pop_front();
+
+        uint64_t v = awindow[a];
+        if (v > 1){
+            awindow[a] = v - 1;
+        } else {
+            awindow.erase(a);
+        }
+    }
+
+    // insert the newest address into the window
+    awindow[addr]++;
+    swindow.push_back(addr);
+
+    return bestdiff;
+}
+
+void SpatialWindowMap::Flush(){
+    awindow.clear();
+    swindow.clear();
+}
+
+void SpatialWindowMap::Invalidate(uint64_t addr){
+    if (awindow.count(addr) == 0){
+        return;
+    }
+    awindow.erase(addr);
+    swindow.remove(addr);
+}
+
+void SpatialWindowMap::GetActiveAddresses(vector<uint64_t>& addrs){
+    for (map<uint64_t, uint64_t>::const_iterator it = awindow.begin(); it != awindow.end(); it++){
+        addrs.push_back(it->first);
+    }
+}
+
+void SpatialWindowMap::GetEngineStats(ReuseEngineStats& s){
+    s.windowsize = swindow.size();
+
+    // std::map doesn't expose its shape, so this is the depth of a perfectly balanced tree
+    s.treedepth = 0;
+    for (uint64_t n = awindow.size(); n; n >>= 1){
+        s.treedepth++;
+    }
+
+    // a map node has 3 pointers and a color, a list node has 2 pointers
+    s.allocations += awindow.size() + swindow.size();
+    s.windowbytes = awindow.size() * (sizeof(pair<const uint64_t, uint64_t>) + 4 * sizeof(void*))
+        + swindow.size() * (sizeof(uint64_t) + 2 * sizeof(void*));
+}
+
+static uint64_t ScanScalar(const uint64_t* ring, uint64_t count, uint64_t addr){
+    uint64_t best = INVALID_SPATIAL;
+    for (uint64_t i = 0; i < count; i++){
+        uint64_t diff = uint64abs(ring[i] - addr);
+        if (diff < best){
+            best = diff;
+        }
+    }
+    return best;
+}
+
+// |a - addr| is the absolute value of the signed difference, and the minimum is unsigned. AVX2
+// has neither a 64-bit abs nor an unsigned 64-bit min, so both are built from signed compares
+__attribute__((target("avx2")))
+static uint64_t ScanAVX2(const uint64_t* ring, uint64_t count, uint64_t addr){
+    const __m256i x = _mm256_set1_epi64x(addr);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set1_epi64x(0x8000000000000000L);
+    __m256i best = _mm256_set1_epi64x(INVALID_SPATIAL);
+
+    uint64_t i = 0;
+    for (; i + 4 <= count; i += 4){
+        __m256i d = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i*)(ring + i)), x);
+        __m256i s = _mm256_cmpgt_epi64(zero, d);
+        d = _mm256_sub_epi64(_mm256_xor_si256(d, s), s);
+
+        __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(best, bias), _mm256_xor_si256(d, bias));
+        best = _mm256_blendv_epi8(best, d, gt);
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, best);
+    uint64_t b = ScanScalar(ring + i, count - i, addr);
+    for (uint32_t j = 0; j < 4; j++){
+        if (lanes[j] < b){
+            b = lanes[j];
+        }
+    }
+    return b;
+}
+
+__attribute__((target("avx512f")))
+static uint64_t ScanAVX512(const uint64_t* ring, uint64_t count, uint64_t addr){
+    const __m512i x = _mm512_set1_epi64(addr);
+    __m512i best = _mm512_set1_epi64(INVALID_SPATIAL);
+
+    uint64_t i = 0;
+    for (; i + 8 <= count; i += 8){
+        __m512i d = _mm512_sub_epi64(_mm512_loadu_si512((const void*)(ring + i)), x);
+        best = _mm512_min_epu64(best, _mm512_abs_epi64(d));
+    }
+
+    uint64_t b = _mm512_reduce_min_epu64(best);
+    uint64_t t = ScanScalar(ring + i, count - i, addr);
+    return t < b ? t : b;
+}
+
+SpatialWindowScan::SpatialWindowScan(uint64_t s)
+    : size(s), count(0), head(0)
+{
+    assert(size > 0);
+    ring = new uint64_t[size];
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")){
+        scan = ScanAVX512;
+    } else if (__builtin_cpu_supports("avx2")){
+        scan = ScanAVX2;
+    } else {
+        scan = ScanScalar;
+    }
+}
+
+SpatialWindowScan::~SpatialWindowScan(){
+    delete[] ring;
+}
+
+uint64_t SpatialWindowScan::Process(uint64_t addr){
+    uint64_t best = scan(ring, count, addr);
+
+    // the ring fills up in order, after which head is the oldest address
+    if (count < size){
+        ring[count++] = addr;
+    } else {
+        ring[head] = addr;
+        head = (head + 1 == size) ? 0 : head + 1;
+    }
+
+    return best;
+}
+
+void SpatialWindowScan::Flush(){
+    count = 0;
+    head = 0;
+}
+
+void SpatialWindowScan::Invalidate(uint64_t addr){
+    if (find(ring, ring + count, addr) == ring + count){
+        return;
+    }
+
+    // put the ring in oldest-first order and close the gaps left by addr, so that eviction order is preserved
+    rotate(ring, ring + head, ring + count);
+    count = remove(ring, ring + count, addr) - ring;
+    head = 0;
+}
+
+void SpatialWindowScan::GetActiveAddresses(vector<uint64_t>& addrs){
+    vector<uint64_t> a(ring, ring + count);
+    sort(a.begin(), a.end());
+    a.erase(unique(a.begin(), a.end()), a.end());
+    addrs.insert(addrs.end(), a.begin(), a.end());
+}
+
+void SpatialWindowScan::GetEngineStats(ReuseEngineStats& s){
+    s.windowsize = count;
+    s.treedepth = 0;
+    s.allocations += 1;
+    s.windowbytes = size * sizeof(uint64_t);
+}
+
+struct BlockedNode {
+    uint32_t n;
+    uint32_t leaf;
+
+    // sorted addresses in a leaf. in an inner node, keys[i] is a lower bound on the addresses
+    // under kids[i], and keys[0] is only meaningful once the node is split or merged
+    uint64_t keys[BLOCKED_FANOUT];
+};
+
+struct BlockedLeaf : public BlockedNode {
+    uint32_t counts[BLOCKED_FANOUT];
+
+    // the position of the latest access to each address
+    uint32_t latest[BLOCKED_FANOUT];
+    BlockedLeaf* prev;
+    BlockedLeaf* next;
+};
+
+struct BlockedInner : public BlockedNode {
+    BlockedNode* kids[BLOCKED_FANOUT];
+};
+
+static BlockedLeaf* NewLeaf(){
+    BlockedLeaf* l = new BlockedLeaf();
+    l->n = 0;
+    l->leaf = 1;
+    l->prev = NULL;
+    l->next = NULL;
+    return l;
+}
+
+static BlockedInner* NewInner(){
+    BlockedInner* in = new BlockedInner();
+    in->n = 0;
+    in->leaf = 0;
+    return in;
+}
+
+static void DeleteNode(BlockedNode* node){
+    if (node->leaf){
+        delete (BlockedLeaf*)node;
+    } else {
+        delete (BlockedInner*)node;
+    }
+}
+
+// nodes are small enough that a full pass over the keys, which the compiler can vectorize and
+// which walks adjacent cache lines, beats a binary search
+static inline uint32_t CountNotAbove(const uint64_t* keys, uint32_t n, uint64_t addr){
+    uint32_t c = 0;
+    for (uint32_t i = 0; i < n; i++){
+        c += (keys[i] <= addr);
+    }
+    return c;
+}
+
+static inline uint32_t CountBelow(const uint64_t* keys, uint32_t n, uint64_t addr){
+    uint32_t c = 0;
+    for (uint32_t i = 0; i < n; i++){
+        c += (keys[i] < addr);
+    }
+    return c;
+}
+
+// the last child whose lower bound is not greater than addr
+static inline uint32_t ChildIndex(BlockedInner* in, uint64_t addr){
+    return CountNotAbove(in->keys + 1, in->n - 1, addr);
+}
+
+SpatialWindowBlocked::SpatialWindowBlocked(uint64_t s)
+    : size(s), count(0), head(0), next(0)
+{
+    assert(size > 0);
+    ring = new uint64_t[size];
+    root = NewLeaf();
+}
+
+SpatialWindowBlocked::~SpatialWindowBlocked(){
+    Free(root);
+    delete[] ring;
+}
+
+void SpatialWindowBlocked::Free(BlockedNode* node){
+    if (!node->leaf){
+        BlockedInner* in = (BlockedInner*)node;
+        for (uint32_t i = 0; i < in->n; i++){
+            Free(in->kids[i]);
+        }
+    }
+    DeleteNode(node);
+}
+
+void SpatialWindowBlocked::Count(BlockedNode* node, uint64_t depth, ReuseEngineStats& s){
+    s.allocations++;
+    if (node->leaf){
+        s.windowbytes += sizeof(BlockedLeaf);
+        if (depth > s.treedepth){
+            s.treedepth = depth;
+        }
+        return;
+    }
+    s.windowbytes += sizeof(BlockedInner);
+    BlockedInner* in = (BlockedInner*)node;
+    for (uint32_t i = 0; i < in->n; i++){
+        Count(in->kids[i], depth + 1, s);
+    }
+}
+
+BlockedLeaf* SpatialWindowBlocked::FindLeaf(uint64_t addr){
+    BlockedNode* node = root;
+    while (!node->leaf){
+        BlockedInner* in = (BlockedInner*)node;
+        node = in->kids[ChildIndex(in, addr)];
+    }
+    return (BlockedLeaf*)node;
+}
+
+// the closest address to addr is either the next one above addr or the next one at/below it,
+// and since leaves are never empty these are at most one leaf away
+static inline uint64_t Closest(BlockedLeaf* l, uint64_t addr){
+    uint64_t best = INVALID_SPATIAL;
+    uint64_t diff;
+    uint32_t p = CountNotAbove(l->keys, l->n, addr);
+
+    if (p < l->n){
+        best = uint64abs(l->keys[p] - addr);
+    } else if (l->next){
+        best = uint64abs(l->next->keys[0] - addr);
+    }
+    if (p > 0){
+        diff = uint64abs(l->keys[p - 1] - addr);
+        best = diff < best ? diff : best;
+    } else if (l->prev){
+        diff = uint64abs(l->prev->keys[l->prev->n - 1] - addr);
+        best = diff < best ? diff : best;
+    }
+    return best;
+}
+
+// the closest address to addr among the newest ages[i] addresses, for each i. addresses are
+// visited in order of their distance from addr, and each one is the answer for every remaining
+// search which reaches back far enough to include its latest access
+static inline void Nearest(BlockedLeaf* l, uint64_t addr, uint32_t next, const uint64_t* ages, uint32_t n, uint64_t* best){
+    uint32_t p = CountNotAbove(l->keys, l->n, addr);
+
+    BlockedLeaf* rl = l;
+    uint32_t ri = p;
+    if (ri == rl->n){
+        rl = rl->next;
+        ri = 0;
+    }
+    BlockedLeaf* ll = l;
+    uint32_t li = p;
+    if (li == 0){
+        ll = ll->prev;
+        li = ll ? ll->n : 0;
+    }
+
+    uint32_t open = 0;
+    while (open < n && ages[open] > 0 && (rl || ll)){
+        uint64_t d;
+        uint32_t age;
+        if (rl && (!ll || rl->keys[ri] - addr < addr - ll->keys[li - 1])){
+            d = rl->keys[ri] - addr;
+            age = next - rl->latest[ri];
+            if (++ri == rl->n){
+                rl = rl->next;
+                ri = 0;
+            }
+        } else {
+            d = addr - ll->keys[li - 1];
+            age = next - ll->latest[li - 1];
+            if (--li == 0){
+                ll = ll->prev;
+                li = ll ? ll->n : 0;
+            }
+        }
+        while (open < n && age <= ages[open]){
+            best[open++] = d;
+        }
+    }
+}
+
+// returns the new right sibling if node was split, and its lower bound in sep. the closest
+// address already in the window is found on the way, so that only one descent is needed
+BlockedNode* SpatialWindowBlocked::Insert(BlockedNode* node, uint64_t addr, uint64_t* sep, const uint64_t* ages, uint32_t n, uint64_t* best){
+    const uint32_t half = BLOCKED_FANOUT / 2;
+
+    if (node->leaf){
+        BlockedLeaf* l = (BlockedLeaf*)node;
+        if (l->n > 0){
+            if (ages){
+                Nearest(l, addr, next, ages, n, best);
+            } else {
+                *best = Closest(l, addr);
+            }
+        }
+
+        uint32_t p = CountBelow(l->keys, l->n, addr);
+        if (p < l->n && l->keys[p] == addr){
+            l->counts[p]++;
+            l->latest[p] = next;
+            return NULL;
+        }
+
+        BlockedLeaf* r = NULL;
+        if (l->n == BLOCKED_FANOUT){
+            r = NewLeaf();
+            r->n = l->n - half;
+            memcpy(r->keys, l->keys + half, r->n * sizeof(uint64_t));
+            memcpy(r->counts, l->counts + half, r->n * sizeof(uint32_t));
+            memcpy(r->latest, l->latest + half, r->n * sizeof(uint32_t));
+            l->n = half;
+
+            r->next = l->next;
+            if (r->next){
+                r->next->prev = r;
+            }
+            r->prev = l;
+            l->next = r;
+
+            if (p >= half){
+                l = r;
+                p -= half;
+            }
+        }
+
+        memmove(l->keys + p + 1, l->keys + p, (l->n - p) * sizeof(uint64_t));
+        memmove(l->counts + p + 1, l->counts + p, (l->n - p) * sizeof(uint32_t));
+        memmove(l->latest + p + 1, l->latest + p, (l->n - p) * sizeof(uint32_t));
+        l->keys[p] = addr;
+        l->counts[p] = 1;
+        l->latest[p] = next;
+        l->n++;
+
+        if (r){
+            *sep = r->keys[0];
+        }
+        return r;
+    }
+
+    BlockedInner* in = (BlockedInner*)node;
+    uint32_t ci = ChildIndex(in, addr);
+    uint64_t s;
+    BlockedNode* kid = Insert(in->kids[ci], addr, &s, ages, n, best);
+    if (kid == NULL){
+        return NULL;
+    }
+
+    // the new child goes right after the one that was split
+    BlockedInner* r = NULL;
+    BlockedInner* t = in;
+    uint32_t p = ci + 1;
+    if (in->n == BLOCKED_FANOUT){
+        r = NewInner();
+        r->n = in->n - half;
+        memcpy(r->keys, in->keys + half, r->n * sizeof(uint64_t));
+        memcpy(r->kids, in->kids + half, r->n * sizeof(BlockedNode*));
+        in->n = half;
+
+        if (p >= half){
+            t = r;
+            p -= half;
+        }
+    }
+
+    memmove(t->keys + p + 1, t->keys + p, (t->n - p) * sizeof(uint64_t));
+    memmove(t->kids + p + 1, t->kids + p, (t->n - p) * sizeof(BlockedNode*));
+    t->keys[p] = s;
+    t->kids[p] = kid;
+    t->n++;
+
+    if (r){
+        *sep = r->keys[0];
+    }
+    return r;
+}
+
+// fold parent->kids[left + 1] into parent->kids[left]
+void SpatialWindowBlocked::Merge(BlockedInner* parent, uint32_t left){
+    BlockedNode* l = parent->kids[left];
+    BlockedNode* r = parent->kids[left + 1];
+    debug_assert(l->leaf == r->leaf);
+    debug_assert(l->n + r->n <= BLOCKED_FANOUT);
+
+    if (l->leaf){
+        BlockedLeaf* ll = (BlockedLeaf*)l;
+        BlockedLeaf* rl = (BlockedLeaf*)r;
+        memcpy(ll->keys + ll->n, rl->keys, rl->n * sizeof(uint64_t));
+        memcpy(ll->counts + ll->n, rl->counts, rl->n * sizeof(uint32_t));
+        memcpy(ll->latest + ll->n, rl->latest, rl->n * sizeof(uint32_t));
+        ll->next = rl->next;
+        if (ll->next){
+            ll->next->prev = ll;
+        }
+    } else {
+        BlockedInner* li = (BlockedInner*)l;
+        BlockedInner* ri = (BlockedInner*)r;
+        ri->keys[0] = parent->keys[left + 1];
+        memcpy(li->keys + li->n, ri->keys, ri->n * sizeof(uint64_t));
+        memcpy(li->kids + li->n, ri->kids, ri->n * sizeof(BlockedNode*));
+    }
+    l->n += r->n;
+    DeleteNode(r);
+
+    uint32_t p = left + 1;
+    memmove(parent->keys + p, parent->keys + p + 1, (parent->n - p - 1) * sizeof(uint64_t));
+    memmove(parent->kids + p, parent->kids + p + 1, (parent->n - p - 1) * sizeof(BlockedNode*));
+    parent->n--;
+}
+
+// returns true if node is left empty
+bool SpatialWindowBlocked::Remove(BlockedNode* node, uint64_t addr, bool all){
+    if (node->leaf){
+        BlockedLeaf* l = (BlockedLeaf*)node;
+        uint32_t p = CountBelow(l->keys, l->n, addr);
+        debug_assert(p < l->n && l->keys[p] == addr);
+
+        if (!all && --l->counts[p] > 0){
+            return false;
+        }
+
+        memmove(l->keys + p, l->keys + p + 1, (l->n - p - 1) * sizeof(uint64_t));
+        memmove(l->counts + p, l->counts + p + 1, (l->n - p - 1) * sizeof(uint32_t));
+        memmove(l->latest + p, l->latest + p + 1, (l->n - p - 1) * sizeof(uint32_t));
+        l->n--;
+
+        if (l->n == 0){
+            if (l->prev){
+                l->prev->next = l->next;
+            }
+            if (l->next){
+                l->next->prev = l->prev;
+            }
+            l->prev = NULL;
+            l->next = NULL;
+            return true;
+        }
+        return false;
+    }
+
+    BlockedInner* in = (BlockedInner*)node;
+    uint32_t ci = ChildIndex(in, addr);
+    BlockedNode* kid = in->kids[ci];
+
+    if (Remove(kid, addr, all)){
+        DeleteNode(kid);
+        memmove(in->keys + ci, in->keys + ci + 1, (in->n - ci - 1) * sizeof(uint64_t));
+        memmove(in->kids + ci, in->kids + ci + 1, (in->n - ci - 1) * sizeof(BlockedNode*));
+        in->n--;
+        return (in->n == 0);
+    }
+
+    // keep nodes reasonably full by folding small neighbors together
+    const uint32_t low = BLOCKED_FANOUT / 4;
+    const uint32_t high = (BLOCKED_FANOUT * 3) / 4;
+    if (kid->n < low){
+        if (ci + 1 < in->n && kid->n + in->kids[ci + 1]->n <= high){
+            Merge(in, ci);
+        } else if (ci > 0 && in->kids[ci - 1]->n + kid->n <= high){
+            Merge(in, ci - 1);
+        }
+    }
+    return false;
+}
+
+void SpatialWindowBlocked::Remove(uint64_t addr, bool all){
+    if (Remove(root, addr, all) && !root->leaf){
+        DeleteNode(root);
+        root = NewLeaf();
+    }
+    while (!root->leaf && root->n == 1){
+        BlockedNode* old = root;
+        root = ((BlockedInner*)root)->kids[0];
+        DeleteNode(old);
+    }
+}
+
+uint64_t SpatialWindowBlocked::Process(uint64_t addr){
+    uint64_t best = INVALID_SPATIAL;
+    Process(addr, NULL, 1, &best);
+    return best;
+}
+
+void SpatialWindowBlocked::Process(uint64_t addr, const uint64_t* ages, uint32_t n, uint64_t* best){
+    debug_assert(ages == NULL || ages[0] == count);
+    for (uint32_t i = 0; i < n; i++){
+        best[i] = INVALID_SPATIAL;
+    }
+
+    uint64_t sep;
+    BlockedNode* r = Insert(root, addr, &sep, ages, n, best);
+    if (r){
+        BlockedInner* in = NewInner();
+        in->n = 2;
+        in->keys[0] = 0;
+        in->kids[0] = root;
+        in->keys[1] = sep;
+        in->kids[1] = r;
+        root = in;
+    }
+
+    // the oldest address leaves only after addr was checked against it
+    if (count < size){
+        ring[count++] = addr;
+    } else {
+        Remove(ring[head], false);
+        ring[head] = addr;
+        head = (head + 1 == size) ? 0 : head + 1;
+    }
+    next++;
+}
+
+void SpatialWindowBlocked::Flush(){
+    Free(root);
+    root = NewLeaf();
+    count = 0;
+    head = 0;
+}
+
+void SpatialWindowBlocked::Invalidate(uint64_t addr){
+    Invalidate(addr, NULL, 0);
+}
+
+void SpatialWindowBlocked::Invalidate(uint64_t addr, uint64_t* ages, uint32_t k){
+    BlockedLeaf* leaf = FindLeaf(addr);
+    uint32_t p = CountBelow(leaf->keys, leaf->n, addr);
+    if (p == leaf->n || leaf->keys[p] != addr){
+        return;
+    }
+    Remove(addr, true);
+
+    // put the ring in oldest-first order, then close the gaps left by addr newest first, so that
+    // eviction order is preserved and the rest ends up against the end of the ring. a copy at
+    // position i is among the newest ages[j] addresses if it was before the c newer copies were
+    // taken off ages[j]
+    rotate(ring, ring + head, ring + count);
+    uint64_t w = count;
+    uint64_t c = 0;
+    for (uint64_t i = count; i > 0; i--){
+        uint64_t a = ring[i - 1];
+        if (a != addr){
+            ring[--w] = a;
+            continue;
+        }
+        for (uint32_t j = 0; j < k; j++){
+            if (count - (i - 1) <= ages[j] + c){
+                ages[j]--;
+            }
+        }
+        c++;
+    }
+    uint64_t n = count - w;
+    memmove(ring, ring + w, n * sizeof(uint64_t));
+    count = n;
+    head = 0;
+
+    // the addresses after addr moved closer to the start of the window, so the latest positions
+    // are renumbered to match. only searches of the newest addresses need them
+    if (ages){
+        for (uint64_t i = 0; i < n; i++){
+            BlockedLeaf* l = FindLeaf(ring[i]);
+            l->latest[CountBelow(l->keys, l->n, ring[i])] = i;
+        }
+        next = n;
+    }
+}
+
+void SpatialWindowBlocked::GetActiveAddresses(vector<uint64_t>& addrs){
+    BlockedNode* node = root;
+    while (!node->leaf){
+        node = ((BlockedInner*)node)->kids[0];
+    }
+    for (BlockedLeaf* l = (BlockedLeaf*)node; l; l = l->next){
+        addrs.insert(addrs.end(), l->keys, l->keys + l->n);
+    }
+}
+
+void SpatialWindowBlocked::GetEngineStats(ReuseEngineStats& s){
+    s.windowsize = count;
+    s.treedepth = 0;
+    s.allocations += 1;
+    s.windowbytes = size * sizeof(uint64_t);
+    Count(root, 1, s);
+}
+
+SpatialWindowMulti::SpatialWindowMulti(const vector<uint64_t>& s, uint64_t limit)
+    : ring(NULL), size(0), count(0), head(0), sizes(s), scanned(0)
+{
+    assert(sizes.size() > 0);
+    for (uint32_t i = 0; i < sizes.size(); i++){
+        assert(sizes[i] > 0 && (i == 0 || sizes[i] > sizes[i - 1]));
+        if (sizes[i] <= limit){
+            scanned = i + 1;
+        }
+    }
+    counts.resize(scanned, 0);
+    if (scanned){
+        size = sizes[scanned - 1];
+        ring = new uint64_t[size];
+    }
+
+    // positions in a SpatialWindowBlocked are 32 bits wide
+    uint32_t large = sizes.size() - scanned;
+    for (uint32_t j = 0; j < large; j++){
+        uint64_t w = sizes[sizes.size() - 1 - j];
+        if (j == 0 || w * MULTI_TIER_RATIO < sizes[sizes.size() - 1 - first.back()]){
+            assert(w < ((uint64_t)1 << 32) && "window size is too large to share");
+            tiers.push_back(new SpatialWindowBlocked(w));
+            first.push_back(j);
+        }
+    }
+    first.push_back(large);
+    ages.resize(large, 0);
+    found.resize(large, INVALID_SPATIAL);
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")){
+        scan = ScanAVX512;
+    } else if (__builtin_cpu_supports("avx2")){
+        scan = ScanAVX2;
+    } else {
+        scan = ScanScalar;
+    }
+}
+
+SpatialWindowMulti::~SpatialWindowMulti(){
+    for (uint32_t i = 0; i < tiers.size(); i++){
+        delete tiers[i];
+    }
+    if (ring){
+        delete[] ring;
+    }
+}
+
+// the smallest distance to the addresses whose age is in (newest, oldest], where the address
+// added last has age 1. those addresses are contiguous in the ring, apart from wrapping around
+uint64_t SpatialWindowMulti::ScanAges(uint64_t newest, uint64_t oldest, uint64_t addr){
+    uint64_t n = oldest - newest;
+    uint64_t start = (head + size - oldest) % size;
+    uint64_t first = min(n, size - start);
+
+    uint64_t best = scan(ring + start, first, addr);
+    if (first < n){
+        uint64_t t = scan(ring, n - first, addr);
+        best = t < best ? t : best;
+    }
+    return best;
+}
+
+void SpatialWindowMulti::Process(uint64_t addr, uint64_t* best){
+    // each small window continues the scan where the last one stopped
+    uint64_t running = INVALID_SPATIAL;
+    uint64_t done = 0;
+    for (uint32_t i = 0; i < scanned; i++){
+        uint64_t n = counts[i];
+        if (n > done){
+            uint64_t t = ScanAges(done, n, addr);
+            running = t < running ? t : running;
+            done = n;
+        }
+        best[i] = running;
+        counts[i] = min(n + 1, sizes[i]);
+    }
+    if (scanned){
+        ring[head] = addr;
+        head = (head + 1 == size) ? 0 : head + 1;
+        count = counts[scanned - 1];
+    }
+
+    uint32_t last = sizes.size() - 1;
+    for (uint32_t i = 0; i < tiers.size(); i++){
+        tiers[i]->Process(addr, &ages[first[i]], first[i + 1] - first[i], &found[first[i]]);
+    }
+    for (uint32_t j = 0; j < ages.size(); j++){
+        best[last - j] = found[j];
+        ages[j] = min(ages[j] + 1, sizes[last - j]);
+    }
+}
+
+void SpatialWindowMulti::Flush(){
+    fill(counts.begin(), counts.end(), 0);
+    count = 0;
+    head = 0;
+    fill(ages.begin(), ages.end(), 0);
+    for (uint32_t i = 0; i < tiers.size(); i++){
+        tiers[i]->Flush();
+    }
+}
+
+void SpatialWindowMulti::Invalidate(uint64_t addr){
+    for (uint32_t i = 0; i < tiers.size(); i++){
+        tiers[i]->Invalidate(addr, &ages[first[i]], first[i + 1] - first[i]);
+    }
+    if (count == 0 || ScanAges(0, count, addr) != 0){
+        return;
+    }
+
+    // put the ring in oldest-first order, then close the gaps left by addr newest first, as in
+    // SpatialWindowBlocked::Invalidate. a copy of the given age is in window i if it was before
+    // the c newer copies were taken off counts[i]
+    rotate(ring, ring + (head + size - count) % size, ring + size);
+    uint64_t w = count;
+    uint64_t c = 0;
+    for (uint64_t age = 1; age <= count; age++){
+        uint64_t a = ring[count - age];
+        if (a != addr){
+            ring[--w] = a;
+            continue;
+        }
+        for (uint32_t i = 0; i < scanned; i++){
+            if (age <= counts[i] + c){
+                counts[i]--;
+            }
+        }
+        c++;
+    }
+    uint64_t n = count - w;
+    memmove(ring, ring + w, n * sizeof(uint64_t));
+
+    count = n;
+    head = (n == size) ? 0 : n;
+}
+
+void SpatialWindowMulti::GetActiveAddresses(vector<uint64_t>& addrs){
+    if (tiers.size()){
+        tiers[0]->GetActiveAddresses(addrs);
+        return;
+    }
+
+    vector<uint64_t> a(ring, ring + count);
+    sort(a.begin(), a.end());
+    a.erase(unique(a.begin(), a.end()), a.end());
+    addrs.insert(addrs.end(), a.begin(), a.end());
+}
+
+void SpatialWindowMulti::GetEngineStats(ReuseEngineStats& s){
+    ReuseEngineStats t;
+    s.windowsize = count;
+    s.treedepth = 0;
+    s.allocations += scanned ? 1 : 0;
+    s.windowbytes = size * sizeof(uint64_t);
+    for (uint32_t i = tiers.size(); i > 0; i--){
+        memset(&t, 0, sizeof(ReuseEngineStats));
+        tiers[i - 1]->GetEngineStats(t);
+        s.windowsize = t.windowsize;
+        s.treedepth = max(s.treedepth, t.treedepth);
+        s.allocations += t.allocations;
+        s.windowbytes += t.windowbytes;
+    }
+}
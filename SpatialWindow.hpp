@@ -0,0 +1,266 @@
+/**
+ * @file
+ * @author Michael Laurenzano <michaell@sdsc.edu>
+ * @version 0.01
+ *
+ * @section LICENSE
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * The address windows used internally by SpatialLocality. Each keeps the most recent
+ * addresses of a stream and answers which of them is closest to a new address.
+ */
+
+#ifndef _SpatialWindow_hpp_
+#define _SpatialWindow_hpp_
+
+#include <ReuseDistance.hpp>
+
+/**
+ * @class SpatialWindow
+ *
+ * Holds the last size addresses of a stream (with duplicates).
+ */
+class SpatialWindow {
+public:
+    virtual ~SpatialWindow() {}
+
+    /**
+     * Find the smallest distance between an address and any address in the window, then
+     * add the address to the window, dropping the oldest address if the window is full.
+     *
+     * @param addr  The address.
+     *
+     * @return The smallest distance found, or INVALID_SPATIAL if the window is empty.
+     */
+    virtual uint64_t Process(uint64_t addr) = 0;
+
+    /**
+     * Remove every address from the window.
+     */
+    virtual void Flush() = 0;
+
+    /**
+     * Remove every copy of an address from the window.
+     */
+    virtual void Invalidate(uint64_t addr) = 0;
+
+    /**
+     * Get the distinct addresses in the window, sorted in ascending order.
+     */
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs) = 0;
+
+    /**
+     * Fill in the windowsize, treedepth and windowbytes fields of s, and add to its allocations.
+     */
+    virtual void GetEngineStats(ReuseEngineStats& s) = 0;
+};
+
+/**
+ * @class SpatialWindowMap
+ *
+ * The general-purpose window: an ordered map of address counts, plus a list giving
+ * the order in which addresses entered the window.
+ */
+class SpatialWindowMap : public SpatialWindow {
+private:
+    // [address -> count]
+    std::map<uint64_t, uint64_t> awindow;
+
+    // list of the addresses in the window, ordered by sequence id
+    std::list<uint64_t> swindow;
+
+    uint64_t size;
+
+public:
+    SpatialWindowMap(uint64_t s) : size(s) {}
+    virtual ~SpatialWindowMap() {}
+
+    virtual uint64_t Process(uint64_t addr);
+    virtual void Flush();
+    virtual void Invalidate(uint64_t addr);
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+    virtual void GetEngineStats(ReuseEngineStats& s);
+};
+
+/**
+ * @class SpatialWindowScan
+ *
+ * A window for small sizes: a ring buffer of addresses which is scanned in full, using
+ * AVX-512 or AVX2 when the processor has them. Nothing is allocated after construction.
+ */
+class SpatialWindowScan : public SpatialWindow {
+private:
+    uint64_t* ring;
+    uint64_t size;
+    uint64_t count;
+    uint64_t head;
+
+    uint64_t (*scan)(const uint64_t* ring, uint64_t count, uint64_t addr);
+
+public:
+    SpatialWindowScan(uint64_t s);
+    virtual ~SpatialWindowScan();
+
+    virtual uint64_t Process(uint64_t addr);
+    virtual void Flush();
+    virtual void Invalidate(uint64_t addr);
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+    virtual void GetEngineStats(ReuseEngineStats& s);
+};
+
+// the number of keys in a leaf and children in an inner node of a SpatialWindowBlocked
+#define BLOCKED_FANOUT (32)
+
+struct BlockedNode;
+struct BlockedLeaf;
+struct BlockedInner;
+
+// the largest ratio between two window sizes that share a SpatialWindowBlocked in a SpatialWindowMulti
+#define MULTI_TIER_RATIO (16)
+
+/**
+ * @class SpatialWindowBlocked
+ *
+ * A window for large sizes: a B+-tree of sorted address blocks with duplicate counts, whose
+ * leaves are linked so that the neighbors of an address are at most one leaf away. The order
+ * in which addresses leave the window is kept in a ring buffer. The leaves also record the
+ * position of the latest access to each address, so that the newest part of the window can
+ * be searched as a smaller window (see SpatialWindowMulti).
+ */
+class SpatialWindowBlocked : public SpatialWindow {
+private:
+    BlockedNode* root;
+
+    uint64_t* ring;
+    uint64_t size;
+    uint64_t count;
+    uint64_t head;
+
+    // the position of the next address. positions wrap, but only their differences are used
+    uint32_t next;
+
+    BlockedLeaf* FindLeaf(uint64_t addr);
+    BlockedNode* Insert(BlockedNode* node, uint64_t addr, uint64_t* sep, const uint64_t* ages, uint32_t n, uint64_t* best);
+    bool Remove(BlockedNode* node, uint64_t addr, bool all);
+    void Merge(BlockedInner* parent, uint32_t left);
+    void Remove(uint64_t addr, bool all);
+    void Free(BlockedNode* node);
+    void Count(BlockedNode* node, uint64_t depth, ReuseEngineStats& s);
+
+public:
+    SpatialWindowBlocked(uint64_t s);
+    virtual ~SpatialWindowBlocked();
+
+    virtual uint64_t Process(uint64_t addr);
+    virtual void Flush();
+    virtual void Invalidate(uint64_t addr);
+    virtual void GetActiveAddresses(std::vector<uint64_t>& addrs);
+    virtual void GetEngineStats(ReuseEngineStats& s);
+
+    /**
+     * Find the smallest distance between an address and the newest addresses in the window,
+     * for several numbers of newest addresses at once, then add the address to the window.
+     *
+     * @param addr  The address.
+     * @param ages  The number of newest addresses to search for each result, in descending order.
+     * The first must be the number of addresses in the window.
+     * @param n  The number of elements in ages and best.
+     * @param best  Receives each distance, or INVALID_SPATIAL if there is no address to search.
+     */
+    void Process(uint64_t addr, const uint64_t* ages, uint32_t n, uint64_t* best);
+
+    /**
+     * Remove every copy of an address from the window, and from each of the newest parts of it
+     * described by ages as in Process. ages is updated to the number of addresses left in each.
+     */
+    void Invalidate(uint64_t addr, uint64_t* ages, uint32_t n);
+};
+
+/**
+ * @class SpatialWindowMulti
+ *
+ * Answers the nearest-address query for several window sizes at once. Each window is a suffix
+ * of every larger one, so the last addresses of the stream are kept in one ring buffer sized
+ * for the largest small window, and the small windows are answered by a single pass over the
+ * newest part of the ring which records the running minimum at each window's boundary. An
+ * invalidation leaves a window with fewer addresses without bringing back any that it had
+ * already evicted, so each window keeps its own count of the newest addresses it holds.
+ *
+ * Windows too large to scan are split into tiers, each a SpatialWindowBlocked sized for the
+ * largest window in it. A smaller window in the same tier walks outward from the new address
+ * through the tree until it finds an address whose latest access is recent enough to be in it.
+ * That takes about as many steps as the ratio between the two sizes, so a window starts a new
+ * tier when it is more than MULTI_TIER_RATIO times smaller than the largest of its tier.
+ */
+class SpatialWindowMulti {
+private:
+    uint64_t* ring;
+    uint64_t size;
+    uint64_t count;
+    uint64_t head;
+
+    // window sizes in ascending order. the first scanned of them are found by scanning the ring
+    std::vector<uint64_t> sizes;
+    uint32_t scanned;
+
+    // the number of newest addresses in each scanned window. the last one is always count
+    std::vector<uint64_t> counts;
+
+    // the windows which are not scanned are numbered from the largest down. tier i holds windows
+    // [first[i], first[i + 1]), and ages and found hold the count and the last result for each
+    std::vector<SpatialWindowBlocked*> tiers;
+    std::vector<uint32_t> first;
+    std::vector<uint64_t> ages;
+    std::vector<uint64_t> found;
+
+    uint64_t (*scan)(const uint64_t* ring, uint64_t count, uint64_t addr);
+
+    uint64_t ScanAges(uint64_t newest, uint64_t oldest, uint64_t addr);
+
+public:
+
+    /**
+     * @param s  The number of addresses in each window, in ascending order without duplicates.
+     * @param limit  Windows of up to limit addresses are found by scanning.
+     */
+    SpatialWindowMulti(const std::vector<uint64_t>& s, uint64_t limit);
+    ~SpatialWindowMulti();
+
+    /**
+     * Find the smallest distance between an address and any address in each window, then add
+     * the address to the windows.
+     *
+     * @param addr  The address.
+     * @param best  Receives the distance for each window, or INVALID_SPATIAL for a window which is empty.
+     */
+    void Process(uint64_t addr, uint64_t* best);
+
+    void Flush();
+    void Invalidate(uint64_t addr);
+
+    /**
+     * Get the distinct addresses in the largest window, sorted in ascending order.
+     */
+    void GetActiveAddresses(std::vector<uint64_t>& addrs);
+    void GetEngineStats(ReuseEngineStats& s);
+};
+
+#endif /* _SpatialWindow_hpp_ */
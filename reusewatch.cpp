@@ -0,0 +1,76 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// reusewatch prints the histograms that a running ReuseDistance publishes through a ReuseExport.
+//
+//   reusewatch <segment> [seconds]
+//
+// prints the segment once, or every <seconds> seconds until the segment goes away. each print is
+// in the format of ReuseDistance::Print, preceded by a '#' line giving the publish count.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <ReuseExport.hpp>
+
+using namespace std;
+
+int main(int argc, char* argv[]){
+    if (argc < 2 || argc > 3){
+        fprintf(stderr, "usage: %s <segment> [seconds]\n", argv[0]);
+        return 1;
+    }
+    uint32_t seconds = (argc == 3) ? atoi(argv[2]) : 0;
+
+    ReuseExportReader reader(argv[1]);
+    if (!reader.IsOpen()){
+        fprintf(stderr, "%s: cannot open segment %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    uint64_t last = 0;
+    while (true){
+        if (!reader.Read()){
+            fprintf(stderr, "%s: no consistent copy of segment %s\n", argv[0], argv[1]);
+            return 1;
+        }
+
+        // only print when something new was published
+        const ReuseExportHeader& h = reader.GetHeader();
+        if (h.publishes != last || seconds == 0){
+            last = h.publishes;
+            cout << "# publish" << TAB << h.publishes << ENDL;
+            reader.Print(cout, false);
+            cout.flush();
+        }
+
+        if (seconds == 0){
+            break;
+        }
+        sleep(seconds);
+
+        // a ReuseExport removes its segment when it is destroyed
+        ReuseExportReader check(argv[1]);
+        if (!check.IsOpen()){
+            break;
+        }
+    }
+    return 0;
+}
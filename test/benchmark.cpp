@@ -0,0 +1,395 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <ReuseDistance.hpp>
+#include <ReuseTrace.hpp>
+
+using namespace std;
+
+// every case is run in its own process so that peak memory can be measured per case
+#define DEFAULT_ACCESSES (2000000)
+#define WORKING_SET (1 << 20)
+#define ZIPF_SKEW (0.99)
+#define LINE_SIZE (64)
+#define BENCH_SEED (0x2545F4914F6CDD1DL)
+
+// xorshift64*, so traces are identical from run to run and machine to machine
+static uint64_t state;
+static inline uint64_t NextRandom(){
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DL;
+}
+
+static void GenStrided(ReuseEntry* t, uint64_t n){
+    for (uint64_t i = 0; i < n; i++){
+        t[i].id = 0;
+        t[i].address = (i % WORKING_SET) * 8;
+    }
+}
+
+static void GenRandom(ReuseEntry* t, uint64_t n){
+    for (uint64_t i = 0; i < n; i++){
+        t[i].id = 0;
+        t[i].address = (NextRandom() % WORKING_SET) * LINE_SIZE;
+    }
+}
+
+static void GenZipf(ReuseEntry* t, uint64_t n){
+    double* cdf = new double[WORKING_SET];
+    double sum = 0.0;
+    for (uint64_t i = 0; i < WORKING_SET; i++){
+        sum += 1.0 / pow((double)(i + 1), ZIPF_SKEW);
+        cdf[i] = sum;
+    }
+
+    // spread the popular items out so that rank doesn't imply address
+    for (uint64_t i = 0; i < n; i++){
+        double u = (double)(NextRandom() >> 11) / (double)(1L << 53) * sum;
+        uint64_t k = lower_bound(cdf, cdf + WORKING_SET, u) - cdf;
+        t[i].id = k % 16;
+        t[i].address = ((k * 0x9E3779B97F4A7C15L) % WORKING_SET) * LINE_SIZE;
+    }
+    delete[] cdf;
+}
+
+static void GenChase(ReuseEntry* t, uint64_t n){
+    uint64_t* next = new uint64_t[WORKING_SET];
+    for (uint64_t i = 0; i < WORKING_SET; i++){
+        next[i] = i;
+    }
+    // Sattolo's algorithm gives a single cycle through every node
+    for (uint64_t i = WORKING_SET - 1; i > 0; i--){
+        uint64_t j = NextRandom() % i;
+        uint64_t x = next[i];
+        next[i] = next[j];
+        next[j] = x;
+    }
+
+    uint64_t c = 0;
+    for (uint64_t i = 0; i < n; i++){
+        t[i].id = 0;
+        t[i].address = c * LINE_SIZE;
+        c = next[c];
+    }
+    delete[] next;
+}
+
+// same shape as the TRIANGLE test in test.cpp, scaled up
+static void GenTriangle(ReuseEntry* t, uint64_t n){
+    uint64_t k = 0;
+    for (uint64_t i = 0; k < n; i++){
+        for (uint64_t j = 0; j < i && k < n; j++){
+            t[k].id = 0;
+            t[k].address = j;
+            k++;
+        }
+    }
+}
+
+// same shape as the SHIFTRNG test in test.cpp, scaled up
+static void GenShift(ReuseEntry* t, uint64_t n){
+    uint64_t k = 0;
+    for (uint64_t i = 0; k < n; i++){
+        uint64_t b = (i % 2 == 0) ? i : 0;
+        uint64_t e = (i % 2 == 0) ? i + 1 : i * 2;
+        for (uint64_t j = b; j < e && k < n; j++){
+            t[k].id = 0;
+            t[k].address = j;
+            k++;
+        }
+    }
+}
+
+// most accesses are to one of the last few addresses, often the same one again, as in a loop
+// body; the rest move on to a random line
+static void GenLocal(ReuseEntry* t, uint64_t n){
+    uint64_t recent[8] = { 0 };
+    for (uint64_t i = 0; i < n; i++){
+        uint64_t r = NextRandom();
+        uint64_t c = r % 10;
+        uint64_t a;
+        if (c < 3 && i){
+            a = t[i - 1].address;
+        } else if (c < 8){
+            a = recent[(r >> 8) % 8];
+        } else {
+            a = ((r >> 8) % WORKING_SET) * LINE_SIZE;
+        }
+        recent[i % 8] = a;
+        t[i].id = 0;
+        t[i].address = a;
+    }
+}
+
+struct Pattern {
+    const char* name;
+    void (*gen)(ReuseEntry* t, uint64_t n);
+};
+
+static Pattern patterns[] = {
+    { "STRIDED", GenStrided },
+    { "RANDOM", GenRandom },
+    { "ZIPF", GenZipf },
+    { "CHASE", GenChase },
+    { "TRIANGLE", GenTriangle },
+    { "SHIFTRNG", GenShift },
+    { "LOCAL", GenLocal },
+};
+
+struct Analyzer {
+    const char* name;
+    uint64_t window;
+};
+
+static Analyzer analyzers[] = {
+    { "REUSE", ReuseDistance::Infinity },
+    { "REUSE", 1024 },
+    { "REUSE", 65536 },
+    { "REUSETREE", ReuseDistance::Infinity },
+    { "REUSETREE", 1024 },
+    { "REUSETREE", 65536 },
+    { "REUSETREEEACH", ReuseDistance::Infinity },
+    { "REUSETREEEACH", 65536 },
+    { "REUSEBTREE", ReuseDistance::Infinity },
+    { "REUSEBTREE", 65536 },
+    { "SHARDED", ReuseDistance::Infinity },
+    { "SHARDED", 65536 },
+    { "REUSEPAGES", ReuseDistance::Infinity },
+    { "REUSEPAGES", 65536 },
+    { "SPATIAL", SpatialLocality::DefaultWindowSize },
+    { "SPATIAL", 1024 },
+    { "SPATIAL", 65536 },
+    { "SPATIALMULTI", 65536 },
+    { "STRIDE", ReuseDistance::Infinity },
+    { "BYTEREUSE", ReuseDistance::Infinity },
+    { "BYTEREUSE", 65536 },
+    { "REUSETIME", ReuseDistance::Infinity },
+    { "PERFSCRIPT", 0 },
+    { "DINERO", 0 },
+    { "LACKEY", 0 },
+};
+
+static double Now(){
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+static uint64_t PeakKB(){
+    struct rusage u;
+    getrusage(RUSAGE_SELF, &u);
+    return u.ru_maxrss;
+}
+
+// generators free their scratch space, so the analyzer's own footprint is taken from the
+// change in resident size rather than from the peak
+static uint64_t ResidentKB(){
+    uint64_t size = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f){
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2){
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static bool IsReader(Analyzer& a){
+    return strcmp(a.name, "PERFSCRIPT") == 0 || strcmp(a.name, "DINERO") == 0 || strcmp(a.name, "LACKEY") == 0;
+}
+
+// a trace reader is timed on the trace printed as text, without analyzing the addresses
+static double RunReader(Analyzer& a, ReuseEntry* trace, uint64_t n){
+    FILE* f = tmpfile();
+    assert(f && "cannot create a temporary file");
+    for (uint64_t i = 0; i < n; i++){
+        if (strcmp(a.name, "PERFSCRIPT") == 0){
+            fprintf(f, "%16s %5d [%03d] %12.6f: %10d cpu/mem-loads,ldlat=30/P: %16lx %16lx main+0x46 (/opt/bench/mcf)\n",
+                    "mcf", 2964, (int)(i & 3), 1138.316131 + i * 1e-6, 10007, trace[i].address, 0x401000 + trace[i].id);
+        } else if (strcmp(a.name, "DINERO") == 0){
+            fprintf(f, "%d %lx %d\n", (int)(i % 3), trace[i].address, 8);
+        } else {
+            fprintf(f, " %c %08lx,%d\n", "LS"[i & 1], trace[i].address, 8);
+        }
+    }
+    fflush(f);
+    lseek(fileno(f), 0, SEEK_SET);
+
+    ReuseTraceReader* reader;
+    if (strcmp(a.name, "PERFSCRIPT") == 0){
+        reader = new PerfScriptReader(fileno(f), 0);
+    } else if (strcmp(a.name, "DINERO") == 0){
+        reader = new DineroReader(fileno(f), 4);
+    } else {
+        reader = new LackeyReader(fileno(f));
+    }
+
+    ReuseEntry* entries = new ReuseEntry[ReuseDistance::BulkSize];
+    ReuseAccess* accesses = new ReuseAccess[ReuseDistance::BulkSize];
+    double t = Now();
+    while (reader->Read(entries, accesses, ReuseDistance::BulkSize) == ReuseDistance::BulkSize){
+    }
+    t = Now() - t;
+    assert(reader->GetRecordCount() == n);
+
+    delete reader;
+    delete[] entries;
+    delete[] accesses;
+    fclose(f);
+    return t;
+}
+
+static void RunCase(Pattern& p, Analyzer& a, uint64_t n){
+    state = BENCH_SEED;
+    ReuseEntry* trace = new ReuseEntry[n];
+    p.gen(trace, n);
+    uint64_t base = ResidentKB();
+
+    if (IsReader(a)){
+        double t = RunReader(a, trace, n);
+        cout << a.name
+             << TAB << a.window
+             << TAB << p.name
+             << TAB << n
+             << TAB << t
+             << TAB << (t * 1e9 / n)
+             << TAB << (uint64_t)(n / t)
+             << TAB << PeakKB()
+             << TAB << 0
+             << ENDL;
+        delete[] trace;
+        return;
+    }
+
+    ReuseDistance* r;
+    if (strcmp(a.name, "SPATIAL") == 0){
+        r = new SpatialLocality(a.window);
+    } else if (strcmp(a.name, "STRIDE") == 0){
+        r = new StrideLocality(ReuseDistance::DefaultBinIndividual);
+    } else if (strcmp(a.name, "SPATIALMULTI") == 0){
+        // every power of 4 from the default window size up to the window
+        vector<uint64_t> sizes;
+        for (uint64_t w = SpatialLocality::DefaultWindowSize; w <= a.window; w *= 4){
+            sizes.push_back(w);
+        }
+        r = new MultiSpatialLocality(sizes);
+    } else if (strcmp(a.name, "REUSETIME") == 0){
+        r = new ReuseTime(ReuseDistance::DefaultBinIndividual);
+    } else if (strcmp(a.name, "BYTEREUSE") == 0){
+        r = new ByteReuseDistance(a.window, ReuseDistance::DefaultBinIndividual);
+    } else if (strcmp(a.name, "REUSEPAGES") == 0){
+        r = new ReuseDistance(a.window, ReuseDistance::DefaultBinIndividual, ReuseDistance::Infinity,
+                              ReuseDistance::WindowAuto, ReuseDistance::IndexPageTable);
+    } else if (strcmp(a.name, "SHARDED") == 0){
+        r = new ShardedReuseDistance(a.window);
+    } else if (strcmp(a.name, "REUSEBTREE") == 0){
+        r = new ReuseDistance(a.window, ReuseDistance::DefaultBinIndividual, ReuseDistance::Infinity, ReuseDistance::WindowBTree);
+    } else if (strcmp(a.name, "REUSETREE") == 0 || strcmp(a.name, "REUSETREEEACH") == 0){
+        r = new ReuseDistance(a.window, ReuseDistance::DefaultBinIndividual, ReuseDistance::Infinity, ReuseDistance::WindowTree);
+    } else {
+        r = new ReuseDistance(a.window);
+    }
+
+    // REUSETREEEACH is REUSETREE fed one address at a time, to compare against its array batches
+    double t = Now();
+    if (strcmp(a.name, "REUSETREEEACH") == 0){
+        for (uint64_t i = 0; i < n; i++){
+            r->Process(trace[i]);
+        }
+    } else {
+        r->Process(trace, n);
+    }
+    t = Now() - t;
+
+    uint64_t peak = PeakKB();
+    uint64_t resident = ResidentKB();
+    cout << a.name
+         << TAB << a.window
+         << TAB << p.name
+         << TAB << n
+         << TAB << t
+         << TAB << (t * 1e9 / n)
+         << TAB << (uint64_t)(n / t)
+         << TAB << peak
+         << TAB << (resident > base ? resident - base : 0)
+         << ENDL;
+
+    delete r;
+    delete[] trace;
+}
+
+int main(int argc, char* argv[]){
+    uint64_t n = DEFAULT_ACCESSES;
+    const char* filter = NULL;
+    if (argc > 1){
+        n = strtol(argv[1], NULL, 10);
+    }
+    if (argc > 2){
+        filter = argv[2];
+    }
+
+    cout << "# <analyzer>"
+         << TAB << "<window_size>"
+         << TAB << "<pattern>"
+         << TAB << "<accesses>"
+         << TAB << "<seconds>"
+         << TAB << "<ns_per_access>"
+         << TAB << "<accesses_per_second>"
+         << TAB << "<peak_rss_kb>"
+         << TAB << "<analyzer_rss_kb>"
+         << ENDL;
+    cout.flush();
+
+    for (uint32_t i = 0; i < sizeof(analyzers) / sizeof(Analyzer); i++){
+        for (uint32_t j = 0; j < sizeof(patterns) / sizeof(Pattern); j++){
+            if (filter && strcmp(filter, patterns[j].name) != 0){
+                continue;
+            }
+            // readers only see text, so one pattern is enough
+            if (IsReader(analyzers[i]) && strcmp(patterns[j].name, "RANDOM") != 0){
+                continue;
+            }
+
+            pid_t pid = fork();
+            assert(pid >= 0 && "fork failed");
+            if (pid == 0){
+                RunCase(patterns[j], analyzers[i], n);
+                cout.flush();
+                _exit(0);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,1928 @@
+/*
+ * This file is part of the ReuseDistance tool.
+ *
+ * Copyright (c) 2012, University of California Regents
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <ReuseDistance.hpp>
+#include <ReuseExport.hpp>
+#include <ReuseTrace.hpp>
+
+using namespace std;
+
+// Runs every analyzer over randomly generated traces and compares the results against
+// naive O(N*W) reference models. Exits non-zero on the first mismatch.
+
+#define DEFAULT_TRIALS (12)
+#define DEFAULT_SEED (1)
+#define TRACE_LENGTH (12000)
+#define HISTORY (256)
+
+enum OpKind {
+    OpAccess = 0,
+    OpSkip,
+    OpInvalidate,
+};
+
+struct TraceOp {
+    uint32_t kind;
+    uint64_t id;
+    uint64_t address;
+    uint32_t thread;
+    uint32_t write;
+};
+
+static uint64_t state;
+static inline uint64_t NextRandom(){
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DL;
+}
+
+static inline uint64_t Choose(uint64_t n){
+    return NextRandom() % n;
+}
+
+/*
+ * The reference models. These are written to be obviously correct rather than fast.
+ */
+class ReferenceAnalyzer {
+private:
+    uint64_t binindividual;
+    uint64_t maxtracking;
+    uint64_t invalid;
+
+    uint64_t GetBin(uint64_t value){
+        if (value == invalid){
+            return invalid;
+        }
+        if (maxtracking != ReuseDistance::Infinity && value > maxtracking){
+            return invalid;
+        }
+        if (binindividual != ReuseDistance::Infinity && value > binindividual){
+            uint64_t p = 1;
+            while (p < value){
+                p <<= 1;
+            }
+            return p;
+        }
+        return value;
+    }
+
+public:
+    // [id -> [bin -> count]]
+    map<uint64_t, map<uint64_t, uint64_t> > counts;
+    map<uint64_t, uint64_t> accesses;
+
+    ReferenceAnalyzer(uint64_t b, uint64_t n, uint64_t inv) : binindividual(b), maxtracking(n), invalid(inv) {}
+    virtual ~ReferenceAnalyzer() {}
+
+    void Process(uint64_t id, uint64_t addr){
+        counts[id][GetBin(Distance(id, addr))]++;
+        accesses[id]++;
+    }
+
+    // most analyzers do not care which id an address came from
+    virtual uint64_t Distance(uint64_t, uint64_t addr) { return Distance(addr); }
+    virtual uint64_t Distance(uint64_t addr) = 0;
+    virtual void Skip() = 0;
+    virtual void Invalidate(uint64_t addr) = 0;
+    virtual void GetActiveAddresses(vector<uint64_t>& addrs) = 0;
+    virtual uint64_t GetWindowSize() = 0;
+
+    uint64_t GetInvalid() { return invalid; }
+};
+
+class ReferenceReuse : public ReferenceAnalyzer {
+private:
+    uint64_t capacity;
+
+    // least recently used first
+    vector<uint64_t> lru;
+
+public:
+    ReferenceReuse(uint64_t w, uint64_t b) : ReferenceAnalyzer(b, w, ReuseDistance::Infinity), capacity(w) {}
+
+    virtual uint64_t Distance(uint64_t addr){
+        for (uint64_t i = lru.size(); i > 0; i--){
+            if (lru[i - 1] == addr){
+                uint64_t dist = lru.size() - (i - 1);
+                lru.erase(lru.begin() + (i - 1));
+                lru.push_back(addr);
+                return dist;
+            }
+        }
+        if (capacity != ReuseDistance::Infinity && lru.size() >= capacity){
+            lru.erase(lru.begin());
+        }
+        lru.push_back(addr);
+        return ReuseDistance::Infinity;
+    }
+
+    virtual void Skip(){
+        lru.clear();
+    }
+
+    virtual void Invalidate(uint64_t addr){
+        for (uint64_t i = 0; i < lru.size(); i++){
+            if (lru[i] == addr){
+                lru.erase(lru.begin() + i);
+                return;
+            }
+        }
+    }
+
+    virtual void GetActiveAddresses(vector<uint64_t>& addrs){
+        addrs = lru;
+    }
+
+    virtual uint64_t GetWindowSize(){
+        return lru.size();
+    }
+};
+
+// the size of an object in a byte-weighted trace, between 1 and maxsize
+static inline uint64_t ObjectSize(uint64_t addr, uint64_t maxsize){
+    return 1 + ((addr * 0x9E3779B97F4A7C15L) >> 40) % maxsize;
+}
+
+class ReferenceBytes : public ReferenceAnalyzer {
+private:
+    uint64_t capacity;
+    uint64_t maxsize;
+
+    // least recently used first
+    vector<uint64_t> lru;
+
+public:
+    ReferenceBytes(uint64_t w, uint64_t b, uint64_t s) : ReferenceAnalyzer(b, w, ReuseDistance::Infinity), capacity(w), maxsize(s) {}
+
+    virtual uint64_t Distance(uint64_t addr){
+        uint64_t dist = ReuseDistance::Infinity;
+        for (uint64_t i = lru.size(); i > 0; i--){
+            if (lru[i - 1] == addr){
+                dist = 0;
+                for (uint64_t j = i - 1; j < lru.size(); j++){
+                    dist += ObjectSize(lru[j], maxsize);
+                }
+                lru.erase(lru.begin() + (i - 1));
+                break;
+            }
+        }
+        lru.push_back(addr);
+
+        uint64_t bytes = 0;
+        for (uint64_t j = 0; j < lru.size(); j++){
+            bytes += ObjectSize(lru[j], maxsize);
+        }
+        while (capacity != ReuseDistance::Infinity && bytes > capacity){
+            bytes -= ObjectSize(lru[0], maxsize);
+            lru.erase(lru.begin());
+        }
+        return dist;
+    }
+
+    virtual void Skip(){
+        lru.clear();
+    }
+
+    virtual void Invalidate(uint64_t addr){
+        for (uint64_t i = 0; i < lru.size(); i++){
+            if (lru[i] == addr){
+                lru.erase(lru.begin() + i);
+                return;
+            }
+        }
+    }
+
+    virtual void GetActiveAddresses(vector<uint64_t>& addrs){
+        addrs = lru;
+    }
+
+    virtual uint64_t GetWindowSize(){
+        return lru.size();
+    }
+};
+
+class ReferenceTime : public ReferenceAnalyzer {
+private:
+    uint64_t now;
+
+    // [address -> time of its last access]
+    map<uint64_t, uint64_t> last;
+
+public:
+    ReferenceTime(uint64_t b) : ReferenceAnalyzer(b, ReuseDistance::Infinity, ReuseDistance::Infinity), now(0) {}
+
+    virtual uint64_t Distance(uint64_t addr){
+        now++;
+        uint64_t t = ReuseDistance::Infinity;
+        if (last.count(addr)){
+            t = now - last[addr];
+        }
+        last[addr] = now;
+        return t;
+    }
+
+    virtual void Skip(){
+        last.clear();
+    }
+
+    virtual void Invalidate(uint64_t addr){
+        last.erase(addr);
+    }
+
+    virtual void GetActiveAddresses(vector<uint64_t>& addrs){
+        vector<pair<uint64_t, uint64_t> > order;
+        for (map<uint64_t, uint64_t>::const_iterator it = last.begin(); it != last.end(); it++){
+            order.push_back(pair<uint64_t, uint64_t>(it->second, it->first));
+        }
+        sort(order.begin(), order.end());
+        addrs.clear();
+        for (uint64_t i = 0; i < order.size(); i++){
+            addrs.push_back(order[i].second);
+        }
+    }
+
+    virtual uint64_t GetWindowSize(){
+        return last.size();
+    }
+};
+
+class ReferenceSpatial : public ReferenceAnalyzer {
+private:
+    uint64_t capacity;
+
+    // oldest first, with duplicates
+    deque<uint64_t> recent;
+
+public:
+    ReferenceSpatial(uint64_t w, uint64_t b, uint64_t n) : ReferenceAnalyzer(b, n, INVALID_SPATIAL), capacity(w) {}
+
+    virtual uint64_t Distance(uint64_t addr){
+        uint64_t best = INVALID_SPATIAL;
+        for (uint64_t i = 0; i < recent.size(); i++){
+            uint64_t d = (recent[i] > addr) ? recent[i] - addr : addr - recent[i];
+            if (d < best){
+                best = d;
+            }
+        }
+        // a new address is compared against the capacity + 1 addresses before it
+        if (recent.size() >= capacity + 1){
+            recent.pop_front();
+        }
+        recent.push_back(addr);
+        return best;
+    }
+
+    virtual void Skip(){
+        recent.clear();
+    }
+
+    virtual void Invalidate(uint64_t addr){
+        for (uint64_t i = recent.size(); i > 0; i--){
+            if (recent[i - 1] == addr){
+                recent.erase(recent.begin() + (i - 1));
+            }
+        }
+    }
+
+    virtual void GetActiveAddresses(vector<uint64_t>& addrs){
+        addrs.assign(recent.begin(), recent.end());
+        sort(addrs.begin(), addrs.end());
+        addrs.erase(unique(addrs.begin(), addrs.end()), addrs.end());
+    }
+
+    virtual uint64_t GetWindowSize(){
+        return recent.size();
+    }
+};
+
+class ReferenceStride : public ReferenceAnalyzer {
+private:
+    uint64_t binindividual;
+    uint64_t maxtracking;
+
+    // [id -> last address]
+    map<uint64_t, uint64_t> last;
+
+public:
+    // [id -> [signed stride -> count]], with binned strides at their bound farthest from 0
+    map<uint64_t, map<int64_t, uint64_t> > strides;
+
+    ReferenceStride(uint64_t b, uint64_t n) : ReferenceAnalyzer(b, n, StrideLocality::Invalid), binindividual(b), maxtracking(n) {}
+
+    virtual uint64_t Distance(uint64_t id, uint64_t addr){
+        if (last.count(id) == 0){
+            last[id] = addr;
+            return StrideLocality::Invalid;
+        }
+        int64_t stride = (int64_t)(addr - last[id]);
+        uint64_t m = (stride < 0) ? 0 - (uint64_t)stride : (uint64_t)stride;
+        last[id] = addr;
+
+        if (maxtracking == ReuseDistance::Infinity || m <= maxtracking){
+            uint64_t bin = m;
+            if (binindividual != ReuseDistance::Infinity && m > binindividual){
+                bin = 1;
+                while (bin < m){
+                    bin <<= 1;
+                }
+            }
+            if (stride < 0){
+                strides[id][(int64_t)(0 - bin)]++;
+            } else {
+                strides[id][(int64_t)min(bin, ((uint64_t)1 << 63) - 1)]++;
+            }
+        }
+        return m;
+    }
+
+    virtual uint64_t Distance(uint64_t){
+        assert(false);
+        return 0;
+    }
+
+    virtual void Skip(){
+        last.clear();
+    }
+
+    virtual void Invalidate(uint64_t){
+    }
+
+    virtual void GetActiveAddresses(vector<uint64_t>& addrs){
+        addrs.clear();
+        for (map<uint64_t, uint64_t>::const_iterator it = last.begin(); it != last.end(); it++){
+            addrs.push_back(it->second);
+        }
+        sort(addrs.begin(), addrs.end());
+        addrs.erase(unique(addrs.begin(), addrs.end()), addrs.end());
+    }
+
+    virtual uint64_t GetWindowSize(){
+        return last.size();
+    }
+};
+
+/*
+ * Trace generation. Most accesses revisit a recent address so that finite windows
+ * see hits as well as misses; the rest are spread over a small universe or far away.
+ */
+struct TraceShape {
+    uint64_t length;
+    uint64_t universe;
+    uint64_t ids;
+    uint32_t threads;
+    uint64_t skipodds;
+    uint64_t invalidateodds;
+    // quarters of the accesses which go back to one of the last few
+    uint64_t local;
+};
+
+static void Generate(vector<TraceOp>& trace, TraceShape& shape){
+    uint64_t history[HISTORY];
+    for (uint32_t i = 0; i < HISTORY; i++){
+        history[i] = Choose(shape.universe) * 8;
+    }
+
+    trace.clear();
+    for (uint64_t i = 0; i < shape.length; i++){
+        TraceOp op;
+        op.id = Choose(shape.ids);
+        op.thread = Choose(shape.threads);
+        op.write = (Choose(4) == 0);
+        op.kind = OpAccess;
+
+        uint64_t c = Choose(10);
+        if (c < 5){
+            op.address = history[Choose(HISTORY)];
+        } else if (c < 9){
+            op.address = Choose(shape.universe) * 8;
+        } else {
+            op.address = NextRandom() >> 4;
+        }
+        // one of the last few accesses again, often the very last one with the same id
+        if (shape.local && i && Choose(4) < shape.local){
+            TraceOp& near = trace[i - 1 - Choose(min(i, (uint64_t)8))];
+            op.address = near.address;
+            if (Choose(2)){
+                op.id = near.id;
+            }
+        }
+        history[i % HISTORY] = op.address;
+
+        if (shape.skipodds && Choose(shape.skipodds) == 0){
+            op.kind = OpSkip;
+            op.address = Choose(1000);
+        } else if (shape.invalidateodds && Choose(shape.invalidateodds) == 0){
+            op.kind = OpInvalidate;
+        }
+        trace.push_back(op);
+    }
+}
+
+/*
+ * Comparison against the reference models.
+ */
+static uint64_t comparisons = 0;
+static string context;
+
+static void Fail(string what){
+    cerr << "****** Differential test FAILED: " << context << ": " << what << ENDL;
+    exit(1);
+}
+
+static void CompareStats(ReuseStats* s, map<uint64_t, uint64_t>& expected, uint64_t accesses, uint64_t id){
+    ostringstream where;
+    where << "id " << id;
+
+    if (s == NULL){
+        Fail(where.str() + " has no stats");
+    }
+    if (s->GetAccessCount() != accesses){
+        Fail(where.str() + " access count differs");
+    }
+
+    vector<uint64_t> keys;
+    s->GetSortedDistances(keys);
+    map<uint64_t, uint64_t> actual;
+    for (vector<uint64_t>::const_iterator it = keys.begin(); it != keys.end(); it++){
+        uint64_t c = s->CountDistance(*it);
+        if (c){
+            actual[*it] = c;
+        }
+    }
+
+    if (actual != expected){
+        ostringstream msg;
+        msg << where.str() << " histogram differs:";
+        for (map<uint64_t, uint64_t>::const_iterator it = expected.begin(); it != expected.end(); it++){
+            if (actual[it->first] != it->second){
+                msg << " [" << it->first << "] expected " << it->second << " got " << actual[it->first];
+            }
+        }
+        for (map<uint64_t, uint64_t>::const_iterator it = actual.begin(); it != actual.end(); it++){
+            if (expected.count(it->first) == 0){
+                msg << " [" << it->first << "] expected 0 got " << it->second;
+            }
+        }
+        Fail(msg.str());
+    }
+    comparisons++;
+}
+
+static uint64_t NaiveCountAtMost(map<uint64_t, uint64_t>& expected, uint64_t invalid, uint64_t d){
+    uint64_t c = 0;
+    for (map<uint64_t, uint64_t>::const_iterator it = expected.begin(); it != expected.end(); it++){
+        if (it->first != invalid && it->first <= d){
+            c += it->second;
+        }
+    }
+    return c;
+}
+
+static uint64_t NaiveQuantile(map<uint64_t, uint64_t>& expected, uint64_t invalid, uint64_t accesses, double q){
+    uint64_t target = (uint64_t)ceil(q * (double)accesses);
+    if (target == 0){
+        target = 1;
+    }
+    uint64_t c = 0;
+    for (map<uint64_t, uint64_t>::const_iterator it = expected.begin(); it != expected.end(); it++){
+        if (it->first != invalid){
+            c += it->second;
+            if (c >= target){
+                return it->first;
+            }
+        }
+    }
+    return invalid;
+}
+
+static void CompareQueries(ReuseStats* s, map<uint64_t, uint64_t>& expected, uint64_t accesses, uint64_t invalid){
+    static const uint64_t points[] = { 0, 1, 2, 5, 17, 100, 1000, 1L << 40, 0xFFFFFFFFFFFFFFFEL };
+    static const double quantiles[] = { 0.0, 0.1, 0.5, 0.9, 0.99, 1.0 };
+
+    for (uint32_t i = 0; i < sizeof(points) / sizeof(uint64_t); i++){
+        if (s->CountAtMost(points[i]) != NaiveCountAtMost(expected, invalid, points[i])){
+            Fail("CountAtMost differs");
+        }
+        if (s->CountMisses(points[i]) != accesses - NaiveCountAtMost(expected, invalid, points[i])){
+            Fail("CountMisses differs");
+        }
+        for (uint32_t j = 0; j <= i; j++){
+            uint64_t lo = NaiveCountAtMost(expected, invalid, points[j] ? points[j] - 1 : 0);
+            uint64_t naive = NaiveCountAtMost(expected, invalid, points[i]) - (points[j] ? lo : 0);
+            if (s->CountRange(points[j], points[i]) != naive){
+                Fail("CountRange differs");
+            }
+        }
+    }
+    for (uint32_t i = 0; i < sizeof(quantiles) / sizeof(double); i++){
+        if (s->GetQuantile(quantiles[i]) != NaiveQuantile(expected, invalid, accesses, quantiles[i])){
+            Fail("GetQuantile differs");
+        }
+    }
+}
+
+static void Compare(ReuseDistance* r, ReferenceAnalyzer& o){
+    vector<uint64_t> ids;
+    r->GetIndices(ids);
+    if (ids.size() != o.accesses.size()){
+        Fail("the set of ids differs");
+    }
+    for (vector<uint64_t>::const_iterator it = ids.begin(); it != ids.end(); it++){
+        if (o.accesses.count(*it) == 0){
+            Fail("found an id that was never used");
+        }
+        CompareStats(r->GetStats(*it), o.counts[*it], o.accesses[*it], *it);
+        CompareQueries(r->GetStats(*it), o.counts[*it], o.accesses[*it], o.GetInvalid());
+    }
+
+    // the same queries across all ids, and the ids with the most misses
+    map<uint64_t, uint64_t> all;
+    uint64_t total = 0;
+    vector<pair<uint64_t, uint64_t> > naivetop;
+    for (map<uint64_t, uint64_t>::const_iterator it = o.accesses.begin(); it != o.accesses.end(); it++){
+        map<uint64_t, uint64_t>& m = o.counts[it->first];
+        for (map<uint64_t, uint64_t>::const_iterator jt = m.begin(); jt != m.end(); jt++){
+            all[jt->first] += jt->second;
+        }
+        total += it->second;
+        naivetop.push_back(pair<uint64_t, uint64_t>(it->first, it->second - NaiveCountAtMost(m, o.GetInvalid(), 16)));
+    }
+    if (total){
+        CompareStats(r->GetAggregateStats(), all, total, 0);
+        CompareQueries(r->GetAggregateStats(), all, total, o.GetInvalid());
+    } else if (r->GetAggregateStats() != NULL){
+        Fail("aggregate stats exist without any accesses");
+    }
+
+    vector<pair<uint64_t, uint64_t> > top;
+    r->GetTopMissIds(16, 5, top);
+    for (uint32_t i = 0; i < top.size(); i++){
+        for (uint32_t j = 0; j < naivetop.size(); j++){
+            if (naivetop[j].second > top[i].second || (naivetop[j].second == top[i].second && naivetop[j].first < top[i].first)){
+                bool listed = false;
+                for (uint32_t k = 0; k < i; k++){
+                    listed = listed || (top[k].first == naivetop[j].first);
+                }
+                if (!listed){
+                    Fail("GetTopMissIds skipped an id");
+                }
+            }
+        }
+    }
+    if (top.size() != min((uint64_t)5, (uint64_t)naivetop.size())){
+        Fail("GetTopMissIds returned the wrong number of ids");
+    }
+
+    vector<uint64_t> actual, expected;
+    r->GetActiveAddresses(actual);
+    o.GetActiveAddresses(expected);
+    if (actual != expected){
+        Fail("active addresses differ");
+    }
+
+    ReuseEngineStats es;
+    r->GetEngineStats(es);
+    uint64_t accesses = 0;
+    for (map<uint64_t, uint64_t>::const_iterator it = o.accesses.begin(); it != o.accesses.end(); it++){
+        accesses += it->second;
+    }
+    if (es.windowsize != o.GetWindowSize() || es.statsobjects != ids.size() || es.accesses != accesses){
+        Fail("engine stats differ");
+    }
+}
+
+// a ByteReuseDistance is given objects of up to maxsize bytes, anything else is given ReuseEntry
+static void Run(ReuseDistance* r, ReferenceAnalyzer& o, vector<TraceOp>& trace, uint64_t maxsize = 0){
+    ReuseEntry entry;
+    ByteReuseEntry object;
+    for (uint64_t i = 0; i < trace.size(); i++){
+        TraceOp& op = trace[i];
+        if (op.kind == OpSkip){
+            r->SkipAddresses(op.address);
+            o.Skip();
+        } else if (op.kind == OpInvalidate){
+            r->Invalidate(op.address);
+            o.Invalidate(op.address);
+        } else if (maxsize){
+            object.id = op.id;
+            object.address = op.address;
+            object.size = ObjectSize(op.address, maxsize);
+            ((ByteReuseDistance*)r)->Process(object);
+            o.Process(op.id, op.address);
+        } else {
+            entry.id = op.id;
+            entry.address = op.address;
+            r->Process(entry);
+            o.Process(op.id, op.address);
+        }
+    }
+    Compare(r, o);
+}
+
+// the same as Run, but consecutive accesses are handed over in arrays of random length
+static void RunArrays(ReuseDistance* r, ReferenceAnalyzer& o, vector<TraceOp>& trace){
+    vector<ReuseEntry> entries;
+    uint64_t limit = 1 + Choose(3 * ReuseDistance::BulkSize);
+    for (uint64_t i = 0; i <= trace.size(); i++){
+        if (i == trace.size() || trace[i].kind != OpAccess || entries.size() == limit){
+            uint64_t how = Choose(16);
+            if (entries.size() && how == 0){
+                r->Process(entries);
+            } else if (entries.size() && how == 1){
+                vector<ReuseEntry*> pointers;
+                for (uint64_t j = 0; j < entries.size(); j++){
+                    pointers.push_back(&entries[j]);
+                }
+                r->Process(pointers);
+            } else if (entries.size()){
+                r->Process(&entries[0], entries.size());
+            }
+            entries.clear();
+            limit = 1 + Choose(3 * ReuseDistance::BulkSize);
+        }
+        if (i == trace.size()){
+            break;
+        }
+
+        TraceOp& op = trace[i];
+        if (op.kind == OpSkip){
+            r->SkipAddresses(op.address);
+            o.Skip();
+        } else if (op.kind == OpInvalidate){
+            r->Invalidate(op.address);
+            o.Invalidate(op.address);
+        } else {
+            ReuseEntry entry;
+            entry.id = op.id;
+            entry.address = op.address;
+            entries.push_back(entry);
+            o.Process(op.id, op.address);
+        }
+    }
+    Compare(r, o);
+}
+
+static void CheckReuse(vector<TraceOp>& trace, uint64_t w, uint64_t b, uint64_t m, uint32_t e, uint32_t i){
+    ostringstream c;
+    c << "ReuseDistance(" << w << ", " << b << ", " << m << ", window " << e << ", index " << i << ")";
+    context = c.str();
+
+    ReuseDistance* r = new ReuseDistance(w, b, m, e, i);
+    ReferenceReuse o(w, b);
+    Run(r, o, trace);
+    delete r;
+
+    context += ", in arrays";
+    r = new ReuseDistance(w, b, m, e, i);
+    ReferenceReuse a(w, b);
+    RunArrays(r, a, trace);
+    delete r;
+}
+
+static void CheckBytes(vector<TraceOp>& trace, uint64_t w, uint64_t b, uint64_t s){
+    ostringstream c;
+    c << "ByteReuseDistance(" << w << ", " << b << ") with objects of up to " << s << " bytes";
+    context = c.str();
+
+    ReuseDistance* r = new ByteReuseDistance(w, b);
+    ReferenceBytes o(w, b, s);
+    Run(r, o, trace, s);
+    delete r;
+
+    // with 1-byte objects it is a ReuseDistance
+    context += ", as ReuseEntry";
+    r = new ByteReuseDistance(w, b);
+    ReferenceReuse u(w, b);
+    Run(r, u, trace);
+    delete r;
+}
+
+// the average number of distinct addresses over every window of w accesses
+static double NaiveFootprint(vector<uint64_t>& addrs, uint64_t w){
+    map<uint64_t, uint64_t> inside;
+    uint64_t distinct = 0;
+    double sum = 0.0;
+    for (uint64_t i = 0; i < addrs.size(); i++){
+        if (inside[addrs[i]]++ == 0){
+            distinct++;
+        }
+        if (i >= w && --inside[addrs[i - w]] == 0){
+            distinct--;
+        }
+        if (i + 1 >= w){
+            sum += distinct;
+        }
+    }
+    return sum / (addrs.size() - w + 1);
+}
+
+static void CheckTime(vector<TraceOp>& trace, uint64_t b){
+    ostringstream c;
+    c << "ReuseTime(" << b << ")";
+    context = c.str();
+
+    ReuseTime* r = new ReuseTime(b);
+    ReferenceTime o(b);
+    Run(r, o, trace);
+
+    // the footprint is exact for a trace without skips or invalidations
+    vector<uint64_t> addrs;
+    for (uint64_t i = 0; i < trace.size(); i++){
+        if (trace[i].kind != OpAccess){
+            addrs.clear();
+            break;
+        }
+        addrs.push_back(trace[i].address);
+    }
+    static const uint64_t windows[] = { 1, 2, 17, 300, 5000 };
+    for (uint32_t i = 0; i < 5 && addrs.size(); i++){
+        double expected = NaiveFootprint(addrs, windows[i]);
+        if (fabs(r->GetFootprint(windows[i]) - expected) > 1e-6 * (1.0 + expected)){
+            Fail("footprint differs");
+        }
+        comparisons++;
+    }
+
+    vector<uint64_t> sizes;
+    vector<double> ratios;
+    for (uint64_t size = 1; size < 4096; size = size * 3 + 1){
+        sizes.push_back(size);
+    }
+    r->GetMissRatioCurve(sizes, ratios);
+    for (uint32_t i = 0; i < sizes.size(); i++){
+        if (ratios[i] != r->GetMissRatio(sizes[i]) || ratios[i] < 0.0 || ratios[i] > 1.0){
+            Fail("miss ratio curve is inconsistent");
+        }
+    }
+    delete r;
+}
+
+static void CheckSpatial(vector<TraceOp>& trace, uint64_t w, uint64_t b, uint64_t n, uint32_t e){
+    ostringstream c;
+    c << "SpatialLocality(" << w << ", " << b << ", " << n << ", engine " << e << ")";
+    context = c.str();
+
+    ReuseDistance* r = new SpatialLocality(w, b, n, e);
+    ReferenceSpatial o(w, b, n);
+    Run(r, o, trace);
+    delete r;
+}
+
+/*
+ * A MultiSpatialLocality is checked against one SpatialLocality per window size, which have
+ * already been checked against the reference.
+ */
+static void CheckMultiSpatial(vector<TraceOp>& trace, vector<uint64_t>& sizes, uint64_t b, uint64_t n){
+    ostringstream c;
+    c << "MultiSpatialLocality(";
+    for (uint32_t k = 0; k < sizes.size(); k++){
+        c << (k ? " " : "") << sizes[k];
+    }
+    c << ", " << b << ", " << n << ")";
+    context = c.str();
+
+    MultiSpatialLocality* r = new MultiSpatialLocality(sizes, b, n);
+    vector<SpatialLocality*> x;
+    for (uint32_t k = 0; k < sizes.size(); k++){
+        x.push_back(new SpatialLocality(sizes[k], b, n));
+    }
+
+    ReuseEntry entry;
+    for (uint64_t i = 0; i < trace.size(); i++){
+        TraceOp& op = trace[i];
+        entry.id = op.id;
+        entry.address = op.address;
+        if (op.kind == OpSkip){
+            r->SkipAddresses(op.address);
+        } else if (op.kind == OpInvalidate){
+            r->Invalidate(op.address);
+        } else {
+            r->Process(entry);
+        }
+        for (uint32_t k = 0; k < x.size(); k++){
+            if (op.kind == OpSkip){
+                x[k]->SkipAddresses(op.address);
+            } else if (op.kind == OpInvalidate){
+                x[k]->Invalidate(op.address);
+            } else {
+                x[k]->Process(entry);
+            }
+        }
+    }
+
+    ostringstream rs, xs;
+    r->Print(rs, false);
+    for (uint32_t k = 0; k < x.size(); k++){
+        x[k]->Print(xs, false);
+    }
+    if (rs.str() != xs.str()){
+        Fail("window sizes give different stats when shared");
+    }
+    comparisons += x.size();
+
+    vector<uint64_t> ra, xa;
+    r->GetActiveAddresses(ra);
+    x.back()->GetActiveAddresses(xa);
+    if (ra != xa){
+        Fail("shared window holds different addresses");
+    }
+
+    ReuseEngineStats rstats, xstats;
+    r->GetEngineStats(rstats);
+    x.back()->GetEngineStats(xstats);
+    if (rstats.windowsize != xstats.windowsize || rstats.accesses != xstats.accesses){
+        Fail("shared window engine stats differ");
+    }
+
+    delete r;
+    for (uint32_t k = 0; k < x.size(); k++){
+        delete x[k];
+    }
+}
+
+static void CheckStride(vector<TraceOp>& trace, uint64_t b, uint64_t n){
+    ostringstream c;
+    c << "StrideLocality(" << b << ", " << n << ")";
+    context = c.str();
+
+    StrideLocality* r = new StrideLocality(b, n);
+    ReferenceStride o(b, n);
+    Run(r, o, trace);
+
+    for (map<uint64_t, map<int64_t, uint64_t> >::const_iterator it = o.strides.begin(); it != o.strides.end(); it++){
+        vector<pair<int64_t, uint64_t> > actual;
+        r->GetStrides(it->first, actual);
+        vector<pair<int64_t, uint64_t> > expected(it->second.begin(), it->second.end());
+        if (actual != expected){
+            Fail("signed strides differ");
+        }
+
+        // the most common exact stride, closest to 0 and then positive on ties
+        int64_t dominant = 0;
+        uint64_t dcount = 0;
+        for (uint64_t i = 0; i < expected.size(); i++){
+            int64_t k = expected[i].first;
+            uint64_t m = (k < 0) ? 0 - (uint64_t)k : (uint64_t)k;
+            if (b != ReuseDistance::Infinity && m > b){
+                continue;
+            }
+            uint64_t dm = (dominant < 0) ? 0 - (uint64_t)dominant : (uint64_t)dominant;
+            if (expected[i].second > dcount || (expected[i].second == dcount && (m < dm || (m == dm && k > 0)))){
+                dominant = k;
+                dcount = expected[i].second;
+            }
+        }
+        int64_t s;
+        if (r->GetDominantStride(it->first, &s) != dcount || s != dominant){
+            Fail("dominant strides differ");
+        }
+        comparisons++;
+    }
+    delete r;
+}
+
+static void CheckThreaded(vector<TraceOp>& trace, uint64_t w, uint64_t b, uint64_t p, uint32_t workers, bool inv){
+    ostringstream c;
+    c << "ThreadedReuseDistance(" << w << ", " << b << ", " << p << ", " << workers << ", " << inv << ")";
+    context = c.str();
+
+    ThreadedReuseDistance* r = new ThreadedReuseDistance(w, b, p, workers, inv);
+    ReferenceReuse shared(w, b);
+    map<uint32_t, ReferenceReuse*> priv;
+
+    // hand the trace over in batches that end at each skip, as a tool would, and otherwise at random
+    // lengths, some of them single addresses. ThreadedReuseDistance has no per-thread invalidation
+    // of its own, so invalidations are treated as plain accesses
+    vector<ThreadedReuseEntry> batch;
+    uint64_t limit = 1 + Choose(3 * ThreadedReuseDistance::BatchSize / 2);
+    for (uint64_t i = 0; i <= trace.size(); i++){
+        if (i == trace.size() || trace[i].kind == OpSkip || batch.size() == limit){
+            if (batch.size() == 1){
+                r->Process(batch[0]);
+            } else if (batch.size()){
+                r->Process(&batch[0], batch.size());
+            }
+            batch.clear();
+            limit = 1 + Choose(3 * ThreadedReuseDistance::BatchSize / 2);
+        }
+        if (i == trace.size() || trace[i].kind == OpSkip){
+            if (i < trace.size()){
+                r->SkipAddresses(trace[i].address);
+                shared.Skip();
+                for (map<uint32_t, ReferenceReuse*>::const_iterator it = priv.begin(); it != priv.end(); it++){
+                    it->second->Skip();
+                }
+            }
+            continue;
+        }
+
+        TraceOp& op = trace[i];
+        ThreadedReuseEntry t;
+        t.id = op.id;
+        t.address = op.address;
+        t.thread = op.thread;
+        t.write = op.write;
+        batch.push_back(t);
+
+        shared.Process(op.id, op.address);
+        if (priv.count(op.thread) == 0){
+            priv[op.thread] = new ReferenceReuse(p, b);
+        }
+        priv[op.thread]->Process(op.id, op.address);
+        if (inv && op.write){
+            for (map<uint32_t, ReferenceReuse*>::const_iterator it = priv.begin(); it != priv.end(); it++){
+                if (it->first != op.thread){
+                    it->second->Invalidate(op.address);
+                }
+            }
+        }
+    }
+
+    Compare(r, shared);
+    for (map<uint32_t, ReferenceReuse*>::const_iterator it = priv.begin(); it != priv.end(); it++){
+        ostringstream t;
+        t << c.str() << " private window of thread " << it->first;
+        context = t.str();
+
+        ReferenceReuse* o = it->second;
+        for (map<uint64_t, uint64_t>::const_iterator jt = o->accesses.begin(); jt != o->accesses.end(); jt++){
+            CompareStats(r->GetPrivateStats(it->first, jt->first), o->counts[jt->first], jt->second, jt->first);
+        }
+        delete o;
+    }
+    delete r;
+}
+
+// each id has a reference window of its own
+static void CheckSharded(vector<TraceOp>& trace, uint64_t w, uint64_t b, uint32_t workers){
+    ostringstream c;
+    c << "ShardedReuseDistance(" << w << ", " << b << ", " << workers << ")";
+    context = c.str();
+
+    ShardedReuseDistance* r = new ShardedReuseDistance(w, b, workers);
+    map<uint64_t, ReferenceReuse*> ids;
+
+    vector<ReuseEntry> entries;
+    uint64_t limit = 1 + Choose(3 * ReuseDistance::BulkSize);
+    for (uint64_t i = 0; i <= trace.size(); i++){
+        if (i == trace.size() || trace[i].kind != OpAccess || entries.size() == limit){
+            if (entries.size() == 1){
+                r->Process(entries[0]);
+            } else if (entries.size()){
+                r->Process(&entries[0], entries.size());
+            }
+            entries.clear();
+            limit = 1 + Choose(3 * ReuseDistance::BulkSize);
+        }
+        if (i == trace.size()){
+            break;
+        }
+
+        TraceOp& op = trace[i];
+        if (op.kind == OpSkip){
+            r->SkipAddresses(op.address);
+            for (map<uint64_t, ReferenceReuse*>::const_iterator it = ids.begin(); it != ids.end(); it++){
+                it->second->Skip();
+            }
+        } else if (op.kind == OpInvalidate){
+            r->Invalidate(op.address);
+            for (map<uint64_t, ReferenceReuse*>::const_iterator it = ids.begin(); it != ids.end(); it++){
+                it->second->Invalidate(op.address);
+            }
+        } else {
+            ReuseEntry entry;
+            entry.id = op.id;
+            entry.address = op.address;
+            entries.push_back(entry);
+            if (ids.count(op.id) == 0){
+                ids[op.id] = new ReferenceReuse(w, b);
+            }
+            ids[op.id]->Process(op.id, op.address);
+        }
+    }
+
+    vector<uint64_t> indices;
+    r->GetIndices(indices);
+    if (indices.size() != ids.size()){
+        Fail("the set of ids differs");
+    }
+
+    uint64_t accesses = 0, windowsize = 0;
+    for (map<uint64_t, ReferenceReuse*>::const_iterator it = ids.begin(); it != ids.end(); it++){
+        ReferenceReuse* o = it->second;
+        CompareStats(r->GetStats(it->first), o->counts[it->first], o->accesses[it->first], it->first);
+        accesses += o->accesses[it->first];
+        windowsize += o->GetWindowSize();
+
+        vector<uint64_t> actual, expected;
+        r->GetActiveAddresses(it->first, actual);
+        o->GetActiveAddresses(expected);
+        if (actual != expected){
+            Fail("active addresses differ");
+        }
+        delete o;
+    }
+
+    ReuseEngineStats es;
+    r->GetEngineStats(es);
+    if (es.windowsize != windowsize || es.statsobjects != ids.size() || es.accesses != accesses){
+        Fail("engine stats differ");
+    }
+
+    ostringstream serial, parallel;
+    r->Print(serial);
+    r->Print(parallel, false, 3);
+    if (serial.str() != parallel.str()){
+        Fail("parallel Print differs");
+    }
+    delete r;
+}
+
+// distances are scaled bin by bin, so the expected histogram is the reference one with every
+// bin scaled and rebinned
+static void CheckScale(vector<TraceOp>& trace, uint64_t b, uint64_t f){
+    ostringstream c;
+    c << "ReuseDistance(" << ReuseDistance::Infinity << ", " << b << ") scaled by " << f;
+    context = c.str();
+
+    ReuseDistance* r = new ReuseDistance(ReuseDistance::Infinity, b);
+    ReferenceReuse o(ReuseDistance::Infinity, b);
+    Run(r, o, trace);
+    r->ScaleStats(f, f);
+
+    for (map<uint64_t, uint64_t>::const_iterator it = o.accesses.begin(); it != o.accesses.end(); it++){
+        map<uint64_t, uint64_t> expected;
+        map<uint64_t, uint64_t>& m = o.counts[it->first];
+        for (map<uint64_t, uint64_t>::const_iterator jt = m.begin(); jt != m.end(); jt++){
+            uint64_t d = jt->first;
+            if (d != ReuseDistance::Infinity){
+                d *= f;
+                if (b != ReuseDistance::Infinity && d > b){
+                    uint64_t p = 1;
+                    while (p < d){
+                        p <<= 1;
+                    }
+                    d = p;
+                }
+            }
+            expected[d] += jt->second * f;
+        }
+        CompareStats(r->GetStats(it->first), expected, it->second * f, it->first);
+    }
+    delete r;
+}
+
+// a copy read back from a ReuseExport should print the same as the ReuseDistance unless some
+// ids or bins did not fit, in which case what did fit should still be right
+static void CompareExport(ReuseDistance* r, ReuseExportReader& reader){
+    if (!reader.Read()){
+        Fail("no consistent copy of the export segment");
+    }
+    const ReuseExportHeader& h = reader.GetHeader();
+
+    bool complete = (h.dropped == 0);
+    for (uint64_t i = 0; i < reader.GetIdCount(); i++){
+        const ReuseExportId& x = reader.GetId(i);
+        ReuseStats* s = r->GetStats(x.id);
+        if (s == NULL || x.accesses != s->GetAccessCount() || x.misses != s->GetMissCount() || x.count > x.total){
+            Fail("exported id differs");
+        }
+        vector<uint64_t> dists;
+        s->GetSortedDistances(dists);
+        if (x.total != dists.size() - (s->GetMissCount() ? 1 : 0)){
+            Fail("exported bin count differs");
+        }
+        const ReuseExportBin* b = reader.GetBins(i);
+        for (uint64_t j = 0; j < x.count; j++){
+            if (b[j].count != s->CountDistance(b[j].upper) || (j && b[j].upper <= b[j - 1].upper)){
+                Fail("exported bin differs");
+            }
+        }
+        complete = complete && (x.count == x.total);
+    }
+
+    vector<uint64_t> ids;
+    r->GetIndices(ids);
+    if (h.idcount + h.dropped != ids.size()){
+        Fail("the number of exported ids differs");
+    }
+    if (complete){
+        ostringstream expected, actual;
+        r->Print(expected);
+        reader.Print(actual);
+        if (expected.str() != actual.str()){
+            Fail("exported output differs from Print");
+        }
+    }
+    comparisons += reader.GetIdCount();
+}
+
+static void CheckExport(vector<TraceOp>& trace, uint64_t w, uint64_t b, uint64_t i, uint64_t n, uint64_t interval){
+    ostringstream c;
+    c << "ReuseExport(" << i << ", " << n << ") of ReuseDistance(" << w << ", " << b << ") every " << interval;
+    context = c.str();
+
+    ostringstream name;
+    name << "/reuse-oracle." << getpid();
+    ReuseExport* e = new ReuseExport(name.str().c_str(), i, n);
+    if (!e->IsOpen()){
+        Fail("cannot create the export segment");
+    }
+    ReuseExportReader reader(name.str().c_str());
+
+    ReuseDistance* r = new ReuseDistance(w, b);
+    ReferenceReuse o(w, b);
+    r->SetExport(e, interval);
+
+    // publishes come from SetExport and from the random extra calls below
+    uint64_t processed = 0, extra = 0;
+    vector<ReuseEntry> entries;
+    uint64_t limit = 1 + Choose(2 * interval);
+    for (uint64_t k = 0; k <= trace.size(); k++){
+        if (k == trace.size() || trace[k].kind != OpAccess || entries.size() == limit){
+            if (entries.size() == 1){
+                r->Process(entries[0]);
+            } else if (entries.size()){
+                r->Process(&entries[0], entries.size());
+            }
+            processed += entries.size();
+            entries.clear();
+            limit = 1 + Choose(2 * interval);
+            if (Choose(4) == 0){
+                e->Publish(r);
+                extra++;
+                CompareExport(r, reader);
+            }
+        }
+        if (k == trace.size()){
+            break;
+        }
+
+        TraceOp& op = trace[k];
+        if (op.kind == OpSkip){
+            r->SkipAddresses(op.address);
+            o.Skip();
+        } else if (op.kind == OpInvalidate){
+            r->Invalidate(op.address);
+            o.Invalidate(op.address);
+        } else {
+            ReuseEntry entry;
+            entry.id = op.id;
+            entry.address = op.address;
+            entries.push_back(entry);
+            o.Process(op.id, op.address);
+        }
+    }
+    Compare(r, o);
+
+    e->Publish(r);
+    CompareExport(r, reader);
+    if (reader.GetHeader().publishes != processed / interval + extra + 1){
+        Fail("the number of publishes differs");
+    }
+
+    delete r;
+    delete e;
+}
+
+static bool ReferenceHex(const string& s, uint64_t& v){
+    string digits = s;
+    if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')){
+        digits = digits.substr(2);
+    }
+    if (digits.size() == 0 || digits.size() > 16 || digits.find_first_not_of("0123456789abcdefABCDEF") != string::npos){
+        return false;
+    }
+    v = strtoull(digits.c_str(), NULL, 16);
+    return true;
+}
+
+static bool ReferenceDecimal(const string& s, uint64_t& v){
+    if (s.size() == 0 || s.size() > 19 || s.find_first_not_of("0123456789") != string::npos){
+        return false;
+    }
+    v = strtoull(s.c_str(), NULL, 10);
+    return true;
+}
+
+static void Tokens(const string& line, vector<string>& tokens){
+    istringstream in(line);
+    string t;
+    while (in >> t){
+        tokens.push_back(t);
+    }
+}
+
+// the documented layout of each trace format, read the slow way, one line at a time
+class ReferenceFormat {
+public:
+    virtual ~ReferenceFormat() {}
+    virtual bool Parse(const string& line, ReuseEntry& r, ReuseAccess& a, uint64_t& period) = 0;
+};
+
+class ReferencePerfScript : public ReferenceFormat {
+private:
+    uint64_t fixed;
+
+public:
+    ReferencePerfScript(uint64_t p) : fixed(p) {}
+
+    virtual bool Parse(const string& line, ReuseEntry& r, ReuseAccess& a, uint64_t& period){
+        vector<string> tokens;
+        Tokens(line, tokens);
+        for (uint32_t i = 0; i < tokens.size(); i++){
+            string& s = tokens[i];
+            if (s[0] == '#'){
+                return false;
+            }
+            if (s[s.size() - 1] != ':'){
+                continue;
+            }
+            string stem = s.substr(0, s.size() - 1);
+            if (stem.size() && stem.find_first_not_of("0123456789.") == string::npos){
+                continue;
+            }
+
+            period = fixed;
+            if (period == 0 && (i == 0 || !ReferenceDecimal(tokens[i - 1], period))){
+                return false;
+            }
+            a.type = (s.find("store") != string::npos) ? ReuseTraceReader::AccessWrite : ReuseTraceReader::AccessRead;
+            a.size = 0;
+            return i + 2 < tokens.size() && ReferenceHex(tokens[i + 1], r.address) && ReferenceHex(tokens[i + 2], r.id);
+        }
+        return false;
+    }
+};
+
+class ReferencePerfRaw : public ReferenceFormat {
+private:
+    uint64_t fixed;
+    uint32_t ipcol;
+    uint32_t addrcol;
+    uint32_t dsrccol;
+
+public:
+    ReferencePerfRaw(uint64_t p) : fixed(p), ipcol(2), addrcol(3), dsrccol(5) {}
+
+    virtual bool Parse(const string& line, ReuseEntry& r, ReuseAccess& a, uint64_t& period){
+        uint64_t p = line.find_first_not_of(" \t\r");
+        if (p != string::npos && line[p] == '#'){
+            istringstream in(line.substr(p + 1));
+            string name;
+            uint32_t ip = 0xFFFFFFFF, addr = 0xFFFFFFFF, dsrc = 0xFFFFFFFF;
+            for (uint32_t col = 0; getline(in, name, ','); col++){
+                uint64_t b = name.find_first_not_of(" \t\r");
+                uint64_t e = name.find_last_not_of(" \t\r");
+                name = (b == string::npos) ? "" : name.substr(b, e - b + 1);
+                if (name == "IP"){
+                    ip = col;
+                } else if (name == "ADDR"){
+                    addr = col;
+                } else if (name == "DSRC"){
+                    dsrc = col;
+                }
+            }
+            if (ip != 0xFFFFFFFF && addr != 0xFFFFFFFF){
+                ipcol = ip;
+                addrcol = addr;
+                dsrccol = dsrc;
+            }
+            return false;
+        }
+
+        string spaced = line;
+        replace(spaced.begin(), spaced.end(), ',', ' ');
+        vector<string> tokens;
+        Tokens(spaced, tokens);
+        if (ipcol >= tokens.size() || addrcol >= tokens.size() || !ReferenceHex(tokens[ipcol], r.id) || !ReferenceHex(tokens[addrcol], r.address)){
+            return false;
+        }
+        uint64_t dsrc = 0;
+        if (dsrccol < tokens.size() && !ReferenceHex(tokens[dsrccol], dsrc)){
+            dsrc = 0;
+        }
+        a.type = (dsrc & 0x4) ? ReuseTraceReader::AccessWrite : ReuseTraceReader::AccessRead;
+        a.size = 0;
+        period = fixed;
+        return true;
+    }
+};
+
+class ReferenceDinero : public ReferenceFormat {
+private:
+    uint32_t size;
+
+public:
+    ReferenceDinero(uint32_t s) : size(s) {}
+
+    virtual bool Parse(const string& line, ReuseEntry& r, ReuseAccess& a, uint64_t& period){
+        vector<string> tokens;
+        Tokens(line, tokens);
+        if (tokens.size() < 2 || (tokens[0] != "0" && tokens[0] != "1" && tokens[0] != "2") || !ReferenceHex(tokens[1], r.address)){
+            return false;
+        }
+        uint64_t s = size;
+        if (tokens.size() > 2 && (!ReferenceDecimal(tokens[2], s) || s > 0xFFFFFFFF)){
+            return false;
+        }
+        a.type = tokens[0][0] - '0';
+        a.size = s;
+        r.id = a.type;
+        period = 1;
+        return true;
+    }
+};
+
+class ReferenceLackey : public ReferenceFormat {
+public:
+    virtual bool Parse(const string& line, ReuseEntry& r, ReuseAccess& a, uint64_t& period){
+        string l = line;
+        replace(l.begin(), l.end(), ',', ' ');
+        vector<string> tokens;
+        Tokens(l, tokens);
+        uint64_t s;
+        if (tokens.size() < 3 || tokens[0].size() != 1 || !ReferenceHex(tokens[1], r.address) || !ReferenceDecimal(tokens[2], s) || s > 0xFFFFFFFF){
+            return false;
+        }
+        // the address and size are only separated by a comma
+        if (line.find(tokens[1] + "," + tokens[2]) == string::npos){
+            return false;
+        }
+
+        static const string types = "LSIM";
+        uint64_t t = types.find(tokens[0][0]);
+        if (t == string::npos){
+            return false;
+        }
+        a.type = t;
+        a.size = s;
+        r.id = a.type;
+        period = 1;
+        return true;
+    }
+};
+
+// reads text through a ReuseTraceReader in arrays of random length, and compares every
+// access, the line counts and the mean period against the reference reading of each line
+static void CompareTrace(ReuseTraceReader* reader, const string& text, ReferenceFormat& format){
+    vector<ReuseEntry> expected;
+    vector<ReuseAccess> expectedaccesses;
+    uint64_t lines = 0, periods = 0;
+    istringstream in(text);
+    string line;
+    while (getline(in, line)){
+        lines++;
+        ReuseEntry r;
+        ReuseAccess a;
+        uint64_t period;
+        if (format.Parse(line, r, a, period)){
+            expected.push_back(r);
+            expectedaccesses.push_back(a);
+            periods += period;
+        }
+    }
+
+    vector<ReuseEntry> actual;
+    vector<ReuseAccess> accesses;
+    vector<ReuseEntry> chunk;
+    vector<ReuseAccess> chunkaccesses;
+    while (true){
+        chunk.resize(1 + Choose(1000));
+        chunkaccesses.resize(chunk.size());
+        uint64_t n = reader->Read(&chunk[0], &chunkaccesses[0], chunk.size());
+        actual.insert(actual.end(), chunk.begin(), chunk.begin() + n);
+        accesses.insert(accesses.end(), chunkaccesses.begin(), chunkaccesses.begin() + n);
+        if (n < chunk.size()){
+            break;
+        }
+    }
+
+    if (actual.size() != expected.size()){
+        Fail("the number of addresses differs");
+    }
+    for (uint64_t i = 0; i < actual.size(); i++){
+        if (actual[i].id != expected[i].id || actual[i].address != expected[i].address ||
+            accesses[i].type != expectedaccesses[i].type || accesses[i].size != expectedaccesses[i].size){
+            ostringstream msg;
+            msg << "access " << i << " differs";
+            Fail(msg.str());
+        }
+    }
+    if (reader->GetLineCount() != lines || reader->GetSkippedCount() != lines - expected.size()){
+        Fail("line counts differ");
+    }
+    uint64_t period = (expected.size() && periods >= expected.size()) ? (periods + expected.size() / 2) / expected.size() : 1;
+    if (reader->GetPeriod() != period){
+        Fail("mean period differs");
+    }
+    comparisons++;
+}
+
+static string ReadFile(const char* path){
+    ifstream f(path);
+    if (!f){
+        Fail("cannot open sample file");
+    }
+    ostringstream text;
+    text << f.rdbuf();
+    return text.str();
+}
+
+static void CheckSampleFile(const char* path, ReuseTraceReader* reader, ReferenceFormat& format, uint64_t records, uint64_t skipped){
+    context = path;
+    if (!reader->IsOpen()){
+        Fail("cannot open sample file");
+    }
+    CompareTrace(reader, ReadFile(path), format);
+    if (reader->GetRecordCount() != records || reader->GetSkippedCount() != skipped){
+        Fail("the sample file was not read as expected");
+    }
+    delete reader;
+}
+
+// the text is read from a temporary file, so that it is read the same way as a real trace
+static void CheckRandomTrace(const string& text, ReuseTraceReader* (*open)(int), ReferenceFormat& format){
+    FILE* f = tmpfile();
+    if (f == NULL || fwrite(text.data(), 1, text.size(), f) != text.size() || fflush(f) || lseek(fileno(f), 0, SEEK_SET)){
+        Fail("cannot write a temporary file");
+    }
+    ReuseTraceReader* reader = open(fileno(f));
+    CompareTrace(reader, text, format);
+    delete reader;
+    fclose(f);
+}
+
+static string RandomHex(uint64_t v){
+    ostringstream s;
+    if (Choose(4) == 0){
+        s << "0x";
+    }
+    s << hex << v;
+    return s.str();
+}
+
+// traces have damaged lines, a line longer than a block and no newline at the end, and are
+// long enough to cross several input blocks
+#define RANDOM_TRACE_LINES (40000)
+
+static string RandomPerfScript(bool period){
+    static const char* events[] = { "cpu/mem-loads,ldlat=30/P:", "cpu/mem-stores/P:", "mem-loads:", "cpu_core/mem-loads-aux/:" };
+    static const char* syms[] = { "main+0x46", "std::vector<long, std::allocator<long> >::push_back(long const&)+0x24", "[unknown]", "" };
+
+    ostringstream s;
+    for (uint32_t i = 0; i < RANDOM_TRACE_LINES; i++){
+        uint64_t kind = Choose(20);
+        if (kind == 0){
+            s << "\t    " << hex << (0x400000 + Choose(4096)) << dec << " main+0x10 (/opt/bench/mcf)\n";
+            continue;
+        } else if (kind == 1){
+            s << "\n";
+            continue;
+        } else if (kind == 2){
+            s << "# captured on: Thu Oct  8 10:00:00 2026\n";
+            continue;
+        }
+
+        if (Choose(2)){
+            s << "             mcf ";
+        }
+        if (Choose(2)){
+            s << " " << (2964 + Choose(8)) << "/" << (2964 + Choose(8));
+        }
+        if (Choose(2)){
+            s << " [00" << Choose(4) << "]";
+        }
+        if (Choose(2)){
+            s << " " << (1138 + Choose(10)) << "." << (100000 + Choose(900000)) << ":";
+        }
+        if (period){
+            s << " " << (kind == 3 ? "12x" : "") << (9900 + Choose(200));
+        }
+        s << " " << events[Choose(4)];
+        s << " " << (kind == 4 ? "zz" : RandomHex(0x55d0c3a4e2a0 + 64 * Choose(5000)));
+        if (kind != 5){
+            s << " " << RandomHex(0x401000 + Choose(300));
+        }
+        if (Choose(2)){
+            s << " " << syms[Choose(4)];
+            if (Choose(2)){
+                s << " (/opt/bench/mcf)";
+            }
+        }
+        if (i == RANDOM_TRACE_LINES / 2){
+            s << " " << string(ReuseTraceReader::BufferSize + 100, 'x');
+        }
+        s << (Choose(10) ? "\n" : "\r\n");
+    }
+    s << "mcf 1138.5: 10000 mem-loads: 7ffd4b4e9c28 401a16";
+    return s.str();
+}
+
+static string RandomDinero(){
+    ostringstream s;
+    for (uint32_t i = 0; i < RANDOM_TRACE_LINES; i++){
+        uint64_t kind = Choose(30);
+        if (kind == 0){
+            s << "4 0\n";
+            continue;
+        } else if (kind == 1){
+            s << "\n";
+            continue;
+        }
+
+        s << (kind == 2 ? "7" : (kind == 3 ? "01" : "")) << Choose(3);
+        s << (Choose(2) ? " " : "\t") << (kind == 4 ? "g" : "") << RandomHex(0x601000 + 8 * Choose(20000));
+        if (Choose(2)){
+            s << " " << (kind == 5 ? "-" : "") << (1 << Choose(4));
+        }
+        if (i == RANDOM_TRACE_LINES / 2){
+            s << string(ReuseTraceReader::BufferSize + 100, ' ');
+        }
+        s << (Choose(10) ? "\n" : "\r\n");
+    }
+    s << "2 400a10";
+    return s.str();
+}
+
+static string RandomLackey(){
+    static const char types[] = "ILSMX";
+    ostringstream s;
+    for (uint32_t i = 0; i < RANDOM_TRACE_LINES; i++){
+        uint64_t kind = Choose(30);
+        if (kind == 0){
+            s << "==31337== Counted " << Choose(100) << " calls to main()\n";
+            continue;
+        } else if (kind == 1){
+            s << "\n";
+            continue;
+        }
+
+        char t = types[Choose(kind == 2 ? 5 : 4)];
+        s << (t == 'I' ? "I  " : (Choose(8) ? " " : "")) << (t == 'I' ? "" : string(1, t) + " ");
+        s << hex << setw(Choose(2) ? 8 : 9) << setfill('0') << (0x601000 + 8 * Choose(20000)) << dec;
+        s << (kind == 3 ? " " : "") << "," << (kind == 4 ? "x" : "") << (1 << Choose(4));
+        if (i == RANDOM_TRACE_LINES / 2){
+            s << string(ReuseTraceReader::BufferSize + 100, ' ');
+        }
+        s << (Choose(10) ? "\n" : "\r\n");
+    }
+    s << " L 7ff000398,8";
+    return s.str();
+}
+
+static ReuseTraceReader* OpenPerfScript(int f){
+    return new PerfScriptReader(f, 0);
+}
+
+static ReuseTraceReader* OpenPerfScriptFixed(int f){
+    return new PerfScriptReader(f, 997);
+}
+
+static ReuseTraceReader* OpenDinero(int f){
+    return new DineroReader(f, 4);
+}
+
+static ReuseTraceReader* OpenLackey(int f){
+    return new LackeyReader(f);
+}
+
+static void CheckTraceReaders(){
+    ReferencePerfScript script(0);
+    ReferencePerfScript fixed(997);
+    ReferencePerfRaw raw(10007);
+    ReferenceDinero dinero(4);
+    ReferenceLackey lackey;
+
+    CheckSampleFile("traces/perf-script.txt", new PerfScriptReader("traces/perf-script.txt", 0), script, 48, 6);
+    CheckSampleFile("traces/perf-raw.txt", new PerfRawReader("traces/perf-raw.txt", 10007), raw, 40, 1);
+    CheckSampleFile("traces/dinero.din", new DineroReader("traces/dinero.din", 4), dinero, 60, 1);
+    CheckSampleFile("traces/lackey.txt", new LackeyReader("traces/lackey.txt"), lackey, 56, 7);
+
+    context = "PerfScriptReader with periods";
+    CheckRandomTrace(RandomPerfScript(true), OpenPerfScript, script);
+    context = "PerfScriptReader with a fixed period";
+    CheckRandomTrace(RandomPerfScript(false), OpenPerfScriptFixed, fixed);
+    context = "DineroReader";
+    CheckRandomTrace(RandomDinero(), OpenDinero, dinero);
+    context = "LackeyReader";
+    CheckRandomTrace(RandomLackey(), OpenLackey, lackey);
+}
+
+/*
+ * A ReuseDistance that runs into its memory budget is only approximately right, so it is
+ * compared against an unlimited one within a tolerance.
+ */
+static void CheckBudget(uint64_t w, uint64_t m){
+    ostringstream c;
+    c << "ReuseDistance(" << w << ", 16, " << m << ") against ReuseDistance(" << w << ", 16)";
+    context = c.str();
+
+    ReuseDistance* r = new ReuseDistance(w, 16, m);
+    ReuseDistance* x = new ReuseDistance(w, 16);
+    ReuseEntry entry;
+    for (uint64_t i = 0; i < 1000000; i++){
+        uint64_t u = NextRandom() >> 20;
+        entry.id = u % 3;
+        entry.address = (Choose(4) == 0) ? Choose(300000) : Choose(20000);
+        r->Process(entry);
+        x->Process(entry);
+    }
+
+    ReuseEngineStats es;
+    r->GetEngineStats(es);
+    if (es.samplerate == 1){
+        Fail("the budget was never approached");
+    }
+    if (es.totalbytes > m){
+        Fail("the budget was exceeded");
+    }
+
+    for (uint64_t id = 0; id < 3; id++){
+        double acc = (double)r->GetStats(id)->GetAccessCount() / x->GetStats(id)->GetAccessCount();
+        double mis = (double)r->GetStats(id)->GetMissCount() / x->GetStats(id)->GetMissCount();
+        if (acc < 0.95 || acc > 1.05 || mis < 0.9 || mis > 1.1){
+            Fail("sampled counts are too far off");
+        }
+        comparisons++;
+    }
+    delete r;
+    delete x;
+}
+
+/*
+ * Windows too large for the reference are checked by comparing the bitmap window against the
+ * tree, including the order of the addresses left in the window.
+ */
+static void CheckWindows(uint64_t w, uint64_t u, uint32_t e, uint32_t i){
+    ostringstream c;
+    c << "ReuseDistance(" << w << ", 16) with window " << e << " and index " << i
+      << " against window " << ReuseDistance::WindowTree << " over " << u << " addresses";
+    context = c.str();
+
+    ReuseDistance* r = new ReuseDistance(w, 16, ReuseDistance::Infinity, e, i);
+    ReuseDistance* x = new ReuseDistance(w, 16, ReuseDistance::Infinity, ReuseDistance::WindowTree);
+    ReuseEntry entry;
+    for (uint64_t i = 0; i < 1000000; i++){
+        entry.id = Choose(3);
+        entry.address = (Choose(4) == 0) ? Choose(u) : Choose(w);
+        if (Choose(5000) == 0){
+            r->Invalidate(entry.address);
+            x->Invalidate(entry.address);
+        } else {
+            r->Process(entry);
+            x->Process(entry);
+        }
+    }
+
+    ostringstream rs, xs;
+    r->Print(rs, false);
+    x->Print(xs, false);
+    if (rs.str() != xs.str()){
+        Fail("window engines give different stats");
+    }
+    comparisons++;
+
+    vector<uint64_t> ra, xa;
+    r->GetActiveAddresses(ra);
+    x->GetActiveAddresses(xa);
+    if (ra != xa){
+        Fail("window engines hold different addresses");
+    }
+    delete r;
+    delete x;
+}
+
+static uint64_t FoldId(uint64_t id, void* arg){
+    return id % *(uint64_t*)arg;
+}
+
+/*
+ * An AnalyzerSet must give each of its analyzers the same stream it would have been given
+ * directly, after masking and mapping.
+ */
+static void CheckAnalyzerSet(uint64_t g, uint32_t t){
+    ostringstream c;
+    c << "AnalyzerSet(" << g << ", " << t << ")";
+    context = c.str();
+
+    uint64_t fold = 5;
+    AnalyzerSet* set = new AnalyzerSet(g, t);
+    set->SetIdMap(FoldId, &fold);
+
+    ReuseDistance* r[2][3];
+    for (uint32_t i = 0; i < 2; i++){
+        r[i][0] = new ReuseDistance(ReuseDistance::Infinity, 16);
+        r[i][1] = new ReuseDistance(300);
+        r[i][2] = new SpatialLocality(64, 8, ReuseDistance::Infinity);
+    }
+    for (uint32_t i = 0; i < 3; i++){
+        set->Add(r[0][i]);
+    }
+
+    // the set is fed in arrays of random length and single entries, the others all at once
+    vector<ReuseEntry> entries;
+    vector<ReuseEntry> direct;
+    uint64_t n = 3 * AnalyzerSet::BatchSize + 17;
+    for (uint64_t i = 0; i < n; i++){
+        ReuseEntry entry;
+        entry.id = Choose(40);
+        entry.address = (Choose(3) == 0) ? (NextRandom() >> 30) : Choose(5000);
+        entries.push_back(entry);
+
+        entry.id = entry.id % fold;
+        entry.address = entry.address & ~(g - 1);
+        direct.push_back(entry);
+
+        if (Choose(1000) == 0 || i == n - 1){
+            if (entries.size() == 1){
+                set->Process(entries[0]);
+            } else {
+                set->Process(&entries[0], entries.size());
+            }
+            entries.clear();
+        }
+    }
+    set->Flush();
+
+    for (uint32_t i = 0; i < 3; i++){
+        r[1][i]->Process(&direct[0], direct.size());
+
+        ostringstream rs, xs;
+        r[0][i]->Print(rs, false);
+        r[1][i]->Print(xs, false);
+        if (rs.str() != xs.str()){
+            Fail("an analyzer in the set saw a different stream");
+        }
+        comparisons++;
+    }
+
+    delete set;
+    for (uint32_t i = 0; i < 2; i++){
+        for (uint32_t j = 0; j < 3; j++){
+            delete r[i][j];
+        }
+    }
+}
+
+int main(int argc, char* argv[]){
+    uint64_t trials = DEFAULT_TRIALS;
+    uint64_t seed = DEFAULT_SEED;
+    if (argc > 1){
+        trials = strtol(argv[1], NULL, 10);
+    }
+    if (argc > 2){
+        seed = strtol(argv[2], NULL, 10);
+    }
+
+    static const uint64_t universes[] = { 16, 300, 2000 };
+    static const uint64_t idcounts[] = { 1, 4, 64, 1000 };
+
+    vector<TraceOp> trace;
+    for (uint64_t t = 0; t < trials; t++){
+        state = (seed + t) * 0x9E3779B97F4A7C15L + 1;
+
+        TraceShape shape;
+        shape.length = TRACE_LENGTH;
+        shape.universe = universes[t % 3];
+        shape.ids = idcounts[t % 4];
+        shape.threads = 1 + Choose(6);
+        shape.skipodds = (t % 2) ? 3000 : 0;
+        shape.invalidateodds = (t % 3) ? 200 : 0;
+        shape.local = (t % 4 < 2) ? 0 : 3;
+
+        Generate(trace, shape);
+
+        CheckReuse(trace, ReuseDistance::Infinity, ReuseDistance::Infinity, ReuseDistance::Infinity, ReuseDistance::WindowAuto, ReuseDistance::IndexHash);
+        CheckReuse(trace, ReuseDistance::Infinity, 8, ReuseDistance::Infinity, ReuseDistance::WindowAuto, ReuseDistance::IndexHash);
+        CheckReuse(trace, ReuseDistance::Infinity, 8, ReuseDistance::Infinity, ReuseDistance::WindowTree, ReuseDistance::IndexHash);
+
+        static const uint32_t windows[] = { ReuseDistance::WindowTree, ReuseDistance::WindowBitmap, ReuseDistance::WindowBTree };
+        for (uint32_t e = 0; e < 3; e++){
+            CheckReuse(trace, 1, ReuseDistance::Infinity, ReuseDistance::Infinity, windows[e], ReuseDistance::IndexHash);
+            CheckReuse(trace, 7, 3, ReuseDistance::Infinity, windows[e], ReuseDistance::IndexHash);
+
+            // around the size of the ReuseWindowFront
+            CheckReuse(trace, 16, ReuseDistance::Infinity, ReuseDistance::Infinity, windows[e], ReuseDistance::IndexHash);
+            CheckReuse(trace, 17, ReuseDistance::Infinity, ReuseDistance::Infinity, windows[e], ReuseDistance::IndexHash);
+            CheckReuse(trace, 20, 4, ReuseDistance::Infinity, windows[e], ReuseDistance::IndexHash);
+            CheckReuse(trace, 100, ReuseDistance::DefaultBinIndividual, ReuseDistance::Infinity, windows[e], ReuseDistance::IndexHash);
+            CheckReuse(trace, 700, 64, ReuseDistance::Infinity, windows[e], ReuseDistance::IndexHash);
+            CheckReuse(trace, 1500, 16, ReuseDistance::Infinity, windows[e], ReuseDistance::IndexHash);
+        }
+
+        CheckReuse(trace, ReuseDistance::Infinity, 8, ReuseDistance::Infinity, ReuseDistance::WindowTree, ReuseDistance::IndexPageTable);
+        CheckReuse(trace, 100, ReuseDistance::DefaultBinIndividual, ReuseDistance::Infinity, ReuseDistance::WindowTree, ReuseDistance::IndexPageTable);
+        CheckReuse(trace, 700, 64, ReuseDistance::Infinity, ReuseDistance::WindowBitmap, ReuseDistance::IndexPageTable);
+
+        // a budget that is never approached changes nothing
+        CheckReuse(trace, ReuseDistance::Infinity, 8, 1L << 30, ReuseDistance::WindowAuto, ReuseDistance::IndexHash);
+
+        CheckTime(trace, ReuseDistance::Infinity);
+        CheckTime(trace, 16);
+
+        CheckBytes(trace, ReuseDistance::Infinity, 64, 100);
+        CheckBytes(trace, 4000, 64, 100);
+        CheckBytes(trace, 150, ReuseDistance::Infinity, 200);
+        CheckBytes(trace, 37, 8, 1);
+
+        static const uint32_t engines[] = { SpatialLocality::EngineAuto, SpatialLocality::EngineMap,
+                                            SpatialLocality::EngineScan, SpatialLocality::EngineBlocked };
+        for (uint32_t e = 0; e < 4; e++){
+            CheckSpatial(trace, 1, 1, ReuseDistance::Infinity, engines[e]);
+            CheckSpatial(trace, 5, 5, 64, engines[e]);
+            CheckSpatial(trace, SpatialLocality::DefaultWindowSize, 8, ReuseDistance::Infinity, engines[e]);
+            CheckSpatial(trace, 600, 1, 4096, engines[e]);
+        }
+        CheckSpatial(trace, 3000, 16, ReuseDistance::Infinity, SpatialLocality::EngineMap);
+        CheckSpatial(trace, 3000, 16, ReuseDistance::Infinity, SpatialLocality::EngineBlocked);
+
+        static const uint64_t multisizes[] = { 1, 5, SpatialLocality::DefaultWindowSize, 600, 3000 };
+        vector<uint64_t> sizes(multisizes, multisizes + 5);
+        CheckMultiSpatial(trace, sizes, 8, ReuseDistance::Infinity);
+        sizes.resize(2);
+        CheckMultiSpatial(trace, sizes, 1, 64);
+        sizes.clear();
+        sizes.push_back(100);
+        sizes.push_back(700);
+        sizes.push_back(1000);
+        sizes.push_back(20000);
+        CheckMultiSpatial(trace, sizes, 16, ReuseDistance::Infinity);
+
+        CheckStride(trace, ReuseDistance::Infinity, ReuseDistance::Infinity);
+        CheckStride(trace, 16, ReuseDistance::Infinity);
+        CheckStride(trace, 4, 4096);
+
+        CheckThreaded(trace, ReuseDistance::Infinity, 8, 50, 3, false);
+        CheckThreaded(trace, 200, ReuseDistance::Infinity, 20, 2, true);
+
+        CheckSharded(trace, ReuseDistance::Infinity, 8, 3);
+        CheckSharded(trace, 50, ReuseDistance::Infinity, 1);
+        CheckSharded(trace, 7, 3, 4);
+
+        CheckScale(trace, ReuseDistance::Infinity, 1 + Choose(100));
+        CheckScale(trace, 8, 1 + Choose(100));
+
+        CheckExport(trace, ReuseDistance::Infinity, 8, ReuseExport::DefaultIds, ReuseExport::DefaultBins, 1000);
+        CheckExport(trace, 700, ReuseDistance::Infinity, 64, 300, 50);
+        CheckExport(trace, 100, 16, 3, 20, 1);
+    }
+
+    // long enough for the threaded and sharded analyzers to fill whole batches
+    state = seed;
+    TraceShape shape;
+    shape.length = 3 * ThreadedReuseDistance::BatchSize;
+    shape.universe = 2000;
+    shape.ids = 64;
+    shape.threads = 5;
+    shape.skipodds = 100000;
+    shape.invalidateodds = 200;
+    shape.local = 3;
+    Generate(trace, shape);
+    CheckThreaded(trace, 200, ReuseDistance::Infinity, 20, 3, true);
+    CheckSharded(trace, 50, 8, 3);
+
+    state = seed;
+    CheckBudget(ReuseDistance::Infinity, 2000000);
+    CheckBudget(100000, 1000000);
+
+    CheckWindows(20000, 100000, ReuseDistance::WindowBitmap, ReuseDistance::IndexHash);
+    CheckWindows(ReuseDistance::BitmapWindowLimit, 200000, ReuseDistance::WindowBitmap, ReuseDistance::IndexHash);
+    CheckWindows(20000, 1000000, ReuseDistance::WindowBitmap, ReuseDistance::IndexPageTable);
+    CheckWindows(20000, 100000, ReuseDistance::WindowBTree, ReuseDistance::IndexHash);
+    CheckWindows(300000, 1000000, ReuseDistance::WindowBTree, ReuseDistance::IndexPageTable);
+
+    CheckAnalyzerSet(1, 0);
+    CheckAnalyzerSet(64, 2);
+
+    CheckTraceReaders();
+
+    cout << "****** Differential tests passed (" << trials << " traces, " << comparisons << " histograms)" << ENDL;
+    return 0;
+}
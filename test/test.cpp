@@ -20,6 +20,9 @@
 
 #include <stdlib.h>
 #include <ReuseDistance.hpp>
+#include <ReuseIngest.hpp>
+
+#include <sstream>
 
 using namespace std;
 
@@ -29,8 +32,31 @@ using namespace std;
 #define SMALL_TEST (100)
 #define MEDIUM_TEST (444444)
 #define LARGE_TEST (3333333)
+#define INGEST_THREADS (4)
+#define DefaultBinIndividualTest (8)
 #define SEPERATOR "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n"
 
+// each thread feeds its own id through its own ReuseProducer
+struct IngestArgs {
+    ReuseIngest* ingest;
+    uint64_t id;
+};
+
+void* IngestThread(void* arg){
+    IngestArgs* a = (IngestArgs*)arg;
+    ReuseProducer* p = a->ingest->Register();
+    ReuseEntry entry = ReuseEntry();
+    entry.id = a->id;
+    for (uint32_t i = 0; i < 10; i++){
+        for (uint32_t j = 0; j < SMALL_TEST; j++){
+            entry.address = j + a->id * SMALL_TEST * 2;
+            p->Process(entry);
+        }
+    }
+    p->Flush();
+    return NULL;
+}
+
 int main(int argc, char* argv[]){
 
     uint32_t i, j;
@@ -66,13 +92,13 @@ int main(int argc, char* argv[]){
     cout << SEPERATOR;\
     r1->Print(true);\
     cout << SEPERATOR;\
-    r2->Print();\
+    r2->Print(cout, false, 4);\
     cout << SEPERATOR;\
     r3->Print();\
     cout << SEPERATOR;\
     s1->Print(true);\
     cout << SEPERATOR;\
-    s2->Print();\
+    s2->Print(cout, false, 3);\
     cout << SEPERATOR;\
     s3->Print();\
     cout << SEPERATOR;\
@@ -108,6 +134,103 @@ int main(int argc, char* argv[]){
     if (filter == 0 || filter == 8){
         __test_define("SHIFTRNG", TINY_TEST, TINY_TEST, (i % 2 == 0 ? (i) : (0)), (i % 2 == 0 ? (i+1) : (i*2)), 1);
     }
+    if (filter == 0 || filter == 9){
+        r1 = new ReuseDistance(ReuseDistance::Infinity);
+        ReuseIngest* ingest = new ReuseIngest(r1, ReuseIngest::PolicyBlock, 4, 16, 1);
+
+        pthread_t threads[INGEST_THREADS];
+        IngestArgs args[INGEST_THREADS];
+        for (i = 0; i < INGEST_THREADS; i++){
+            args[i].ingest = ingest;
+            args[i].id = i;
+            pthread_create(&threads[i], NULL, IngestThread, &args[i]);
+        }
+        for (i = 0; i < INGEST_THREADS; i++){
+            pthread_join(threads[i], NULL);
+        }
+        ingest->Drain();
+
+        cout << "INGEST TEST" << ENDL;
+        cout << SEPERATOR;
+        cout << ingest->GetProcessedCount() << TAB << ingest->GetDropCount() << ENDL;
+        delete ingest;
+
+        // distances depend on how the producers were interleaved, but cold misses do not
+        for (i = 0; i < INGEST_THREADS; i++){
+            ReuseStats* st = r1->GetStats(i);
+            cout << TAB << i << TAB << st->GetAccessCount() << TAB << st->GetMissCount() << ENDL;
+        }
+        cout << SEPERATOR;
+        cout << SEPERATOR;
+        delete r1;
+    }
+    if (filter == 0 || filter == 10){
+        // 3 threads walk over the same array, thread 0 writes while the others read
+        ThreadedReuseDistance* t1 = new ThreadedReuseDistance(ReuseDistance::Infinity, DefaultBinIndividualTest, SMALL_TEST, 2, false);
+        ThreadedReuseDistance* t2 = new ThreadedReuseDistance(SMALL_TEST, DefaultBinIndividualTest, SMALL_TEST * 2, 2, true);
+        ThreadedReuseEntry tentries[3 * SMALL_TEST];
+        for (i = 0; i < 10; i++){
+            for (j = 0; j < 3 * SMALL_TEST; j++){
+                tentries[j].id = j % 3;
+                tentries[j].address = (j / 3) * (i % 2 + 1);
+                tentries[j].thread = j % 3;
+                tentries[j].write = (j % 3 == 0);
+            }
+            t1->Process(tentries, 3 * SMALL_TEST);
+            t2->Process(tentries, 3 * SMALL_TEST);
+        }
+
+        cout << "THREADED TEST" << ENDL;
+        cout << SEPERATOR;
+        t1->Print(true);
+        cout << SEPERATOR;
+        t2->Print(cout, false, 2);
+        cout << SEPERATOR;
+        cout << SEPERATOR;
+        delete t1;
+        delete t2;
+    }
+    if (filter == 0 || filter == 11){
+        // the same stream fed directly and through an AnalyzerSet gives the same output
+        ReuseDistance* direct[4];
+        ReuseDistance* batched[4];
+        for (i = 0; i < 2; i++){
+            direct[i] = new ReuseDistance(SMALL_TEST / (i + 1), DefaultBinIndividualTest);
+            batched[i] = new ReuseDistance(SMALL_TEST / (i + 1), DefaultBinIndividualTest);
+            direct[i + 2] = new SpatialLocality(64 * (i + 1), 1, 32);
+            batched[i + 2] = new SpatialLocality(64 * (i + 1), 1, 32);
+        }
+        AnalyzerSet* set = new AnalyzerSet();
+        for (i = 0; i < 4; i++){
+            set->Add(batched[i]);
+        }
+
+        for (i = 0; i < SMALL_TEST; i++){
+            for (j = 0; j < i; j++){
+                entry.id = j % 3;
+                entry.address = (j * 7) % (SMALL_TEST / 2);
+                for (uint32_t k = 0; k < 4; k++){
+                    direct[k]->Process(entry);
+                }
+                set->Process(entry);
+            }
+        }
+        set->Flush();
+        delete set;
+
+        cout << "ANALYZERSET TEST" << ENDL;
+        cout << SEPERATOR;
+        for (i = 0; i < 4; i++){
+            ostringstream d, b;
+            direct[i]->Print(d);
+            batched[i]->Print(b);
+            cout << TAB << i << TAB << (d.str() == b.str() ? "same" : "different") << ENDL;
+            delete direct[i];
+            delete batched[i];
+        }
+        cout << SEPERATOR;
+        cout << SEPERATOR;
+    }
 
     return 0;
 }
@@ -115,6 +115,41 @@ int count234(tree234 *t) {
 	return 0;
 }
 
+/*
+ * Find the depth of a tree. Every leaf is at the same depth.
+ */
+int depth234(tree234 *t) {
+    int depth = 0;
+    node234 *n = t->root;
+    while (n) {
+	depth++;
+	n = n->kids[0];
+    }
+    return depth;
+}
+
+static int nodesnode234(node234 *n) {
+    int i, count = 1;
+    for (i = 0; i < 4; i++)
+	if (n->kids[i])
+	    count += nodesnode234(n->kids[i]);
+    return count;
+}
+
+/*
+ * Count the nodes in a tree.
+ */
+int nodes234(tree234 *t) {
+    if (t->root)
+	return nodesnode234(t->root);
+    else
+	return 0;
+}
+
+int nodesize234() {
+    return sizeof(node234);
+}
+
 /*
  * Add an element e to a 2-3-4 tree t. Returns e on success, or if
  * an existing element compares equal, returns that.
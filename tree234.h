@@ -150,4 +150,12 @@ ReuseEntry* delpos234(tree234 *t, int index);
  */
 int count234(tree234 *t);
 
+/*
+ * Return the number of levels in a tree234 (0 if it is empty), the
+ * number of nodes it holds, and the size in bytes of a single node.
+ */
+int depth234(tree234 *t);
+int nodes234(tree234 *t);
+int nodesize234();
+
 #endif /* TREE234_H */